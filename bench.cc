@@ -0,0 +1,305 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Per-character latency of single steps, see src/engine.h
+ *
+ * run like this: ./bench (B) (threads) (D) (steps)
+ *
+ * random parameters, M = 256; for every N: the generic path
+ * (one GEMM per product, separate passes for the bias, the gates,
+ * the cell, the softmax and the carried state, as in
+ * layers/lstm.h and layers/softmax.h), the engine on 1 thread and
+ * on threads threads, the same with bf16, fp16 and int8 weights,
+ * the largest difference of p between the generic path and the
+ * fp32 engine and the extra bits / char of the others (random
+ * text); int8 also runs on 1 thread, which should give the same
+ * p as on threads threads (integer sums), the run fails otherwise
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <thread>
+#include <memory>
+#include <math.h>
+
+#include <cblas.h>
+
+#include <containers/datatype.h>
+#include <timer.h>
+#include <engine.h>
+
+/* column-major parameters of one net and the generic single step */
+class Generic {
+
+	public:
+	
+		Generic ( size_t _M, size_t _N, size_t _D, size_t _B, std::mt19937 &rng ) : M ( _M ), N ( _N ), D ( _D ), B ( _B ) {
+		
+			std::uniform_real_distribution<dtype> uniform ( -1, 1 );
+			
+			W.resize ( D );
+			U.resize ( D );
+			b.resize ( D );
+			g.resize ( D );
+			h.resize ( D );
+			c.resize ( D );
+			
+			for ( size_t d = 0; d < D; d++ ) {
+			
+				size_t in = d == 0 ? M : N;
+				
+				W[d].resize ( in * 4 * N );
+				U[d].resize ( N * 4 * N );
+				b[d].resize ( 4 * N );
+				
+				for ( auto &w : W[d] ) w = uniform ( rng ) / sqrt ( in );
+				
+				for ( auto &w : U[d] ) w = uniform ( rng ) / sqrt ( N );
+				
+				for ( auto &w : b[d] ) w = uniform ( rng ) * 0.1;
+				
+				g[d].assign ( B * 4 * N, 0 );
+				h[d].assign ( 2 * B * N, 0 );
+				c[d].assign ( 2 * B * N, 0 );
+				
+			}
+			
+			Wy.resize ( N * M );
+			by.resize ( M );
+			
+			for ( auto &w : Wy ) w = uniform ( rng ) / sqrt ( N );
+			
+			for ( auto &w : by ) w = uniform ( rng ) * 0.1;
+			
+			x.assign ( B * M, 0 );
+			p.assign ( B * M, 0 );
+			sums.assign ( B, 0 );
+			
+		}
+		
+		void step ( const size_t *tokens ) {
+		
+			std::fill ( x.begin(), x.end(), 0 );
+			
+			for ( size_t r = 0; r < B; r++ )
+				if ( tokens[r] < M ) x[tokens[r] * B + r] = 1;
+				
+			const dtype *in = x.data();
+			
+			for ( size_t d = 0; d < D; d++ ) {
+			
+				dtype *gd = g[d].data(), *hd = h[d].data(), *cd = c[d].data();
+				
+				// [0, BN) - t - 1, [BN, 2BN) - t
+				cblas_gemm ( CblasColMajor, CblasNoTrans, CblasNoTrans, B, 4 * N, d == 0 ? M : N, 1, in, B, W[d].data(),
+							 d == 0 ? M : N, 0, gd, B );
+				cblas_gemm ( CblasColMajor, CblasNoTrans, CblasNoTrans, B, 4 * N, N, 1, hd, B, U[d].data(), N, 1, gd, B );
+				
+				for ( size_t j = 0; j < 4 * N; j++ )
+					for ( size_t r = 0; r < B; r++ )
+						gd[j * B + r] += b[d][j];
+						
+				for ( size_t j = 0; j < 3 * N * B; j++ )
+					gd[j] = logistic ( gd[j] );
+					
+				for ( size_t j = 3 * N * B; j < 4 * N * B; j++ )
+					gd[j] = _tanh ( gd[j] );
+					
+				for ( size_t j = 0; j < N * B; j++ )
+					cd[B * N + j] = gd[j] * gd[3 * N * B + j] + gd[2 * N * B + j] * cd[j];
+					
+				for ( size_t j = 0; j < N * B; j++ )
+					hd[B * N + j] = gd[N * B + j] * _tanh ( cd[B * N + j] );
+					
+				in = hd + B * N;
+				
+			}
+			
+			cblas_gemm ( CblasColMajor, CblasNoTrans, CblasNoTrans, B, M, N, 1, in, B, Wy.data(), N, 0, p.data(), B );
+			
+			for ( size_t m = 0; m < M; m++ )
+				for ( size_t r = 0; r < B; r++ )
+					p[m * B + r] += by[m];
+					
+			for ( size_t r = 0; r < B; r++ ) {
+			
+				dtype maximum = p[r];
+				
+				for ( size_t m = 0; m < M; m++ )
+					maximum = std::max ( maximum, p[m * B + r] );
+					
+				sums[r] = 0;
+				
+				for ( size_t m = 0; m < M; m++ ) {
+				
+					p[m * B + r] = _exp ( p[m * B + r] - maximum );
+					sums[r] += p[m * B + r];
+					
+				}
+				
+			}
+			
+			for ( size_t m = 0; m < M; m++ )
+				for ( size_t r = 0; r < B; r++ )
+					p[m * B + r] /= sums[r];
+					
+			// carryContext
+			for ( size_t d = 0; d < D; d++ ) {
+			
+				std::copy ( h[d].begin() + B * N, h[d].end(), h[d].begin() );
+				std::copy ( c[d].begin() + B * N, c[d].end(), c[d].begin() );
+				
+			}
+			
+		}
+		
+		const size_t M, N, D, B;
+		
+		std::vector<std::vector<dtype>> W, U, b;
+		std::vector<dtype> Wy, by;
+		
+		std::vector<std::vector<dtype>> g, h, c;
+		std::vector<dtype> x, p, sums;
+		
+};
+
+/* microseconds per step of f () */
+template <typename F>
+double measure ( size_t steps, const F &f ) {
+
+	for ( size_t i = 0; i < steps / 10 + 1; i++ )
+		f ( i );
+		
+	Timer timer;
+	timer.start();
+	
+	for ( size_t i = 0; i < steps; i++ )
+		f ( i );
+		
+	return timer.end() / steps * 1e6;
+	
+}
+
+int main ( int argc, char *argv[] ) {
+
+	const size_t    B               = argc > 1 ? atoi ( argv[1] ) : 1;
+	const size_t    threads         = argc > 2 ? atoi ( argv[2] ) : std::max<unsigned> ( 1, std::thread::hardware_concurrency() );
+	const size_t    D               = argc > 3 ? atoi ( argv[3] ) : 1;
+	const size_t    steps           = argc > 4 ? atoi ( argv[4] ) : 2000;
+	const size_t    M               = 256;
+	
+	if ( B < 1 || B > 4 || D < 1 ) {
+	
+		std::cout << "usage: " << argv[0] << " (B = 1, up to 4) (threads = cores) (D = 1) (steps = 2000)" << std::endl;
+		return -1;
+		
+	}
+	
+	std::mt19937 rng ( 1 );
+	
+	std::vector<size_t> tokens ( std::max<size_t> ( steps + steps / 10 + 1, 100 ) * B );
+	
+	for ( auto &t : tokens ) t = rng() % M;
+	
+	// engines: fp32 on 1 thread, fp32 / bf16 / fp16 / int8 on threads threads, int8 on 1 thread
+	const char *names[] = { "fp32", "fp32", "bf16", "fp16", "int8", "int8" };
+	const size_t variants = 6;
+	
+	auto single = [] ( size_t v ) { return v == 0 || v == 5; };
+	
+	std::cout << "B = " << B << ", D = " << D << ", us/char (one step of every stream), + bits/char vs fp32" << std::endl;
+	std::cout << std::setw ( 6 ) << "N" << std::setw ( 10 ) << "generic";
+	
+	for ( size_t v = 0; v < variants; v++ )
+		std::cout << std::setw ( 6 ) << names[v] << " x" << std::setw ( 2 ) << std::left << ( single ( v ) ? 1 : threads ) <<
+				  std::right;
+				  
+	std::cout << std::setw ( 10 ) << "max |dp|" << std::setw ( 8 ) << "+bf16" << std::setw ( 8 ) << "+fp16" << std::setw (
+				  8 ) << "+int8" << std::setw ( 10 ) << "int8 |dp|" << std::endl;
+				  
+	for ( size_t N : { 128, 256, 512, 1024, 2048 } ) {
+	
+		Generic generic ( M, N, D, B, rng );
+		std::vector<std::unique_ptr<Engine>> engines;
+		
+		for ( size_t v = 0; v < variants; v++ ) {
+		
+			engines.emplace_back ( new Engine ( M, N, D, B, single ( v ) ? 1 : threads ) );
+			
+			for ( size_t d = 0; d < D; d++ )
+				engines[v]->pack_layer ( d, generic.W[d].data(), generic.U[d].data(), generic.b[d].data() );
+				
+			engines[v]->pack_output ( generic.Wy.data(), generic.by.data() );
+			
+		}
+		
+		engines[2]->half ( HALF_BF16 );
+		engines[3]->half ( HALF_FP16 );
+		engines[4]->quantize();
+		engines[5]->quantize();
+		
+		// same inputs, compare p after every step
+		dtype difference = 0, threads_difference = 0;
+		std::vector<double> bits ( variants, 0 );
+		double reference = 0;
+		
+		for ( size_t i = 0; i + 1 < 100; i++ ) {
+		
+			generic.step ( &tokens[i * B] );
+			
+			for ( size_t v = 1; v < variants; v++ )
+				engines[v]->step ( &tokens[i * B] );
+				
+			for ( size_t r = 0; r < B; r++ ) {
+			
+				size_t next = tokens[ ( i + 1 ) * B + r];
+				
+				for ( size_t m = 0; m < M; m++ ) {
+				
+					difference = std::max ( difference, _fabs ( generic.p[m * B + r] - engines[1]->probabilities ( r ) [m] ) );
+					threads_difference = std::max ( threads_difference, _fabs ( engines[4]->probabilities ( r ) [m] -
+													engines[5]->probabilities ( r ) [m] ) );
+													
+				}
+				
+				reference -= log2 ( generic.p[next * B + r] );
+				
+				for ( size_t v = 1; v < variants; v++ )
+					bits[v] -= log2 ( engines[v]->probabilities ( r ) [next] );
+					
+			}
+			
+		}
+		
+		std::cout << std::fixed << std::setprecision ( 2 ) << std::setw ( 6 ) << N << std::setw ( 10 ) << measure ( steps, [&] (
+					  size_t i ) { generic.step ( &tokens[i * B] ); } );
+					  
+		for ( size_t v = 0; v < variants; v++ )
+			std::cout << std::setw ( 10 ) << measure ( steps, [&] ( size_t i ) { engines[v]->step ( &tokens[i * B] ); } );
+			
+		std::cout << std::scientific << std::setprecision ( 1 ) << std::setw ( 10 ) << difference << std::fixed <<
+				  std::setprecision ( 4 );
+				  
+		for ( size_t v = 2; v < 5; v++ )
+			std::cout << std::setw ( 8 ) << ( bits[v] - reference ) / ( 99 * B );
+			
+		std::cout << std::scientific << std::setprecision ( 1 ) << std::setw ( 10 ) << threads_difference << std::fixed <<
+				  std::endl;
+				  
+		// only the order of the float sums of the softmax differs
+		if ( threads_difference > 1e-5 ) {
+		
+			std::cout << "int8 on " << threads << " threads differs from 1 thread" << std::endl;
+			return -1;
+			
+		}
+		
+	}
+	
+	return 0;
+	
+}
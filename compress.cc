@@ -0,0 +1,224 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Compressor / decompressor, see src/compressor.h
+ *
+ * run like this:
+ *
+ *   ./compress c N snapshot input output (blocks) (GPU)
+ *   ./compress d N snapshot input output (GPU)
+ *
+ * decompression needs the same snapshot, build and GPU model;
+ * byte-level snapshots (M = 256, full softmax) only
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <memory>
+
+#include <stdlib.h>
+
+#include <containers/datatype.h>
+
+#include <serialization.h>
+#include <deeplstm.h>
+#include <compressor.h>
+
+bool read_file ( const std::string &filename, std::vector<uint8_t> &data ) {
+
+	std::ifstream in ( filename, std::ios::binary );
+	
+	if ( !in.is_open() ) {
+	
+		std::cout << "open error: (" << filename << ")" << std::endl;
+		return false;
+		
+	}
+	
+	data.assign ( std::istreambuf_iterator<char> ( in ), std::istreambuf_iterator<char>() );
+	return true;
+	
+}
+
+int main ( int argc, char *argv[] ) {
+
+	if ( argc < 6 || ( argv[1][0] != 'c' && argv[1][0] != 'd' ) ) {
+	
+		std::cout << "usage: " << argv[0] << " c N snapshot input output (blocks = 64) (GPU = 0)" << std::endl;
+		std::cout << "       " << argv[0] << " d N snapshot input output (GPU = 0)" << std::endl;
+		return -1;
+		
+	}
+	
+	const bool      decompress      = argv[1][0] == 'd';
+	const size_t    N               = atoi ( argv[2] );
+	std::string     snapshot        = argv[3];
+	const size_t    requested       = !decompress && argc > 6 ? atoi ( argv[6] ) : 64;
+	const int       gpu_number      = argc > ( decompress ? 6 : 7 ) ? atoi ( argv[decompress ? 6 : 7] ) : 0;
+	const size_t    M               = 256;
+	const size_t    D               = 1;
+	
+	std::vector<uint8_t> model, input;
+	
+	if ( !read_file ( snapshot, model ) || !read_file ( argv[4], input ) ) return -1;
+	
+	CompressedHeader header;
+	std::vector<std::vector<uint8_t>> blocks, coded;
+	
+	if ( decompress ) {
+	
+		std::ifstream in ( argv[4], std::ios::binary );
+		
+		if ( !header.read ( in ) ) {
+		
+			std::cout << "not a compressed file: (" << argv[4] << ")" << std::endl;
+			return -1;
+			
+		}
+		
+		if ( header.N != N || header.snapshot != fnv1a ( model.data(), model.size() ) ) {
+		
+			std::cout << "compressed with a different snapshot (N = " << header.N << ")" << std::endl;
+			return -1;
+			
+		}
+		
+		blocks.resize ( header.blocks );
+		coded.resize ( header.blocks );
+		
+		for ( size_t b = 0; b < header.blocks; b++ ) {
+		
+			uint64_t sizes[2];
+			in.read ( ( char * ) sizes, sizeof ( sizes ) );
+			blocks[b].resize ( sizes[0] );
+			coded[b].resize ( sizes[1] );
+			
+		}
+		
+		for ( size_t b = 0; b < header.blocks; b++ )
+			in.read ( ( char * ) coded[b].data(), coded[b].size() );
+			
+		if ( !in ) {
+		
+			std::cout << "truncated file: (" << argv[4] << ")" << std::endl;
+			return -1;
+			
+		}
+		
+	} else {
+	
+		// contiguous blocks of equal length, the last one shorter
+		size_t length = ( input.size() + std::max<size_t> ( 1, requested ) - 1 ) / std::max<size_t> ( 1, requested );
+		
+		for ( size_t first = 0; first < input.size(); first += length )
+			blocks.push_back ( std::vector<uint8_t> ( input.begin() + first, input.begin() + std::min ( input.size(),
+						   first + length ) ) );
+						
+		header.N = N;
+		header.snapshot = fnv1a ( model.data(), model.size() );
+		header.bytes = input.size();
+		header.checksum = fnv1a ( input.data(), input.size() );
+		header.blocks = blocks.size();
+		
+	}
+	
+	#ifdef __USE_CUDA__
+	// a fixed workspace, so that cuBLAS picks the same reduction order on every run (multiple streams)
+	setenv ( "CUBLAS_WORKSPACE_CONFIG", ":4096:8", 1 );
+	cudaSetDevice ( gpu_number );
+	init_cublas ( gpu_number );
+	#endif
+	
+	std::unique_ptr<DeepLSTM<MatrixType>> deeplstm;
+	double bits = 0;
+	Timer timer;
+	
+	if ( header.blocks > 0 ) {
+	
+		// one row per block, single steps
+		deeplstm.reset ( new DeepLSTM<MatrixType> ( M, N, header.blocks, 2, D ) );
+		
+		if ( !deeplstm->load ( snapshot ) ) return -1;
+		
+		if ( !deeplstm->inference_mode() ) return -1;
+		
+		Compressor<MatrixType> compressor ( *deeplstm );
+		
+		timer.start();
+		
+		if ( decompress ) compressor.decompress ( coded, blocks );
+		else bits = compressor.compress ( blocks, coded );
+		
+	}
+	
+	double seconds = header.blocks > 0 ? timer.end() : 0;
+	
+	std::ofstream out ( argv[5], std::ios::binary );
+	size_t written = 0;
+	
+	if ( decompress ) {
+	
+		std::vector<uint8_t> output;
+		
+		for ( size_t b = 0; b < blocks.size(); b++ )
+			output.insert ( output.end(), blocks[b].begin(), blocks[b].end() );
+			
+		if ( output.size() != header.bytes || fnv1a ( output.data(), output.size() ) != header.checksum ) {
+		
+			std::cout << "checksum mismatch, inference is not reproducible on this setup" << std::endl;
+			return -1;
+			
+		}
+		
+		out.write ( ( const char * ) output.data(), output.size() );
+		written = output.size();
+		
+	} else {
+	
+		header.write ( out );
+		
+		for ( size_t b = 0; b < blocks.size(); b++ ) {
+		
+			uint64_t sizes[2] = { blocks[b].size(), coded[b].size() };
+			out.write ( ( const char * ) sizes, sizeof ( sizes ) );
+			
+		}
+		
+		for ( size_t b = 0; b < coded.size(); b++ )
+			out.write ( ( const char * ) coded[b].data(), coded[b].size() );
+			
+		written = out.tellp();
+		
+	}
+	
+	if ( !out ) {
+	
+		std::cout << "write error: (" << argv[5] << ")" << std::endl;
+		return -1;
+		
+	}
+	
+	size_t compressed = decompress ? input.size() : written;
+	
+	std::cout << std::fixed << std::setprecision ( 3 ) << ( decompress ? "Decompressed " : "Compressed " ) << header.bytes <<
+			  " bytes in " << header.blocks << " blocks, " << header.bytes / ( seconds > 0 ? seconds : 1 ) / ( 1 << 20 ) <<
+			  " MB/s, " << compressed << " bytes, ratio " << ( double ) header.bytes / std::max<size_t> ( 1, compressed ) <<
+			  ", " << 8.0 * compressed / std::max<size_t> ( 1, header.bytes ) << " bits/byte";
+			
+	// coder overhead: headers, quantization, flushing
+	if ( !decompress ) std::cout << " (model " << bits / std::max<size_t> ( 1, header.bytes ) << ")";
+	
+	std::cout << std::endl;
+	
+	#ifdef __USE_CUDA__
+	teardown_cublas ();
+	#endif
+	
+	return 0;
+	
+}
@@ -4,7 +4,11 @@
  *
  * run like this
  *
- * ./deeplstm N B S GPU (test_every_seconds)
+ * ./deeplstm N B S GPU (test_every_seconds) (bptt_memory_MB) (spill_dir) (corpus) (bpe_vocabulary) (softmax_classes) (dynamic_k) (stash_bits) (resume_checkpoint) (seed)
+ *
+ * to skip an optional argument before the last one given, pass 0
+ * (spill_dir, resume_checkpoint: "0" or "" is off), e.g. to resume a default run:
+ * ./deeplstm 512 100 64 0 1000 0 0 data/enwik8 0 0 0 0 snapshots/<name>.ckpt
  *
  */
 
@@ -21,7 +25,10 @@
 #include <utils.h>
 
 #include <containers/io.h>
+#include <batcher.h>
 #include <serialization.h>
+#include <evaluator.h>
+#include <dynamic.h>
 
 #include <cuda.h>
 
@@ -40,8 +47,6 @@ int main ( int argc, char *argv[] ) {
 	
 	// hidden size
 	const size_t    N               = atoi ( argv[1] );
-	// vocab size (# of distinct observable events)
-	const size_t    M               = 256;
 	// sequence length for learning
 	const size_t    S               = atoi ( argv[2] );
 	// batch size
@@ -59,14 +64,38 @@ int main ( int argc, char *argv[] ) {
 	else
 		test_every      = 3600;
 		
+	// per-layer memory for BPTT states, checkpoint if exceeded (0 = keep all)
+	if ( argc > 6 )
+		Timelayer<MatrixType>::bptt_memory_budget = ( size_t ) atoi ( argv[6] ) << 20;
+		
+	// scratch directory for out-of-core BPTT (states spilled to a mapped file), "0" = off
+	if ( argc > 7 && std::string ( argv[7] ) != "0" )
+		Timelayer<MatrixType>::spill_directory = argv[7];
+		
+	// keep sigmoid / tanh outputs for backward in 8 or 16-bit fixed point (0 = dtype)
+	if ( argc > 12 )
+		Timelayer<MatrixType>::stash_bits = atoi ( argv[12] );
+		
+	if ( Timelayer<MatrixType>::stash_bits != 0 && Timelayer<MatrixType>::stash_bits != 8 &&
+			Timelayer<MatrixType>::stash_bits != 16 ) {
+			
+		std::cout << "stash_bits should be 0, 8 or 16" << std::endl;
+		return -1;
+		
+	}
+	
 	bool dropout = true;
 	
 	cudaSetDevice ( gpu_number );
 	
-	//MatrixXi 	_data           = rawread ( "data/large/enwiki-20160601-pages-articles.xml" );
+	// raw file or a directory made by ./pack, e.g. the full
+	// enwiki-20160601-pages-articles.xml, which does not fit in RAM
+	std::string 	corpus          = argc > 8 ? argv[8] : "data/enwik8";
+	
+	// .gz / .zst are decompressed on the fly, no random access; the first 2 blocks are valid / test
+	std::unique_ptr<BlockStream> stream ( BlockStream::compressed ( corpus ) ? new BlockStream ( corpus, 2 ) : nullptr );
 	
-	/* TODO: move to command line */
-	MatrixXi 	_data           = rawread ( "data/enwik8" );
+	Corpus 		_data           = stream ? Corpus() : Corpus ( corpus.c_str() );
 	std::string out_filename    	= "enwik8_lstm_0708f_N" + std::to_string ( N ) +
 									  "_S" + std::to_string ( S ) +
 									  "_B" + std::to_string ( B ) ;
@@ -76,6 +105,12 @@ int main ( int argc, char *argv[] ) {
 	const size_t    epochs          = 1000000;
 	const dtype     loss_dampening  = 0.999;
 	const dtype     reset_std       = 0.0;
+	// tokens fed before each stream of the full evaluation starts scoring
+	const size_t    burn_in         = 100;
+	// dynamic evaluation, an update every dynamic_k tokens (0 = off)
+	const size_t    dynamic_k       = argc > 11 ? atoi ( argv[11] ) : 0;
+	const dtype     dynamic_rate    = 1e-4;
+	const dtype     dynamic_decay   = 1e-3;
 	
 	// if true - loss in bits (lg2)
 	// if false - loss in nats (ln)
@@ -84,11 +119,20 @@ int main ( int argc, char *argv[] ) {
 	const float     train_percent   = 90.0f;
 	const float     valid_percent   = 5.0f;
 	
-	size_t serialize_every = 24; // * test_every, creates a large file
+	size_t serialize_every = 24; // * test_every, snapshots/<name>.ckpt (full training state)
 	size_t serialize_counter = 0;
 	
+	#ifdef __STASH_REPORT__
+	bool stash_reported = false;
+	#endif
+	
 	double test_loss_dampening = 0.0;
 	
+	// key of all random numbers (initial weights, dropout, batch positions), 0 = default; a resumed run keeps its own
+	const uint64_t  seed            = argc > 14 ? strtoull ( argv[14], nullptr, 0 ) : 0;
+	
+	if ( seed != 0 ) seed_rng ( seed );
+	
 	#ifdef __USE_CLBLAS__
 	init_clblas ();
 	#endif
@@ -107,19 +151,71 @@ int main ( int argc, char *argv[] ) {
 	
 	size_t percent_size = _data.size() / 100;
 	
-	// data used for training
-	MatrixXi data, test, valid;
+	// views into _data, nothing is copied
+	Corpus data, test, valid;
 	
-	data.block ( _data, 0, 0, train_percent * percent_size, 1 );
+	if ( stream ) {
 	
-	// data used for validation
-	valid.block ( _data, ( train_percent ) * percent_size, 0,
-				  valid_percent * percent_size, 1 );
-				  
-	// data used for testing
-	test.block ( _data, ( train_percent + valid_percent ) * percent_size, 0,
-				 _data.size() - ( train_percent + valid_percent ) * percent_size, 1 );
+		// the first two decoded blocks are held out
+		valid = stream->next();
+		test = stream->next();
+		data = stream->next();
+		
+	} else if ( _data.packed() ) {
+	
+		// boundaries recorded by the packer
+		data = _data.split ( 0 );
+		valid = _data.split ( 1 );
+		test = _data.split ( 2 );
+		
+	} else {
+	
+		// data used for training
+		data = _data.block ( 0, train_percent * percent_size );
+		
+		// data used for validation
+		valid = _data.block ( ( train_percent ) * percent_size,
+							  valid_percent * percent_size );
+							  
+		// data used for testing
+		test = _data.block ( ( train_percent + valid_percent ) * percent_size,
+							 _data.size() - ( train_percent + valid_percent ) * percent_size );
+							 
+	}
 				 
+	// subword vocabulary, learned once and cached next to the corpus (0 = bytes)
+	BPE bpe;
+	size_t vocabulary = argc > 9 ? atoi ( argv[9] ) : 0;
+	
+	if ( vocabulary > 256 ) {
+	
+		std::string vocabulary_file = corpus + ".bpe" + std::to_string ( vocabulary );
+		
+		if ( !bpe.load ( vocabulary_file ) ) {
+		
+			bpe.learn ( data, vocabulary, ( size_t ) 64 << 20 );
+			bpe.save ( vocabulary_file );
+			
+		}
+		
+		Timer encode_timer;
+		encode_timer.start();
+		
+		data = bpe.encode ( data );
+		valid = bpe.encode ( valid );
+		test = bpe.encode ( test );
+		
+		std::cout << "Encoded in " << encode_timer.end() << " s, " << data.tokens_per_byte << " tokens/byte" << std::endl;
+		
+	}
+	
+	// vocab size (# of distinct observable events)
+	const size_t    M               = bpe.size();
+	
+	// class-factored softmax with this many classes, about sqrt ( M ) (0 = full softmax)
+	size_t classes = argc > 10 ? atoi ( argv[10] ) : 0;
+	std::vector<size_t> counts = classes > 0 ? data.histogram ( M, ( size_t ) 64 << 20 ) : std::vector<size_t>();
+	
 	//std::cout << test << std::endl;
 	
 	// DEBUG code
@@ -136,34 +232,47 @@ int main ( int argc, char *argv[] ) {
 		new LSTM<MatrixType>	( 100, 100, 1, 5 ),
 		new Softmax<MatrixType> ( 100, 100, 1, 5 )
 		
-	} );
+	}, counts, classes );
 	
-	// this is an identity matrix that
-	// is used to encode inputs, 1 of K encoding
-	// (MATLAB's eye())
-	MatrixType codes ( M, M );
-	eye ( codes );
+	// continue from a checkpoint written below: parameters, optimizer memory, carried state, RNG and position
+	std::string resume = argc > 13 && std::string ( argv[13] ) != "0" ? argv[13] : "";
+	uint64_t first_epoch = 0, first_i = 0, resumed_iterations = 0;
+	double resumed_loss = -1;
 	
-	// temp matrix for storing input
-	std::vector<MatrixType> x ( S );
-	// targets - desired outputs
-	std::vector<MatrixType> target ( S );
+	if ( !resume.empty() ) {
 	
-	//zero them
-	for ( size_t t = 0; t < S; t++ ) {
-	
-		target[t].resize ( B, M );
-		x[t].resize ( B, M );
+		Checkpoint in;
+		uint64_t _B = 0, _S = 0;
+		
+		if ( !in.open ( resume ) || !in.read ( "train.B", _B ) || !in.read ( "train.S", _S ) )
+			return -1;
+			
+		if ( _B != B || _S != S ) {
+		
+			std::cout << "resume needs the same S and B as (" << resume << "), S = " << _S << ", B = " << _B << std::endl;
+			return -1;
+			
+		}
+		
+		if ( !deeplstm.restore ( in, true ) || !in.read ( "train.epoch", first_epoch ) || !in.read ( "train.i", first_i ) ||
+				!in.read ( "train.iterations", resumed_iterations ) || !in.read ( "train.smooth_loss", resumed_loss ) )
+			return -1;
+			
+		std::cout << "Resuming from (" << resume << "), epoch " << first_epoch << ", i = " << first_i << std::endl;
+		
+		if ( stream ) std::cout << "(" << corpus << " starts again at its first block)" << std::endl;
 		
 	}
 	
+	// inputs and targets - desired outputs, built one iteration ahead
+	Batcher<MatrixType> batcher ( data, M, B, S, epoch_length, stream.get(), vocabulary > 256 ? &bpe : nullptr,
+								  classes > 0, first_epoch, first_i / ( S - 1 ) );
+	
 	Timer epoch_timer, flops_timer, test_timer, main_timer;
 	
 	size_t length = data.rows();
-	size_t positions[B];
 	dtype loss, epoch_loss;
 	Matrix results;
-	size_t results_size = 0;
 	
 	// some approximation on the number of FlOPs
 	dtype flops_per_iteration = count_flops ( M, N, S, B ) * D;
@@ -175,30 +284,30 @@ int main ( int argc, char *argv[] ) {
 	test_timer.start();
 	main_timer.start();
 	
-	unsigned long iterations = 0L;
-	dtype smooth_loss = -1;
-	dtype train_error = -1;
-	dtype test_error = -1;
+	unsigned long iterations = resumed_iterations;
+	dtype smooth_loss = resumed_loss;
 	
 	deeplstm.sync_memory();
 	deeplstm.sync_params();
 	deeplstm.sync_grads_device();
 	
-	for ( size_t e = 0; e < epochs; e++ ) {
+	// adapts a copy of the snapshot's parameters while scoring valid / test
+	std::unique_ptr<DynamicEvaluation<MatrixType>> dynamic ( dynamic_k > 0 ? new DynamicEvaluation<MatrixType> ( deeplstm,
+			B, dynamic_k, dynamic_rate, dynamic_decay ) : nullptr );
+	DynamicEvaluation<MatrixType> *dynamic_evaluation = dynamic.get();
 	
-		//initial positions
-		
-		for ( size_t b = 0; b < B; b++ )
-		
-			positions[b] = rand() % ( length - epoch_length - 1 - S );
-			
-			
-		deeplstm.resetContext ( reset_std );
+	// sample / test on parameter snapshots, in the background
+	Evaluator<MatrixType> evaluator ( deeplstm, gpu_number );
+	
+	for ( size_t e = first_epoch; e < epochs; e++ ) {
+	
+		// a resumed epoch goes on from the carried state of the checkpoint
+		if ( e != first_epoch || first_i == 0 ) deeplstm.resetContext ( reset_std );
 		
 		epoch_timer.start();
 		flops_timer.start();
 		
-		for ( size_t i = 0; i < epoch_length; i += S - 1 ) {
+		for ( size_t i = e == first_epoch ? first_i : 0; i < epoch_length; i += S - 1 ) {
 		
 			loss = 0;
 			
@@ -225,43 +334,31 @@ int main ( int argc, char *argv[] ) {
 				gflops_per_sec = ( 1.0f * flops_per_iteration / powf ( 2,
 								   30 ) ) / flops_time;
 								   
-				PRINT_INFO();
+				double batch_wait = batcher.wait_time;
+				std::string input_info = stream ? ", decode " + to_string_with_precision ( stream->rate(), 1 ) + " MB/s" : "";
 				
-				flops_timer.start();
-			}
-			
-			for ( size_t t = 0; t < S; t++ ) {
-			
-				target[t].setZero();
-				x[t].setZero();
+				// last test of the evaluator, if any
+				dtype last_test_error = evaluator.get ( "test_error", -1 );
 				
-			}
-			
-			for ( size_t b = 0; b < B; b++ ) {
-			
-				size_t event = ( ( int * ) data.data() ) [positions[b]];      // current observation, uchar (0-255)
-				
-				for ( size_t t = 1; t < S; t++ ) {
-				
-					size_t ev_x = ( ( int * ) data.data() ) [positions[b] + t];
-					size_t ev_t = ( ( int * ) data.data() ) [positions[b] + t +
-								  1];
-								  
-					set_row_one_hot ( target[t], b, ev_t );
-					set_row_one_hot ( x[t], b, ev_x );
-					
-				}
+				if ( last_test_error >= 0 ) input_info += ", test " + to_string_with_precision ( last_test_error, 3 );
 				
-				positions[b] += S - 1;
+				PRINT_INFO();
 				
+				flops_timer.start();
 			}
 			
+			// filled by the batcher thread while the previous iteration ran
+			auto &batch = batcher.next();
+			std::vector<MatrixType> &x = batch.x;
+			std::vector<MatrixType> &target = batch.target;
+			
 			// std::cout << bytes_allocated_total << std::endl;
 			iterations++;
 			
-			deeplstm.forward ( dropout, x );
+			deeplstm.forward ( dropout, x, target );
 			
-			loss = deeplstm.loss ( target, 1, loss_in_bits );
+			// per original byte, comparable across vocabularies
+			loss = deeplstm.loss ( target, 1, loss_in_bits ) * data.tokens_per_byte;
 			//loss = deeplstm.cu_loss (target, 1, loss_in_bits );
 			
 			if ( !std::isnan ( loss ) && !std::isinf ( loss ) )
@@ -274,7 +371,17 @@ int main ( int argc, char *argv[] ) {
 			
 			if ( test_time > test_every ) {
 			
-				serialize_counter++;
+				#ifdef __STASH_REPORT__
+				
+				// same batch again without the stash, before the update; once, it needs fp32 states for all S steps
+				if ( deeplstm.layers[0]->stash && !stash_reported ) {
+				
+					deeplstm.stash_report ( dropout, x, target );
+					stash_reported = true;
+					
+				}
+				
+				#endif
 				
 				#ifdef __PRECISE_MATH__
 				
@@ -287,102 +394,151 @@ int main ( int argc, char *argv[] ) {
 				
 				#endif
 				
-				//dtype train_error = smooth_loss;
-				/*
-					- sample size
-					- min
-					- mean
-					- max
-					- std err
-				
-				*/
-				
-				/* sample */
-				//TODO: change to std::string
-				std::vector<char> generated_text = deeplstm.sample ( 5000,
-												   codes, " ", reset_std );
-												   
-				std::ofstream FILE ( "samples/" + out_filename +
-									 "_sample" "_" + to_string_with_precision ( test_error * 1000,
-											 0 ) + ".txt", std::ios::out | std::ofstream::binary );
-											 
-				std::copy ( generated_text.begin(), generated_text.end(),
-							std::ostreambuf_iterator<char> ( FILE ) );
-							
-				FILE.close();
-				/* end sample */
-				
-				/* test */
-				std::tuple<size_t, dtype, dtype, dtype, dtype> test_error_tuple, test2_error_tuple, train_error_tuple;
-				train_error_tuple = deeplstm.test_batch ( data, epoch_length / 10, codes, reset_std, loss_in_bits );
-				test_error_tuple = deeplstm.test_batch ( valid, epoch_length / 10, codes, reset_std, loss_in_bits );
-				test2_error_tuple = deeplstm.test_batch ( test, epoch_length / 10, codes, reset_std, loss_in_bits );
+				float progress = e + ( float ) ( i + 1 ) / ( float ) epoch_length;
 				
-				dtype avg_test_error = std::get<2> ( test_error_tuple );
-				dtype avg_train_error = std::get<2> ( train_error_tuple );
-				dtype avg_test2_error = std::get<2> ( test2_error_tuple );
-				
-				if ( !std::isnan ( avg_test_error ) && !std::isinf ( avg_test_error ) )
-					test_error = test_error < 0 ? avg_test_error : test_error *
-								 test_loss_dampening + ( 1 - test_loss_dampening ) * avg_test_error;
-								 
-				if ( !std::isnan ( avg_train_error )  && !std::isinf ( avg_train_error ) )
-					train_error = train_error < 0 ? avg_train_error : train_error *
-								  test_loss_dampening + ( 1 - test_loss_dampening ) * avg_train_error;
-								  
-								  
-				size_t test_length = test.rows();
+				serialize_counter++;
 				
-				// TODO: clean up
-				results_size++;
+				// runs on a snapshot of the parameters as of this iteration, training goes on
+				evaluator.submit ( [ =, &bpe, &evaluator ]
+				( DeepLSTM<MatrixType> &snapshot ) {
 				
-				/* TODO: move this somewhere */
-				std::string results =
-					to_string_with_precision ( results_size, 0 ) + " " +
-					to_string_with_precision ( ( e + ( float ) ( i + 1 ) / ( float ) epoch_length ), 1 ) + " " +
-					to_string_with_precision ( iterations, 0 ) + " " +
-					to_string_with_precision ( test_time, 0 ) + " " +
-					to_string_with_precision ( train_error, 3 ) + " " +
-					to_string_with_precision ( test_error, 3 ) + " " +
-					to_string_with_precision ( smooth_loss, 3 ) + " " +
-					to_string_with_precision ( gflops_per_sec, 1 ) + " " +
-					to_string_with_precision ( std::get<1> ( train_error_tuple ), 3 ) + " " +
-					to_string_with_precision ( std::get<3> ( train_error_tuple ), 3 ) + " " +
-					to_string_with_precision ( std::get<4> ( train_error_tuple ), 3 ) + " " +
-					to_string_with_precision ( std::get<1> ( test_error_tuple ), 3 ) + " " +
-					to_string_with_precision ( std::get<3> ( test_error_tuple ), 3 ) + " " +
-					to_string_with_precision ( std::get<4> ( test_error_tuple ), 3 ) + " " +
-					to_string_with_precision ( std::get<1> ( test2_error_tuple ), 3 ) + " " +
-					to_string_with_precision ( std::get<2> ( test2_error_tuple ), 3 ) + " " +
-					to_string_with_precision ( std::get<3> ( test2_error_tuple ), 3 ) + " " +
-					to_string_with_precision ( std::get<4> ( test2_error_tuple ), 3 );
+					// smoothed over the tests so far, kept by the evaluator (read by the main thread with get)
+					dtype train_error = evaluator.get ( "train_error", -1 );
+					dtype test_error = evaluator.get ( "test_error", -1 );
+					size_t results_size = evaluator.get ( "results", 0 );
 					
-				std::ofstream out ( "results/" + out_filename + ".txt", std::ofstream::out | std::ofstream::app );
-				
-				out << results << std::endl;
-				std::cout << results << std::endl;
-				out.close();
-				
-				/* end test */
-				
-				/* serialization */
-				if ( serialize_counter == serialize_every ) {
-				
-					std::cout << "Syncing CPU-GPU... " << std::flush;
-					deeplstm.sync_all_host();
-					std::cout << "Done." << std::endl;
-					std::cout << "Serializing... " << std::flush;
-					std::ofstream serialization_out ( "snapshots/" + out_filename + "_" + to_string_with_precision ( test_error * 1000,
-													  0 ) + ".json" );
-					//cereal::PortableBinaryOutputArchive archive_o(out);
-					cereal::JSONOutputArchive archive_o ( serialization_out );
-					archive_o ( deeplstm );
+					//dtype train_error = smooth_loss;
+					/*
+						- sample size
+						- min
+						- mean
+						- max
+						- std err
 					
-					std::cout << "Done." << std::endl;
-					serialize_counter = 0;
-				}
+					*/
+					
+					/* sample */
+					Timer sample_timer;
+					sample_timer.start();
+					
+					std::string generated_text = bpe.decode ( snapshot.sample ( 5000, " ",
+												 reset_std ) );
+												 
+					std::cout << std::endl << "Sampled " << to_string_with_precision ( generated_text.size() / sample_timer.end(),
+							  0 ) << " chars/s" << std::endl;
+							  
+					std::ofstream FILE ( "samples/" + out_filename +
+										 "_sample" "_" + to_string_with_precision ( test_error * 1000,
+												 0 ) + ".txt", std::ios::out | std::ofstream::binary );
+												 
+					std::copy ( generated_text.begin(), generated_text.end(),
+								std::ostreambuf_iterator<char> ( FILE ) );
+								
+					FILE.close();
+					/* end sample */
+					
+					/* test */
+					Corpus train_view = data, valid_view = valid, test_view = test;
+					std::tuple<size_t, dtype, dtype, dtype, dtype> test_error_tuple, test2_error_tuple, train_error_tuple;
+					train_error_tuple = snapshot.test_batch ( train_view, epoch_length / 10, reset_std, loss_in_bits );
+					test_error_tuple = snapshot.test_batch ( valid_view, epoch_length / 10, reset_std, loss_in_bits );
+					test2_error_tuple = snapshot.test_batch ( test_view, epoch_length / 10, reset_std, loss_in_bits );
+					
+					dtype avg_test_error = std::get<2> ( test_error_tuple );
+					dtype avg_train_error = std::get<2> ( train_error_tuple );
+					dtype avg_test2_error = std::get<2> ( test2_error_tuple );
+					
+					if ( !std::isnan ( avg_test_error ) && !std::isinf ( avg_test_error ) )
+						test_error = test_error < 0 ? avg_test_error : test_error *
+									 test_loss_dampening + ( 1 - test_loss_dampening ) * avg_test_error;
+									 
+					if ( !std::isnan ( avg_train_error )  && !std::isinf ( avg_train_error ) )
+						train_error = train_error < 0 ? avg_train_error : train_error *
+									  test_loss_dampening + ( 1 - test_loss_dampening ) * avg_train_error;
+									  
+					// TODO: clean up
+					results_size++;
+					
+					evaluator.set ( "train_error", train_error );
+					evaluator.set ( "test_error", test_error );
+					evaluator.set ( "results", results_size );
+					
+					/* TODO: move this somewhere */
+					// stamped with the iteration of the snapshot
+					std::string results =
+						to_string_with_precision ( results_size, 0 ) + " " +
+						to_string_with_precision ( progress, 1 ) + " " +
+						to_string_with_precision ( iterations, 0 ) + " " +
+						to_string_with_precision ( test_time, 0 ) + " " +
+						to_string_with_precision ( train_error, 3 ) + " " +
+						to_string_with_precision ( test_error, 3 ) + " " +
+						to_string_with_precision ( smooth_loss, 3 ) + " " +
+						to_string_with_precision ( gflops_per_sec, 1 ) + " " +
+						to_string_with_precision ( std::get<1> ( train_error_tuple ), 3 ) + " " +
+						to_string_with_precision ( std::get<3> ( train_error_tuple ), 3 ) + " " +
+						to_string_with_precision ( std::get<4> ( train_error_tuple ), 3 ) + " " +
+						to_string_with_precision ( std::get<1> ( test_error_tuple ), 3 ) + " " +
+						to_string_with_precision ( std::get<3> ( test_error_tuple ), 3 ) + " " +
+						to_string_with_precision ( std::get<4> ( test_error_tuple ), 3 ) + " " +
+						to_string_with_precision ( std::get<1> ( test2_error_tuple ), 3 ) + " " +
+						to_string_with_precision ( std::get<2> ( test2_error_tuple ), 3 ) + " " +
+						to_string_with_precision ( std::get<3> ( test2_error_tuple ), 3 ) + " " +
+						to_string_with_precision ( std::get<4> ( test2_error_tuple ), 3 );
+						
+					std::ofstream out ( "results/" + out_filename + ".txt", std::ofstream::out | std::ofstream::app );
+					
+					out << results << std::endl;
+					std::cout << std::endl << results << std::endl;
+					out.close();
+					
+					/* whole valid / test splits, exact */
+					std::tuple<size_t, dtype, dtype, dtype> valid_full, test_full;
+					valid_full = snapshot.test_full ( valid_view, burn_in, reset_std, loss_in_bits );
+					test_full = snapshot.test_full ( test_view, burn_in, reset_std, loss_in_bits );
+					
+					// iteration, valid, test, tokens/s, seconds
+					std::string full_results =
+						to_string_with_precision ( iterations, 0 ) + " " +
+						to_string_with_precision ( std::get<1> ( valid_full ), 4 ) + " " +
+						to_string_with_precision ( std::get<1> ( test_full ), 4 ) + " " +
+						to_string_with_precision ( std::get<2> ( test_full ), 0 ) + " " +
+						to_string_with_precision ( std::get<3> ( valid_full ) + std::get<3> ( test_full ), 1 );
+						
+					std::ofstream full_out ( "results/" + out_filename + "_full.txt", std::ofstream::out | std::ofstream::app );
+					
+					full_out << full_results << std::endl;
+					std::cout << full_results << std::endl;
+					full_out.close();
+					
+					/* dynamic evaluation of the same splits */
+					if ( dynamic_evaluation ) {
+					
+						std::tuple<size_t, dtype, dtype, dtype> valid_dynamic, test_dynamic;
+						valid_dynamic = dynamic_evaluation->score ( snapshot, valid_view, reset_std, loss_in_bits );
+						test_dynamic = dynamic_evaluation->score ( snapshot, test_view, reset_std, loss_in_bits );
+						
+						// iteration, valid, test, tokens/s, seconds, % of the time adapting, slowdown vs test_full
+						std::string dynamic_results =
+							to_string_with_precision ( iterations, 0 ) + " " +
+							to_string_with_precision ( std::get<1> ( valid_dynamic ), 4 ) + " " +
+							to_string_with_precision ( std::get<1> ( test_dynamic ), 4 ) + " " +
+							to_string_with_precision ( std::get<2> ( test_dynamic ), 0 ) + " " +
+							to_string_with_precision ( std::get<3> ( valid_dynamic ) + std::get<3> ( test_dynamic ), 1 ) + " " +
+							to_string_with_precision ( 100.0 * dynamic_evaluation->adapting / std::get<3> ( test_dynamic ), 1 ) + " " +
+							to_string_with_precision ( std::get<2> ( test_full ) / std::get<2> ( test_dynamic ), 2 );
+							
+						std::ofstream dynamic_out ( "results/" + out_filename + "_dynamic.txt", std::ofstream::out | std::ofstream::app );
+						
+						dynamic_out << dynamic_results << std::endl;
+						std::cout << dynamic_results << std::endl;
+						dynamic_out.close();
+						
+					}
+					
+					/* end test */
+					
+				} );
 				
-				/* end serialization */
 				test_timer.start();
 				
 			}
@@ -392,6 +548,34 @@ int main ( int argc, char *argv[] ) {
 			
 			//state(0) = state(last)
 			deeplstm.carryContext ( S - 1 );
+			
+			batcher.done();
+			
+			/* checkpoint, between two iterations, so that a resumed run continues with the next one */
+			if ( serialize_counter == serialize_every ) {
+			
+				bool last = i + S - 1 >= epoch_length;
+				
+				Checkpoint out;
+				deeplstm.checkpoint ( out );
+				
+				out.add ( "train.B", ( uint64_t ) B );
+				out.add ( "train.S", ( uint64_t ) S );
+				out.add ( "train.epoch", ( uint64_t ) ( last ? e + 1 : e ) );
+				out.add ( "train.i", ( uint64_t ) ( last ? 0 : i + S - 1 ) );
+				out.add ( "train.iterations", ( uint64_t ) iterations );
+				out.add ( "train.smooth_loss", ( double ) smooth_loss );
+				
+				Timer checkpoint_timer;
+				checkpoint_timer.start();
+				std::cout << "Checkpoint... " << std::flush;
+				
+				if ( out.write ( "snapshots/" + out_filename + ".ckpt" ) )
+					std::cout << "Done (" << to_string_with_precision ( checkpoint_timer.end(), 2 ) << " s)." << std::endl;
+					
+				serialize_counter = 0;
+				
+			}
 		}
 		
 	}
@@ -0,0 +1,100 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Packs a raw corpus into fixed-size shards + index
+ * (see src/containers/shards.h), reading it in one pass
+ * so that the input never has to fit in memory
+ *
+ * run like this: ./pack input outdir (shard_MB) (train_percent) (valid_percent)
+ *
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <containers/shards.h>
+
+int main ( int argc, char *argv[] ) {
+
+	if ( argc < 3 ) {
+	
+		std::cout << "usage: " << argv[0] << " input outdir (shard_MB = 64) (train_percent = 90) (valid_percent = 5)" <<
+				  std::endl;
+		return -1;
+		
+	}
+	
+	std::string input = argv[1];
+	std::string dir = argv[2];
+	
+	size_t shard_bytes = ( size_t ) ( argc > 3 ? atoi ( argv[3] ) : 64 ) << 20;
+	float train_percent = argc > 4 ? atof ( argv[4] ) : 90.0f;
+	float valid_percent = argc > 5 ? atof ( argv[5] ) : 5.0f;
+	
+	FILE *in = fopen ( input.c_str(), "rb" );
+	
+	if ( !in ) {
+	
+		std::cout << "fopen error: (" << input << ")" << std::endl;
+		return -1;
+		
+	}
+	
+	mkdir ( dir.c_str(), 0755 );
+	
+	ShardIndex index;
+	index.shard_bytes = shard_bytes;
+	
+	std::vector<uint8_t> buffer ( shard_bytes );
+	
+	while ( size_t length = fread ( &buffer[0], 1, shard_bytes, in ) ) {
+	
+		std::string name = shard_name ( dir, index.shards() );
+		FILE *out = fopen ( name.c_str(), "wb" );
+		
+		if ( !out || fwrite ( &buffer[0], 1, length, out ) != length ) {
+		
+			std::cout << "write error: (" << name << ")" << std::endl;
+			return -1;
+			
+		}
+		
+		fclose ( out );
+		
+		index.checksums.push_back ( fnv1a ( &buffer[0], length ) );
+		index.total_bytes += length;
+		
+		std::cout << "\r" << index.shards() << " shards, " << index.total_bytes / ( 1 << 20 ) << " MB" << std::flush;
+		
+	}
+	
+	fclose ( in );
+	
+	std::cout << std::endl;
+	
+	// same split as deeplstm.cc does for raw files
+	size_t percent_size = index.total_bytes / 100;
+	size_t valid_begin = train_percent * percent_size;
+	size_t test_begin = ( train_percent + valid_percent ) * percent_size;
+	
+	index.splits[0][0] = 0;				index.splits[0][1] = valid_begin;
+	index.splits[1][0] = valid_begin;	index.splits[1][1] = test_begin;
+	index.splits[2][0] = test_begin;	index.splits[2][1] = index.total_bytes;
+	
+	if ( !index.save ( dir ) ) {
+	
+		std::cout << "write error: (" << dir << "/index)" << std::endl;
+		return -1;
+		
+	}
+	
+	std::cout << "Packed " << index.total_bytes << " bytes into " << index.shards() << " shards (" << dir << ")" <<
+			  std::endl;
+			  
+	return 0;
+	
+}
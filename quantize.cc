@@ -0,0 +1,163 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Int8 inference vs fp32 on a snapshot, see src/engine.h
+ *
+ * run like this: ./quantize N snapshot corpus (threads) (bytes)
+ *
+ * the validation split of corpus (as in deeplstm.cc, at most
+ * bytes of it) is scored by the host engine with fp32 and with
+ * int8 weights, 4 contiguous streams; prints bpc of both, scoring
+ * chars / s and sampling us / char (1 stream, drawing every char);
+ * byte-level snapshots (M = 256, full softmax) only
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <thread>
+#include <math.h>
+
+#include <containers/datatype.h>
+#include <containers/io.h>
+
+#include <serialization.h>
+#include <deeplstm.h>
+#include <engine.h>
+
+/* one row of an engine's output, for Sampler::draw */
+typedef struct {
+
+	const dtype *p;
+	size_t M;
+	
+	size_t cols() const { return M; }
+	dtype operator() ( size_t row, size_t k ) const { return p[k]; }
+	
+} EngineRow;
+
+/* bits of length chars of valid over B streams, chars / s */
+double score ( Engine &engine, const Corpus &valid, size_t length, double &speed ) {
+
+	const size_t B = engine.B, stride = length / B;
+	std::vector<size_t> tokens ( B );
+	double bits = 0;
+	
+	Timer timer;
+	timer.start();
+	
+	for ( size_t b = 0; b < B; b++ )
+		engine.reset ( b );
+		
+	for ( size_t i = 0; i + 1 < stride; i++ ) {
+	
+		for ( size_t b = 0; b < B; b++ )
+			tokens[b] = valid[b * stride + i];
+			
+		engine.step ( tokens.data() );
+		
+		for ( size_t b = 0; b < B; b++ )
+			bits -= log2 ( engine.probabilities ( b ) [valid[b * stride + i + 1]] );
+			
+	}
+	
+	speed = B * ( stride - 1 ) / timer.end();
+	
+	return bits / ( B * ( stride - 1 ) );
+	
+}
+
+/* us / char of generating chars chars */
+double sample ( Engine &engine, size_t chars ) {
+
+	std::mt19937 rng ( 1 );
+	std::uniform_real_distribution<dtype> uniform ( 0, 1 );
+	Sampler sampler;
+	
+	size_t token = '\n';
+	
+	Timer timer;
+	timer.start();
+	
+	engine.reset ( 0 );
+	
+	for ( size_t i = 0; i < chars; i++ ) {
+	
+		engine.step ( &token );
+		
+		EngineRow row = { engine.probabilities ( 0 ), engine.M };
+		token = sampler.draw ( row, 0, 1 - uniform ( rng ) );
+		
+	}
+	
+	return timer.end() / chars * 1e6;
+	
+}
+
+int main ( int argc, char *argv[] ) {
+
+	if ( argc < 4 ) {
+	
+		std::cout << "usage: " << argv[0] << " N snapshot corpus (threads = cores) (bytes = 1M)" << std::endl;
+		return -1;
+		
+	}
+	
+	const size_t    N               = atoi ( argv[1] );
+	std::string     snapshot        = argv[2];
+	const size_t    threads         = argc > 4 ? atoi ( argv[4] ) : std::max<unsigned> ( 1, std::thread::hardware_concurrency() );
+	const size_t    bytes           = argc > 5 ? atoi ( argv[5] ) : 1 << 20;
+	const size_t    M               = 256;
+	const size_t    D               = 1;
+	const size_t    streams         = 4;
+	
+	Corpus data ( argv[3] );
+	
+	if ( data.size() == 0 ) return -1;
+	
+	Corpus valid = data.packed() ? data.split ( 1 ) : data.block ( 90 * ( data.size() / 100 ), 5 * ( data.size() / 100 ) );
+	size_t length = std::min ( bytes, valid.size() );
+	
+	#ifdef __USE_CUDA__
+	init_cublas ( 0 );
+	#endif
+	
+	DeepLSTM<MatrixType> deeplstm ( M, N, 1, 2, D );
+	
+	if ( !deeplstm.load ( snapshot ) ) return -1;
+	
+	Engine fp32 ( M, N, D, streams, threads ), int8 ( M, N, D, streams, threads );
+	Engine fp32_single ( M, N, D, 1, threads ), int8_single ( M, N, D, 1, threads );
+	
+	for ( Engine *engine : { &fp32, &int8, &fp32_single, &int8_single } )
+		if ( !engine->pack ( deeplstm ) ) return -1;
+		
+	int8.quantize();
+	int8_single.quantize();
+	
+	double speed, speed_int8;
+	double bpc = score ( fp32, valid, length, speed );
+	double bpc_int8 = score ( int8, valid, length, speed_int8 );
+	
+	std::cout << std::fixed << std::setprecision ( 4 ) << "valid (" << length << " bytes): fp32 " << bpc << " bpc, int8 " <<
+			  bpc_int8 << " bpc (" << std::showpos << bpc_int8 - bpc << std::noshowpos << ")" << std::endl;
+			
+	std::cout << std::setprecision ( 1 ) << "weights: fp32 " << fp32.weight_bytes() / 1024.0 << " kB, int8 " <<
+			  int8.weight_bytes() / 1024.0 << " kB" << std::endl;
+			
+	std::cout << "scoring (" << streams << " streams, " << threads << " threads): fp32 " << speed << " chars/s, int8 " <<
+			  speed_int8 << " chars/s" << std::endl;
+			
+	std::cout << std::setprecision ( 2 ) << "sampling (1 stream): fp32 " << sample ( fp32_single, 2000 ) << " us/char, int8 "
+			  << sample ( int8_single, 2000 ) << " us/char" << std::endl;
+			
+	#ifdef __USE_CUDA__
+	teardown_cublas ();
+	#endif
+	
+	return 0;
+	
+}
@@ -0,0 +1,148 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Reranking candidates which share prefixes, see src/prefix.h
+ *
+ * run like this: ./rerank N snapshot candidates (B) (cache_MB) (GPU)
+ *
+ * candidates - a text file, one candidate per line; they are
+ * scored together by PrefixScorer (B rows per step, cache_MB of
+ * cached states) and, as a reference, one by one from a reset
+ * state; prints the candidates by bits per byte, the largest
+ * difference between the two scores and the time of both;
+ * byte-level snapshots (M = 256, full softmax) only
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <math.h>
+
+#include <containers/datatype.h>
+
+#include <serialization.h>
+#include <deeplstm.h>
+#include <prefix.h>
+
+/* -log2 p of every byte but the first, one string at a time */
+std::vector<double> reference ( DeepLSTM<MatrixType> &net, const std::vector<std::string> &strings ) {
+
+	std::vector<double> bits ( strings.size(), 0 );
+	MatrixType x ( 1, net.M );
+	
+	for ( size_t k = 0; k < strings.size(); k++ ) {
+	
+		net.resetContext ( 0 );
+		
+		for ( size_t i = 0; i + 1 < strings[k].size(); i++ ) {
+		
+			x.setZero();
+			set_row_one_hot ( x, 0, ( unsigned char ) strings[k][i] );
+			
+			net.forward ( false, x );
+			net.carryContext ( 1 );
+			
+			bits[k] -= log2 ( net.probability ( 0, ( unsigned char ) strings[k][i + 1] ) );
+			
+		}
+		
+	}
+	
+	return bits;
+	
+}
+
+int main ( int argc, char *argv[] ) {
+
+	if ( argc < 4 ) {
+	
+		std::cout << "usage: " << argv[0] << " N snapshot candidates (B = 64) (cache_MB = 256) (GPU = 0)" << std::endl;
+		return -1;
+		
+	}
+	
+	const size_t    N               = atoi ( argv[1] );
+	std::string     snapshot        = argv[2];
+	const size_t    B               = argc > 4 ? atoi ( argv[4] ) : 64;
+	const size_t    cache_MB        = argc > 5 ? atoi ( argv[5] ) : 256;
+	const int       gpu_number      = argc > 6 ? atoi ( argv[6] ) : 0;
+	const size_t    M               = 256;
+	const size_t    D               = 1;
+	
+	std::ifstream in ( argv[3] );
+	std::vector<std::string> candidates;
+	std::string line;
+	
+	// at least one scored byte each
+	while ( std::getline ( in, line ) )
+		if ( line.size() > 1 ) candidates.push_back ( line );
+		
+	if ( candidates.empty() ) {
+	
+		std::cout << "no candidates: (" << argv[3] << ")" << std::endl;
+		return -1;
+		
+	}
+	
+	#ifdef __USE_CUDA__
+	cudaSetDevice ( gpu_number );
+	init_cublas ( gpu_number );
+	#endif
+	
+	DeepLSTM<MatrixType> deeplstm ( M, N, 1, 2, D );
+	
+	if ( !deeplstm.load ( snapshot ) ) return -1;
+	
+	// single steps, B rows for the trie and 1 for the reference
+	DeepLSTM<MatrixType> batched ( deeplstm, B, 2 ), single ( deeplstm, 1, 2 );
+	
+	if ( !batched.in_inference_mode() || !single.in_inference_mode() ) return -1;
+	
+	PrefixScorer<MatrixType> scorer ( batched, cache_MB << 20 );
+	std::vector<double> bits = scorer.score ( candidates );
+	
+	Timer timer;
+	timer.start();
+	
+	std::vector<double> expected = reference ( single, candidates );
+	double reference_seconds = timer.end();
+	
+	double largest = 0;
+	std::vector<size_t> order ( candidates.size() );
+	
+	for ( size_t k = 0; k < candidates.size(); k++ ) {
+	
+		largest = std::max ( largest, fabs ( bits[k] - expected[k] ) );
+		order[k] = k;
+		
+	}
+	
+	std::sort ( order.begin(), order.end(), [&] ( size_t a, size_t b ) {
+	
+		return bits[a] / ( candidates[a].size() - 1 ) < bits[b] / ( candidates[b].size() - 1 );
+		
+	} );
+	
+	for ( size_t k : order )
+		std::cout << std::fixed << std::setprecision ( 4 ) << bits[k] / ( candidates[k].size() - 1 ) << " " << candidates[k] <<
+				  std::endl;
+				
+	std::cout << std::endl << candidates.size() << " candidates, " << scorer.tokens << " bytes, " << scorer.trie_nodes <<
+			  " trie nodes, " << scorer.steps << " steps, " << scorer.recomputed << " recomputed, cache " << scorer.hits <<
+			  " hits / " << scorer.misses << " misses / " << scorer.evictions << " evictions" << std::endl;
+			
+	std::cout << "trie " << std::setprecision ( 3 ) << scorer.seconds << " s, one by one " << reference_seconds <<
+			  " s, largest difference " << std::scientific << largest << " bits" << std::endl;
+			
+	#ifdef __USE_CUDA__
+	teardown_cublas ();
+	#endif
+	
+	return 0;
+	
+}
@@ -0,0 +1,66 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Scoring and generation for local clients, see src/server.h
+ *
+ * run like this: ./serve N snapshot socket (streams) (GPU) (bpe_merges)
+ *
+ * N and the vocabulary (bpe_merges, i.e. corpus.bpe<size>) must
+ * be those the snapshot was trained with; full softmax only
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include <containers/datatype.h>
+
+#include <serialization.h>
+#include <deeplstm.h>
+#include <server.h>
+
+int main ( int argc, char *argv[] ) {
+
+	if ( argc < 4 ) {
+	
+		std::cout << "usage: " << argv[0] << " N snapshot socket (streams = 32) (GPU = 0) (bpe_merges)" << std::endl;
+		return -1;
+		
+	}
+	
+	const size_t    N               = atoi ( argv[1] );
+	std::string     snapshot        = argv[2];
+	std::string     path            = argv[3];
+	const size_t    streams         = argc > 4 ? atoi ( argv[4] ) : 32;
+	const int       gpu_number      = argc > 5 ? atoi ( argv[5] ) : 0;
+	const size_t    D               = 1;
+	
+	BPE bpe;
+	
+	if ( argc > 6 && !bpe.load ( argv[6] ) ) return -1;
+	
+	#ifdef __USE_CUDA__
+	cudaSetDevice ( gpu_number );
+	init_cublas ( gpu_number );
+	#endif
+	
+	// one row per concurrent stream, single steps
+	DeepLSTM<MatrixType> deeplstm ( bpe.size(), N, streams, 2, D );
+	
+	if ( !deeplstm.load ( snapshot ) ) return -1;
+	
+	if ( !deeplstm.inference_mode() ) return -1;
+	
+	Server<MatrixType> server ( deeplstm, bpe );
+	
+	if ( !server.run ( path ) ) return -1;
+	
+	#ifdef __USE_CUDA__
+	teardown_cublas ();
+	#endif
+	
+	return 0;
+	
+}
@@ -0,0 +1,185 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Many interleaved streams on one model, see src/session.h
+ *
+ * run like this: ./sessions N snapshot corpus (sessions) (rows) (bytes) (GPU)
+ *
+ * the validation split of corpus (as in deeplstm.cc) is cut into
+ * one piece of bytes per session; the sessions are stepped in
+ * groups of rows, so with more sessions than rows every group
+ * parks the one before it, and every 64 steps one session is
+ * turned into bytes (snapshot), closed and restored; the bits of
+ * every piece are compared with scoring it alone from a reset
+ * state; prints the largest difference, the rows copied in / out
+ * and tokens / s; byte-level snapshots (M = 256, full softmax)
+ * only
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include <containers/datatype.h>
+#include <containers/io.h>
+
+#include <serialization.h>
+#include <deeplstm.h>
+#include <session.h>
+
+/* -log2 p of every byte of valid [ offset, offset + length ) but the first */
+double reference ( DeepLSTM<MatrixType> &net, const Corpus &valid, size_t offset, size_t length ) {
+
+	MatrixType x ( 1, net.M );
+	double bits = 0;
+	
+	net.resetContext ( 0 );
+	
+	for ( size_t i = offset; i + 1 < offset + length; i++ ) {
+	
+		x.setZero();
+		set_row_one_hot ( x, 0, valid[i] );
+		
+		net.forward ( false, x );
+		net.carryContext ( 1 );
+		
+		bits -= log2 ( net.probability ( 0, valid[i + 1] ) );
+		
+	}
+	
+	return bits;
+	
+}
+
+int main ( int argc, char *argv[] ) {
+
+	if ( argc < 4 ) {
+	
+		std::cout << "usage: " << argv[0] << " N snapshot corpus (sessions = 64) (rows = 16) (bytes = 1024) (GPU = 0)" <<
+				  std::endl;
+		return -1;
+		
+	}
+	
+	const size_t    N               = atoi ( argv[1] );
+	std::string     snapshot        = argv[2];
+	const size_t    count           = argc > 4 ? atoi ( argv[4] ) : 64;
+	const size_t    rows            = argc > 5 ? atoi ( argv[5] ) : 16;
+	const size_t    length          = argc > 6 ? atoi ( argv[6] ) : 1024;
+	const int       gpu_number      = argc > 7 ? atoi ( argv[7] ) : 0;
+	const size_t    M               = 256;
+	const size_t    D               = 1;
+	
+	Corpus data ( argv[3] );
+	
+	if ( data.size() == 0 ) return -1;
+	
+	Corpus valid = data.packed() ? data.split ( 1 ) : data.block ( 90 * ( data.size() / 100 ), 5 * ( data.size() / 100 ) );
+	
+	if ( count == 0 || rows == 0 || length < 2 || valid.size() < count * length ) {
+	
+		std::cout << "the validation split has " << valid.size() << " bytes, " << count << " sessions of " << length <<
+				  " bytes do not fit" << std::endl;
+		return -1;
+		
+	}
+	
+	#ifdef __USE_CUDA__
+	cudaSetDevice ( gpu_number );
+	init_cublas ( gpu_number );
+	#endif
+	
+	DeepLSTM<MatrixType> deeplstm ( M, N, 1, 2, D );
+	
+	if ( !deeplstm.load ( snapshot ) ) return -1;
+	
+	// single steps, rows for the sessions and 1 for the reference
+	DeepLSTM<MatrixType> net ( deeplstm, rows, 2 ), single ( deeplstm, 1, 2 );
+	
+	if ( !net.in_inference_mode() || !single.in_inference_mode() ) return -1;
+	
+	Sessions<MatrixType> sessions ( net );
+	
+	std::vector<size_t> ids ( count );
+	std::vector<double> bits ( count, 0 );
+	size_t restored = 0;
+	
+	for ( size_t k = 0; k < count; k++ )
+		ids[k] = sessions.open();
+		
+	Timer timer;
+	timer.start();
+	
+	for ( size_t i = 0; i + 1 < length; i++ ) {
+	
+		for ( size_t first = 0; first < count; first += rows ) {
+		
+			std::vector<size_t> group, tokens;
+			
+			for ( size_t k = first; k < std::min ( count, first + rows ); k++ ) {
+			
+				group.push_back ( ids[k] );
+				tokens.push_back ( valid[k * length + i] );
+				
+			}
+			
+			if ( !sessions.step ( group, tokens ) ) return -1;
+			
+			for ( size_t j = 0; j < group.size(); j++ ) {
+			
+				dtype p;
+				
+				if ( !sessions.probability ( group[j], valid[ ( first + j ) * length + i + 1], p ) ) return -1;
+				
+				bits[first + j] -= log2 ( p );
+				
+			}
+			
+		}
+		
+		// a round trip through bytes, the stream goes on from the restored session
+		if ( i % 64 == 63 ) {
+		
+			size_t k = ( i / 64 ) % count;
+			std::vector<uint8_t> saved = sessions.snapshot ( ids[k] );
+			
+			sessions.close ( ids[k] );
+			ids[k] = sessions.restore ( saved );
+			
+			if ( ids[k] == 0 ) return -1;
+			
+			restored++;
+			
+		}
+		
+	}
+	
+	double seconds = timer.end();
+	double largest = 0, total = 0;
+	
+	for ( size_t k = 0; k < count; k++ ) {
+	
+		largest = std::max ( largest, fabs ( bits[k] - reference ( single, valid, k * length, length ) ) );
+		total += bits[k];
+		
+	}
+	
+	std::cout << count << " sessions in " << rows << " rows, " << std::fixed << std::setprecision ( 4 ) << total /
+			  ( count * ( length - 1 ) ) << " bits / byte, " << std::setprecision ( 0 ) << count * ( length - 1 ) / seconds <<
+			  " tokens / s" << std::endl;
+			
+	std::cout << sessions.loads << " rows loaded, " << sessions.stores << " stored, " << restored <<
+			  " snapshot / restore round trips, largest difference to a single stream " << std::scientific <<
+			  std::setprecision ( 3 ) << largest << " bits" << std::endl;
+			
+	#ifdef __USE_CUDA__
+	teardown_cublas ();
+	#endif
+	
+	return 0;
+	
+}
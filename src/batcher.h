@@ -0,0 +1,236 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Batch construction in a background thread
+ *
+ * The producer fills the inputs and targets of iteration i + 1
+ * into one buffer set while iteration i trains on the other;
+ * buffer indices go back and forth through two lock-free
+ * single-producer / single-consumer queues. Batch positions
+ * come from Philox (keyed by epoch), not from rand(), so the
+ * producer does not share RNG state with the main thread.
+ *
+ * With a BlockStream (compressed input), positions are drawn
+ * from the current decoded block, which is replaced by the next
+ * one every block_bytes / (B * epoch_length) epochs.
+ *
+ * A resumed run starts at ( first_epoch, first_iteration ), where
+ * the positions are the same as in the run it was saved from
+ * (without a BlockStream, which starts again at its first block).
+ *
+ */
+
+#ifndef __BATCHER_H__
+#define __BATCHER_H__
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include <containers/io.h>
+#include <containers/stream.h>
+#include <containers/bpe.h>
+#include <containers/spsc_queue.h>
+#include <timer.h>
+
+template <typename T>
+class Batcher {
+
+	public:
+	
+		/* x[t] and target[t], t = 1 .. S - 1 */
+		typedef struct {
+		
+			std::vector<T> x, target;
+			
+		} Batch;
+		
+		Batcher ( Corpus &_data, size_t _M, size_t _B, size_t _S, size_t _epoch_length, BlockStream *_stream = nullptr,
+				  const BPE *_bpe = nullptr, bool _target_ids = false, uint32_t _first_epoch = 0, size_t _first_iteration = 0 ) :
+			data ( _data ), M ( _M ), B ( _B ), S ( _S ), epoch_length ( _epoch_length ),
+			positions ( _B ), stream ( _stream ), bpe ( _bpe ), target_ids ( _target_ids ),
+			first_epoch ( _first_epoch ), first_iteration ( _first_iteration ) {
+			
+			for ( size_t k = 0; k < 2; k++ ) {
+			
+				buffers[k].x.resize ( S );
+				buffers[k].target.resize ( S );
+				
+				for ( size_t t = 0; t < S; t++ ) {
+				
+					buffers[k].x[t].resize ( B, M );
+					buffers[k].target[t].resize ( B, target_ids ? 1 : M );
+					
+				}
+				
+				free.push ( k );
+				
+			}
+			
+			// positions are drawn from [ 0, size - epoch_length - S - 1 )
+			if ( data.size() < epoch_length + S + 2 ) {
+			
+				std::cout << "Batcher() : " << data.size() << " tokens of training data, at least epoch_length + S + 2 = " <<
+						  epoch_length + S + 2 << " needed" << std::endl;
+				exit ( -1 );
+				
+			}
+			
+			producer = std::thread ( &Batcher::produce, this );
+			
+		}
+		
+		~Batcher() {
+		
+			stop = true;
+			producer.join();
+			
+		}
+		
+		/* batches of the main loop, in order; blocks if not ready */
+		Batch &next() {
+		
+			if ( !ready.pop ( current ) ) {
+			
+				Timer timer;
+				timer.start();
+				
+				while ( !ready.pop ( current ) )
+					std::this_thread::yield();
+					
+				wait_time += timer.end();
+				
+			}
+			
+			return buffers[current];
+			
+		}
+		
+		/* the batch returned by next() is no longer needed */
+		void done() {
+		
+			free.push ( current );
+			
+		}
+		
+		/* seconds the main loop spent in next() */
+		double wait_time = 0.0;
+		
+	protected:
+	
+		void produce() {
+		
+			size_t iterations = ( epoch_length + S - 2 ) / ( S - 1 );
+			size_t epochs_per_block = stream ? std::max<size_t> ( 1, stream->block_bytes / ( B * epoch_length ) ) : 0;
+			
+			for ( uint32_t e = first_epoch; !stop; e++ ) {
+			
+				// sequential window, the last block of a pass may be too short
+				if ( stream && e > first_epoch && e % epochs_per_block == 0 ) {
+				
+					size_t short_blocks = 0;
+					
+					do {
+					
+						data = stream->next();
+						
+						if ( bpe ) data = bpe->encode ( data );
+						
+						// only the last block of a pass can be short, not two in a row
+						if ( data.size() < epoch_length + S + 2 && ++short_blocks > 1 ) {
+						
+							std::cout << "Batcher() : decoded blocks are shorter than epoch_length + S + 2 = " << epoch_length + S + 2 <<
+									  std::endl;
+							exit ( -1 );
+							
+						}
+						
+					} while ( data.size() < epoch_length + S + 2 );
+					
+				}
+					
+				size_t length = data.size();
+				size_t first = e == first_epoch ? first_iteration : 0;
+				
+				// initial positions, moved past the iterations done before a resume
+				for ( size_t b = 0; b < B; b++ )
+					positions[b] = philox4x32 ( make_philox_key ( philox_seed, PHILOX_BATCH_STREAM, e ), b ).x[0] %
+								   ( length - epoch_length - 1 - S ) + first * ( S - 1 );
+								
+				for ( size_t i = first; i < iterations && !stop; i++ ) {
+				
+					size_t k;
+					
+					while ( !free.pop ( k ) ) {
+					
+						if ( stop ) return;
+						
+						std::this_thread::sleep_for ( std::chrono::microseconds ( 50 ) );
+						
+					}
+					
+					fill ( buffers[k] );
+					ready.push ( k );
+					
+				}
+				
+			}
+			
+		}
+		
+		void fill ( Batch &batch ) {
+		
+			for ( size_t t = 0; t < S; t++ ) {
+			
+				batch.target[t].setZero();
+				batch.x[t].setZero();
+				
+			}
+			
+			for ( size_t b = 0; b < B; b++ ) {
+			
+				for ( size_t t = 1; t < S; t++ ) {
+				
+					size_t ev_x = data[positions[b] + t];
+					size_t ev_t = data[positions[b] + t + 1];
+					
+					if ( target_ids ) batch.target[t] ( b, 0 ) = ev_t;
+					else set_row_one_hot ( batch.target[t], b, ev_t );
+					
+					set_row_one_hot ( batch.x[t], b, ev_x );
+					
+				}
+				
+				positions[b] += S - 1;
+				
+			}
+			
+		}
+		
+		Corpus data;
+		size_t M, B, S, epoch_length;
+		std::vector<size_t> positions;
+		
+		BlockStream *stream;
+		const BPE *bpe;
+		
+		/* B x 1 token ids instead of one-hot targets (class-factored output) */
+		bool target_ids;
+		
+		uint32_t first_epoch;
+		size_t first_iteration;
+		
+		Batch buffers[2];
+		size_t current = 0;
+		
+		spsc_queue<size_t, 4> free, ready;
+		
+		std::thread producer;
+		std::atomic<bool> stop {false};
+		
+};
+
+#endif /* __BATCHER_H__ */
@@ -0,0 +1,348 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Binary checkpoints (see DeepLSTM::checkpoint / restore)
+ *
+ * File: header, table, data
+ *
+ * - header: magic, version, number of entries, offset of the
+ *   data, file size, fnv1a of the table
+ * - table: one entry per tensor or scalar: name (e.g. "0.p.W",
+ *   "1.m.U", "0.s.h", "train.epoch"), type, rows, cols, offset
+ *   and length of its data, fnv1a of the data
+ * - data: raw host arrays (column-major, as in memory), each at
+ *   a multiple of 4096, so that a mapped file is read in place
+ *
+ * Writing goes to name.tmp, which is renamed when complete, so an
+ * interrupted write keeps the previous checkpoint. Reading maps
+ * the file once; every tensor is checked against its checksum
+ * when it is copied out.
+ *
+ */
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <containers/shards.h>
+
+#define CHECKPOINT_MAGIC 0x4b435453u
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_ALIGN 4096
+
+#define CHECKPOINT_FLOAT 0
+#define CHECKPOINT_DOUBLE 1
+#define CHECKPOINT_UINT64 2
+
+typedef struct {
+
+	uint32_t magic = CHECKPOINT_MAGIC;
+	uint32_t version = CHECKPOINT_VERSION;
+	
+	uint64_t entries = 0, data = 0, bytes = 0;
+	
+	// fnv1a of the table
+	uint64_t checksum = 0;
+	
+} CheckpointHeader;
+
+typedef struct {
+
+	char name[64];
+	
+	uint32_t type, element;
+	uint64_t rows, cols;
+	
+	uint64_t offset, bytes, checksum;
+	
+} CheckpointEntry;
+
+class Checkpoint {
+
+	public:
+	
+		Checkpoint() = default;
+		
+		~Checkpoint() {
+		
+			if ( base != nullptr ) munmap ( base, mapped );
+			
+		}
+		
+		/* writing: rows x cols elements at data, kept until write () */
+		void add ( const std::string &name, const void *data, size_t rows, size_t cols, uint32_t type ) {
+		
+			CheckpointEntry entry;
+			memset ( &entry, 0, sizeof ( entry ) );
+			
+			strncpy ( entry.name, name.c_str(), sizeof ( entry.name ) - 1 );
+			entry.type = type;
+			entry.element = type == CHECKPOINT_FLOAT ? 4 : 8;
+			entry.rows = rows;
+			entry.cols = cols;
+			entry.bytes = rows * cols * entry.element;
+			entry.checksum = fnv1a ( ( const uint8_t * ) data, entry.bytes );
+			
+			table.push_back ( entry );
+			sources.push_back ( ( const uint8_t * ) data );
+			
+		}
+		
+		void add ( const std::string &name, const float *data, size_t rows, size_t cols ) {
+		
+			add ( name, data, rows, cols, CHECKPOINT_FLOAT );
+			
+		}
+		
+		void add ( const std::string &name, const double *data, size_t rows, size_t cols ) {
+		
+			add ( name, data, rows, cols, CHECKPOINT_DOUBLE );
+			
+		}
+		
+		/* scalars are copied */
+		void add ( const std::string &name, uint64_t value ) {
+		
+			scalars.push_back ( value );
+			add ( name, &scalars.back(), 1, 1, CHECKPOINT_UINT64 );
+			
+		}
+		
+		void add ( const std::string &name, double value ) {
+		
+			uint64_t bits;
+			memcpy ( &bits, &value, 8 );
+			
+			scalars.push_back ( bits );
+			add ( name, &scalars.back(), 1, 1, CHECKPOINT_DOUBLE );
+			
+		}
+		
+		bool write ( const std::string &filename ) {
+		
+			CheckpointHeader header;
+			header.entries = table.size();
+			header.data = align ( sizeof ( header ) + table.size() * sizeof ( CheckpointEntry ) );
+			
+			uint64_t offset = header.data;
+			
+			for ( auto &entry : table ) {
+			
+				entry.offset = offset;
+				offset = align ( offset + entry.bytes );
+				
+			}
+			
+			header.bytes = offset;
+			header.checksum = fnv1a ( ( const uint8_t * ) table.data(), table.size() * sizeof ( CheckpointEntry ) );
+			
+			std::string temporary = filename + ".tmp";
+			std::ofstream out ( temporary, std::ios::binary );
+			
+			if ( !out.is_open() ) {
+			
+				std::cout << "open error: (" << temporary << ")" << std::endl;
+				return false;
+				
+			}
+			
+			std::vector<char> padding ( CHECKPOINT_ALIGN, 0 );
+			
+			out.write ( ( const char * ) &header, sizeof ( header ) );
+			out.write ( ( const char * ) table.data(), table.size() * sizeof ( CheckpointEntry ) );
+			out.write ( padding.data(), header.data - sizeof ( header ) - table.size() * sizeof ( CheckpointEntry ) );
+			
+			for ( size_t i = 0; i < table.size(); i++ ) {
+			
+				out.write ( ( const char * ) sources[i], table[i].bytes );
+				out.write ( padding.data(), align ( table[i].bytes ) - table[i].bytes );
+				
+			}
+			
+			out.close();
+			
+			if ( !out || rename ( temporary.c_str(), filename.c_str() ) != 0 ) {
+			
+				std::cout << "write error: (" << filename << ")" << std::endl;
+				return false;
+				
+			}
+			
+			return true;
+			
+		}
+		
+		/* true if filename starts with the magic number */
+		static bool is_checkpoint ( const std::string &filename ) {
+		
+			std::ifstream in ( filename, std::ios::binary );
+			uint32_t magic = 0;
+			
+			in.read ( ( char * ) &magic, sizeof ( magic ) );
+			
+			return in && magic == CHECKPOINT_MAGIC;
+			
+		}
+		
+		/* reading: maps filename, checks the header and the table */
+		bool open ( const std::string &filename ) {
+		
+			int fd = ::open ( filename.c_str(), O_RDONLY );
+			
+			if ( fd < 0 ) {
+			
+				std::cout << "open error: (" << filename << ")" << std::endl;
+				return false;
+				
+			}
+			
+			struct stat info;
+			
+			if ( fstat ( fd, &info ) == 0 && ( size_t ) info.st_size >= sizeof ( CheckpointHeader ) ) {
+			
+				mapped = info.st_size;
+				void *ptr = mmap ( NULL, mapped, PROT_READ, MAP_PRIVATE, fd, 0 );
+				
+				if ( ptr != MAP_FAILED ) base = ( uint8_t * ) ptr;
+				
+			}
+			
+			close ( fd );
+			
+			if ( base == nullptr ) {
+			
+				std::cout << "mmap error: (" << filename << ")" << std::endl;
+				return false;
+				
+			}
+			
+			madvise ( base, mapped, MADV_SEQUENTIAL );
+			
+			CheckpointHeader header;
+			memcpy ( &header, base, sizeof ( header ) );
+			
+			if ( header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION ) {
+			
+				std::cout << "not a checkpoint (version " << CHECKPOINT_VERSION << "): (" << filename << ")" << std::endl;
+				return false;
+				
+			}
+			
+			size_t length = header.entries * sizeof ( CheckpointEntry );
+			
+			if ( header.bytes != mapped || sizeof ( header ) + length > mapped ||
+					fnv1a ( base + sizeof ( header ), length ) != header.checksum ) {
+					
+				std::cout << "truncated or corrupt checkpoint: (" << filename << ")" << std::endl;
+				return false;
+				
+			}
+			
+			table.resize ( header.entries );
+			memcpy ( table.data(), base + sizeof ( header ), length );
+			
+			for ( auto &entry : table ) {
+			
+				entry.name[sizeof ( entry.name ) - 1] = '\0';
+				
+				if ( entry.offset + entry.bytes > mapped ) {
+				
+					std::cout << "truncated or corrupt checkpoint: (" << filename << ")" << std::endl;
+					return false;
+					
+				}
+				
+			}
+			
+			return true;
+			
+		}
+		
+		const CheckpointEntry *find ( const std::string &name ) const {
+		
+			for ( auto &entry : table )
+				if ( name == entry.name ) return &entry;
+				
+			return nullptr;
+			
+		}
+		
+		/* rows x cols elements of type into out, if name exists with that shape and its checksum matches */
+		bool read ( const std::string &name, void *out, size_t rows, size_t cols, uint32_t type ) const {
+		
+			const CheckpointEntry *entry = find ( name );
+			
+			if ( entry == nullptr ) {
+			
+				std::cout << "checkpoint has no " << name << std::endl;
+				return false;
+				
+			}
+			
+			if ( entry->type != type || entry->rows != rows || entry->cols != cols ) {
+			
+				std::cout << "checkpoint has " << name << " of " << entry->rows << " x " << entry->cols << ", type " <<
+						  entry->type << " instead of " << rows << " x " << cols << ", type " << type << std::endl;
+				return false;
+				
+			}
+			
+			if ( fnv1a ( base + entry->offset, entry->bytes ) != entry->checksum ) {
+			
+				std::cout << "checksum mismatch: " << name << std::endl;
+				return false;
+				
+			}
+			
+			memcpy ( out, base + entry->offset, entry->bytes );
+			return true;
+			
+		}
+		
+		bool read ( const std::string &name, float *out, size_t rows, size_t cols ) const {
+		
+			return read ( name, out, rows, cols, CHECKPOINT_FLOAT );
+			
+		}
+		
+		bool read ( const std::string &name, double *out, size_t rows, size_t cols ) const {
+		
+			return read ( name, out, rows, cols, CHECKPOINT_DOUBLE );
+			
+		}
+		
+		bool read ( const std::string &name, uint64_t &value ) const { return read ( name, &value, 1, 1, CHECKPOINT_UINT64 ); }
+		
+		bool read ( const std::string &name, double &value ) const { return read ( name, &value, 1, 1, CHECKPOINT_DOUBLE ); }
+		
+		std::vector<CheckpointEntry> table;
+		
+	protected:
+	
+		static uint64_t align ( uint64_t offset ) { return ( offset + CHECKPOINT_ALIGN - 1 ) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN; }
+		
+		// writing
+		std::vector<const uint8_t *> sources;
+		std::deque<uint64_t> scalars;
+		
+		// reading
+		uint8_t *base = nullptr;
+		size_t mapped = 0;
+		
+};
+
+#endif /* __CHECKPOINT_H__ */
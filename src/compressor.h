@@ -0,0 +1,181 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Compression with the model's next-byte distribution
+ *
+ * The input is cut into B contiguous blocks, one per row of a
+ * single-step batch (DeepLSTM::inference_mode), each coded into
+ * its own range coder stream (containers/range_coder.h); a block
+ * starts from a zero state and an empty input, rows past the end
+ * of their block get empty inputs.
+ *
+ * The decoder rebuilds the inputs from the bytes it has decoded,
+ * so it reproduces the encoder's probabilities only if inference
+ * is bit-exact: same snapshot, same B (kept in the header), same
+ * build and GPU, no atomics in forward, and a fixed cuBLAS
+ * workspace (CUBLAS_WORKSPACE_CONFIG, see compress.cc). The
+ * probabilities are quantized to integer frequencies on the host,
+ * the same way on both sides.
+ *
+ * File: header, B x (block bytes, coded bytes), coded streams
+ *
+ */
+
+#ifndef __COMPRESSOR_H__
+#define __COMPRESSOR_H__
+
+#include <vector>
+#include <iostream>
+#include <math.h>
+#include <stdint.h>
+
+#include <deeplstm.h>
+#include <containers/range_coder.h>
+#include <containers/shards.h>
+
+#define COMPRESSOR_MAGIC 0x4d54534cu
+#define COMPRESSOR_VERSION 1
+
+typedef struct {
+
+	uint32_t magic = COMPRESSOR_MAGIC;
+	uint32_t version = COMPRESSOR_VERSION;
+	
+	// net, fnv1a of the snapshot file
+	uint64_t N = 0, snapshot = 0;
+	
+	// fnv1a of the original
+	uint64_t bytes = 0, checksum = 0;
+	
+	uint64_t blocks = 0;
+	
+	bool read ( std::istream &in ) {
+	
+		in.read ( ( char * ) this, sizeof ( *this ) );
+		return in && magic == COMPRESSOR_MAGIC && version == COMPRESSOR_VERSION;
+		
+	}
+	
+	void write ( std::ostream &out ) const { out.write ( ( const char * ) this, sizeof ( *this ) ); }
+	
+} CompressedHeader;
+
+template <typename T>
+class Compressor {
+
+	public:
+	
+		/* net - single-step batch of 256 symbols, one row per block */
+		Compressor ( DeepLSTM<T> &_net ) : net ( _net ), x ( _net.B, _net.M ), cumulative ( _net.M + 1 ) { }
+		
+		/* blocks into coded streams, returns the model's cost in bits */
+		double compress ( const std::vector<std::vector<uint8_t>> &blocks, std::vector<std::vector<uint8_t>> &coded ) {
+		
+			std::vector<RangeEncoder> encoders ( blocks.size() );
+			double bits = 0;
+			
+			run ( blocks, [&] ( size_t b, size_t i ) {
+			
+				uint8_t symbol = blocks[b][i];
+				uint32_t total = quantize ( b );
+				
+				encoders[b].encode ( cumulative[symbol], cumulative[symbol + 1] - cumulative[symbol], total );
+				bits += -log2 ( net.probability ( b, symbol ) );
+				
+			} );
+			
+			coded.resize ( blocks.size() );
+			
+			for ( size_t b = 0; b < blocks.size(); b++ )
+				coded[b].swap ( encoders[b].finish() );
+				
+			return bits;
+			
+		}
+		
+		/* coded streams into blocks, sized to their lengths beforehand */
+		void decompress ( const std::vector<std::vector<uint8_t>> &coded, std::vector<std::vector<uint8_t>> &blocks ) {
+		
+			std::vector<RangeDecoder> decoders;
+			
+			for ( size_t b = 0; b < coded.size(); b++ )
+				decoders.push_back ( RangeDecoder ( coded[b].data(), coded[b].size() ) );
+				
+			run ( blocks, [&] ( size_t b, size_t i ) {
+			
+				uint32_t total = quantize ( b );
+				uint32_t target = decoders[b].target ( total );
+				
+				// the last symbol starting at or below target
+				size_t symbol = std::upper_bound ( cumulative.begin(), cumulative.end(), target ) - cumulative.begin() - 1;
+				
+				decoders[b].consume ( cumulative[symbol], cumulative[symbol + 1] - cumulative[symbol] );
+				blocks[b][i] = symbol;
+				
+			} );
+			
+		}
+		
+	protected:
+	
+		/* code ( b, i ) for every byte i of every block b, bytes before i already in place */
+		template <typename F>
+		void run ( const std::vector<std::vector<uint8_t>> &blocks, const F &code ) {
+		
+			size_t length = 0;
+			std::vector<size_t> rows;
+			
+			for ( size_t b = 0; b < net.B; b++ )
+				rows.push_back ( b );
+				
+			for ( size_t b = 0; b < blocks.size(); b++ )
+				length = std::max ( length, blocks[b].size() );
+				
+			net.reset_rows ( rows );
+			
+			for ( size_t i = 0; i < length; i++ ) {
+			
+				x.setZero();
+				
+				for ( size_t b = 0; b < blocks.size(); b++ )
+					if ( i > 0 && i < blocks[b].size() ) set_row_one_hot ( x, b, blocks[b][i - 1] );
+					
+				net.forward ( false, x );
+				net.carryContext ( 1 );
+				
+				for ( size_t b = 0; b < blocks.size(); b++ )
+					if ( i < blocks[b].size() ) code ( b, i );
+					
+			}
+			
+		}
+		
+		/*
+			cumulative frequencies of row b, every symbol at least 1
+			(the model may be wrong), total at most 2^16 as long as
+			the probabilities add up to 1 within M / 2^16
+		*/
+		uint32_t quantize ( size_t b ) {
+		
+			T &probs = net.outputlayer->s[1]['p'];
+			const size_t M = net.M;
+			const dtype scale = ( 1 << RANGE_TOTAL_BITS ) - 2 * M;
+			
+			cumulative[0] = 0;
+			
+			for ( size_t k = 0; k < M; k++ )
+				cumulative[k + 1] = cumulative[k] + 1 + ( uint32_t ) ( probs ( b, k ) * scale );
+				
+			return cumulative[M];
+			
+		}
+		
+		DeepLSTM<T> &net;
+		T x;
+		
+		std::vector<uint32_t> cumulative;
+		
+};
+
+#endif /* __COMPRESSOR_H__ */
@@ -0,0 +1,361 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Byte-pair encoding
+ *
+ * Tokens 0 .. 255 are bytes, token 256 + r is merge r. With no
+ * merges, encode() is skipped and the model sees bytes.
+ *
+ * learn() keeps the sample as a linked list of tokens, pair
+ * counts and pair positions in hash maps and a max-heap of
+ * counts (stale entries are skipped), so each merge only
+ * touches the positions of the merged pair.
+ *
+ * encode() applies the merges in rank order (min-heap over
+ * adjacent pairs) to 64 kB chunks, in parallel; tokens do not
+ * cross chunk boundaries.
+ *
+ */
+
+#ifndef __BPE_H__
+#define __BPE_H__
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <fstream>
+#include <unordered_map>
+#include <algorithm>
+
+#include <containers/io.h>
+
+#define BPE_DEAD 0xFFFFFFFFu
+#define BPE_CHUNK ( 1 << 16 )
+
+class BPE {
+
+	public:
+	
+		BPE() {
+		
+			for ( size_t b = 0; b < 256; b++ )
+				pieces.push_back ( std::string ( 1, ( char ) b ) );
+				
+		}
+		
+		size_t size() const { return pieces.size(); }
+		
+		void learn ( const Corpus &corpus, size_t vocabulary, size_t max_bytes ) {
+		
+			// ids are stored in 16 bits
+			vocabulary = std::min<size_t> ( vocabulary, 1 << 16 );
+			
+			size_t n = std::min ( corpus.size(), max_bytes );
+			
+			std::vector<uint32_t> tok ( n );
+			std::vector<int64_t> prev ( n ), next ( n );
+			
+			std::unordered_map<uint64_t, int64_t> counts;
+			std::unordered_map<uint64_t, std::vector<uint32_t>> where;
+			
+			for ( size_t i = 0; i < n; i++ ) {
+			
+				tok[i] = corpus[i];
+				prev[i] = ( int64_t ) i - 1;
+				next[i] = i + 1 < n ? ( int64_t ) i + 1 : -1;
+				
+			}
+			
+			for ( size_t i = 0; i + 1 < n; i++ ) {
+			
+				uint64_t k = key ( tok[i], tok[i + 1] );
+				counts[k]++;
+				where[k].push_back ( i );
+				
+			}
+			
+			std::priority_queue<std::pair<int64_t, uint64_t>> heap;
+			
+			for ( auto &c : counts )
+				heap.push ( std::make_pair ( c.second, c.first ) );
+				
+			while ( size() < vocabulary && !heap.empty() ) {
+			
+				std::pair<int64_t, uint64_t> top = heap.top();
+				heap.pop();
+				
+				auto it = counts.find ( top.second );
+				
+				// stale
+				if ( it == counts.end() || it->second != top.first ) continue;
+				
+				if ( top.first < 2 ) break;
+				
+				uint32_t a = top.second >> 32, b = ( uint32_t ) top.second;
+				uint32_t c = add ( a, b );
+				
+				std::vector<uint32_t> positions;
+				positions.swap ( where[top.second] );
+				where.erase ( top.second );
+				counts.erase ( it );
+				
+				std::vector<uint64_t> changed;
+				
+				auto update = [&] ( uint64_t k, int64_t delta, int64_t pos ) {
+				
+					if ( k == top.second ) return;
+					
+					counts[k] += delta;
+					
+					if ( delta > 0 ) where[k].push_back ( pos );
+					
+					changed.push_back ( k );
+					
+				};
+				
+				for ( uint32_t i : positions ) {
+				
+					// already merged into a neighbour or changed since
+					if ( tok[i] != a || next[i] < 0 || tok[next[i]] != b ) continue;
+					
+					int64_t j = next[i];
+					
+					if ( prev[i] >= 0 ) {
+					
+						update ( key ( tok[prev[i]], a ), -1, prev[i] );
+						update ( key ( tok[prev[i]], c ), 1, prev[i] );
+						
+					}
+					
+					if ( next[j] >= 0 ) {
+					
+						update ( key ( b, tok[next[j]] ), -1, i );
+						update ( key ( c, tok[next[j]] ), 1, i );
+						
+					}
+					
+					tok[i] = c;
+					tok[j] = BPE_DEAD;
+					next[i] = next[j];
+					
+					if ( next[j] >= 0 ) prev[next[j]] = i;
+					
+				}
+				
+				for ( uint64_t k : changed ) {
+				
+					auto ck = counts.find ( k );
+					
+					if ( ck != counts.end() && ck->second > 0 ) heap.push ( std::make_pair ( ck->second, k ) );
+					
+				}
+				
+			}
+			
+			std::cout << "BPE : " << size() << " tokens learned from " << n << " bytes" << std::endl;
+			
+		}
+		
+		/* 16-bit token corpus with tokens_per_byte set */
+		Corpus encode ( const Corpus &corpus ) const {
+		
+			size_t chunks = ( corpus.size() + BPE_CHUNK - 1 ) / BPE_CHUNK;
+			size_t workers = std::max<size_t> ( 1, std::min<size_t> ( std::thread::hardware_concurrency(), chunks ) );
+			
+			std::vector<std::vector<uint16_t>> parts ( workers );
+			std::vector<std::thread> threads;
+			
+			for ( size_t w = 0; w < workers; w++ )
+				threads.push_back ( std::thread ( [&, w] {
+				
+				size_t first = chunks * w / workers, last = chunks * ( w + 1 ) / workers;
+				
+				for ( size_t k = first; k < last; k++ ) {
+				
+					size_t begin = k * BPE_CHUNK;
+					size_t end = std::min ( corpus.size(), begin + BPE_CHUNK );
+					encode_chunk ( corpus, begin, end, parts[w] );
+					
+				}
+				
+			} ) );
+			
+			size_t tokens = 0;
+			
+			for ( size_t w = 0; w < workers; w++ ) {
+			
+				threads[w].join();
+				tokens += parts[w].size();
+				
+			}
+			
+			// little-endian
+			std::vector<uint8_t> bytes ( 2 * tokens );
+			size_t i = 0;
+			
+			for ( auto &part : parts )
+				for ( uint16_t t : part ) {
+				
+					bytes[i++] = t & 0xFF;
+					bytes[i++] = t >> 8;
+					
+				}
+				
+			Corpus encoded ( std::make_shared<Shards> ( std::move ( bytes ) ), 2 );
+			encoded.tokens_per_byte = corpus.size() > 0 ? ( double ) tokens / corpus.size() : 1.0;
+			
+			return encoded;
+			
+		}
+		
+		std::string decode ( const std::vector<size_t> &tokens ) const {
+		
+			std::string text;
+			
+			for ( size_t t : tokens )
+				text += pieces[t];
+				
+			return text;
+			
+		}
+		
+		/* one merge "left right" per line, in rank order */
+		bool save ( const std::string &filename ) const {
+		
+			std::ofstream out ( filename );
+			
+			if ( !out.is_open() ) return false;
+			
+			for ( auto &m : merges )
+				out << m.first << " " << m.second << std::endl;
+				
+			return out.good();
+			
+		}
+		
+		bool load ( const std::string &filename ) {
+		
+			std::ifstream in ( filename );
+			
+			if ( !in.is_open() ) return false;
+			
+			uint32_t a, b;
+			
+			while ( in >> a >> b ) {
+			
+				if ( a >= size() || b >= size() ) {
+				
+					std::cout << "bad merge " << a << " " << b << ": (" << filename << ")" << std::endl;
+					return false;
+					
+				}
+				
+				add ( a, b );
+				
+			}
+			
+			std::cout << "BPE : " << size() << " tokens (" << filename << ")" << std::endl;
+			
+			return true;
+			
+		}
+		
+	protected:
+	
+		static uint64_t key ( uint32_t a, uint32_t b ) { return ( ( uint64_t ) a << 32 ) | b; }
+		
+		uint32_t add ( uint32_t a, uint32_t b ) {
+		
+			uint32_t c = size();
+			
+			ranks[key ( a, b )] = merges.size();
+			merges.push_back ( std::make_pair ( a, b ) );
+			pieces.push_back ( pieces[a] + pieces[b] );
+			
+			return c;
+			
+		}
+		
+		int64_t rank ( uint32_t a, uint32_t b ) const {
+		
+			auto it = ranks.find ( key ( a, b ) );
+			return it == ranks.end() ? -1 : ( int64_t ) it->second;
+			
+		}
+		
+		void encode_chunk ( const Corpus &corpus, size_t begin, size_t end, std::vector<uint16_t> &out ) const {
+		
+			size_t n = end - begin;
+			
+			std::vector<uint32_t> tok ( n );
+			std::vector<int64_t> prev ( n ), next ( n );
+			
+			// (rank, position), lowest rank first, then leftmost
+			typedef std::pair<int64_t, int64_t> entry;
+			std::priority_queue<entry, std::vector<entry>, std::greater<entry>> heap;
+			
+			for ( size_t i = 0; i < n; i++ ) {
+			
+				tok[i] = corpus[begin + i];
+				prev[i] = ( int64_t ) i - 1;
+				next[i] = i + 1 < n ? ( int64_t ) i + 1 : -1;
+				
+			}
+			
+			for ( size_t i = 0; i + 1 < n; i++ ) {
+			
+				int64_t r = rank ( tok[i], tok[i + 1] );
+				
+				if ( r >= 0 ) heap.push ( entry ( r, i ) );
+				
+			}
+			
+			while ( !heap.empty() ) {
+			
+				entry top = heap.top();
+				heap.pop();
+				
+				int64_t i = top.second;
+				
+				if ( tok[i] == BPE_DEAD || next[i] < 0 || rank ( tok[i], tok[next[i]] ) != top.first ) continue;
+				
+				int64_t j = next[i];
+				
+				tok[i] = 256 + top.first;
+				tok[j] = BPE_DEAD;
+				next[i] = next[j];
+				
+				if ( next[j] >= 0 ) prev[next[j]] = i;
+				
+				if ( prev[i] >= 0 ) {
+				
+					int64_t r = rank ( tok[prev[i]], tok[i] );
+					
+					if ( r >= 0 ) heap.push ( entry ( r, prev[i] ) );
+					
+				}
+				
+				if ( next[i] >= 0 ) {
+				
+					int64_t r = rank ( tok[i], tok[next[i]] );
+					
+					if ( r >= 0 ) heap.push ( entry ( r, i ) );
+					
+				}
+				
+			}
+			
+			for ( int64_t i = 0; i >= 0; i = next[i] )
+				out.push_back ( tok[i] );
+				
+		}
+		
+		std::vector<std::pair<uint32_t, uint32_t>> merges;
+		std::unordered_map<uint64_t, uint32_t> ranks;
+		std::vector<std::string> pieces;
+		
+};
+
+#endif /* __BPE_H__ */
@@ -17,6 +17,8 @@
 #include <functional>
 #include <assert.h>
 
+#include <containers/philox.h>
+
 #ifdef __USE_BLAS__
 	#include <cblas.h>
 #endif
@@ -43,6 +45,27 @@
 	
 #endif
 
+/*
+	counter-based RNG state, every fill gets its own step;
+	steps are counted per thread, so that a background
+	evaluator (evaluator.h) does not shift the draws of training
+*/
+uint64_t philox_seed = 0x2016;
+thread_local uint32_t philox_host_step = 0;
+
+void seed_rng ( uint64_t seed ) {
+
+	philox_seed = seed;
+	philox_host_step = 0;
+	
+}
+
+philox_key next_host_key() {
+
+	return make_philox_key ( philox_seed, PHILOX_HOST_STREAM, philox_host_step++ );
+	
+}
+
 template <typename T>
 class matrix {
 
@@ -58,9 +81,13 @@ class matrix {
 		size_t bytes_allocated = 0;
 		bool write = true;
 		
+		// false if _data_ belongs to another matrix (see alias)
+		bool owns_data = true;
+		
 		void alloc ( size_t rows, size_t cols ) {
 		
 			bytes_allocated = rows * cols * sizeof ( T );
+			owns_data = true;
 			
 			//if using cuda matrix: use page locked memory
 			#ifdef __CUDA_MATRIX__
@@ -81,11 +108,13 @@ class matrix {
 				if ( _data_ != nullptr ) {
 				
 					//if using cuda matrix: use page locked memory
-					#ifdef __CUDA_MATRIX__
-					cudaFreeHost ( _data_ );
-					#else
-					free ( _data_ );
-					#endif
+					if ( owns_data ) {
+						#ifdef __CUDA_MATRIX__
+						cudaFreeHost ( _data_ );
+						#else
+						free ( _data_ );
+						#endif
+					}
 					
 					bytes_allocated = 0;
 					_data_ = nullptr;
@@ -96,6 +125,33 @@ class matrix {
 			
 		}
 		
+		/* share storage with other (same dims), nothing is freed on destruction */
+		void alias ( matrix<T> &other ) {
+		
+			dealloc();
+			
+			_data_ = other._data_;
+			bytes_allocated = other.bytes_allocated;
+			owns_data = false;
+			
+			_rows = other._rows;
+			_cols = other._cols;
+			_size = other._size;
+			bytes = other.bytes;
+			
+		}
+		
+		/* keep dims, use external host memory (e.g. a mapped file) */
+		void alias ( T *ptr ) {
+		
+			dealloc();
+			
+			_data_ = ptr;
+			bytes_allocated = _rows * _cols * sizeof ( T );
+			owns_data = false;
+			
+		}
+		
 		void block ( const matrix<T> &src, const size_t r, const size_t c, const size_t nr, const size_t nc ) {
 		
 			resize ( nr, nc );
@@ -122,14 +178,13 @@ class matrix {
 		
 		void block_rand ( const size_t offset, const size_t cols, const dtype range_min, const dtype range_max ) {
 		
-			std::random_device rd;
-			std::mt19937 mt ( rd() );
-			std::uniform_real_distribution<T> dis ( range_min, range_max );
+			philox_key key = next_host_key();
 			
 			for ( size_t i = 0; i < rows(); i++ )
 				for ( size_t j = 0; j < cols; j++ )
 				
-					this->operator() ( i, j + offset ) = dis ( mt );
+					this->operator() ( i, j + offset ) = range_min + ( range_max - range_min ) *
+														 philox_uniform ( key, ORDER ( i, j + offset ) );
 					
 			write = true;
 		}
@@ -152,6 +207,10 @@ class matrix {
 		
 		}
 		
+		void cu_resize ( const size_t new_rows, const size_t new_cols ) {
+		
+		}
+		
 		/* main constr */
 		matrix ( const size_t rows, const size_t cols ) {
 		
@@ -426,11 +485,16 @@ class matrix {
 		template<class Archive>
 		void serialize ( Archive &archive ) {
 		
-			archive ( _rows, _cols );
+			size_t rows = _rows, cols = _cols;
+			archive ( rows, cols );
 			
-			for ( int i = 0; i < _rows; i++ )
-				for ( int j = 0; j < _cols; j++ )
-					archive ( this->operator() ( i, j ) );
+			// when loading, values of a different shape are read but not stored
+			bool match = rows == _rows && cols == _cols;
+			T ignored;
+			
+			for ( int i = 0; i < rows; i++ )
+				for ( int j = 0; j < cols; j++ )
+					archive ( match ? this->operator() ( i, j ) : ignored );
 					
 		}
 };
@@ -455,6 +519,14 @@ void elementwise_mult ( dtype *a, dtype *b, dtype *c, size_t elements ) {
 		
 }
 
+/* host counterpart of cu_copy (cu_matrix.h) */
+template <typename T>
+void cu_copy ( matrix<T> &dst, matrix<T> &src ) {
+
+	memcpy ( dst.data(), src.data(), src.size() * sizeof ( T ) );
+	
+}
+
 template <typename T>
 void row ( matrix<T> &out, const matrix<T> &m, const size_t which ) {
 
@@ -509,29 +581,23 @@ void ones ( matrix<T> &m ) {
 template <typename T>
 void rand_uniform ( matrix<T> &m, const double range_min, const double range_max ) {
 
-	std::random_device rd;
-	std::mt19937 mt ( rd() );
-	std::uniform_real_distribution<T> dis ( range_min, range_max );
+	// each element depends only on (seed, step, i), no sequential state
+	philox_key key = next_host_key();
 	
-	for ( int i = 0; i < m.rows(); i++ ) {
-		for ( int j = 0; j < m.cols(); j++ )
-			m ( i, j ) = dis ( mt );
-	}
+	for ( size_t i = 0; i < m.size(); i++ )
+		m ( i ) = range_min + ( range_max - range_min ) * philox_uniform ( key, i );
+		
 	
 }
 
 template <typename T>
 void randn ( matrix<T> &m, const T mean, const T stddev ) {
 
-	// random number generator
-	std::random_device rd;
-	std::mt19937 mt ( rd() );
-	std::normal_distribution<T> __randn ( mean, stddev );
+	philox_key key = next_host_key();
 	
-	for ( int i = 0; i < m.rows(); i++ )
-		for ( int j = 0; j < m.cols(); j++ )
-			m ( i, j ) = __randn ( mt );
-			
+	for ( size_t i = 0; i < m.size(); i++ )
+		m ( i ) = mean + stddev * philox_normal ( key, i );
+		
 }
 
 template <typename T>
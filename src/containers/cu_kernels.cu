@@ -181,6 +181,38 @@ void cu_randn ( dtype *__restrict__ data, size_t elements, dtype mean = ( dtype
 	#endif
 }
 
+__global__ void kernel_philox_uniform ( dtype *__restrict__ data, size_t n, philox_key key ) {
+
+	int tid = blockDim.x * blockIdx.x + threadIdx.x;
+	
+	if ( tid < n ) data[tid] = ( dtype ) philox_uniform ( key, tid );
+	
+}
+
+void cu_philox_uniform ( dtype *__restrict__ data, size_t elements, philox_key key, int stream_idx ) {
+
+	size_t num_blocks = ( elements + NUM_THREADS - 1 ) / NUM_THREADS;
+	kernel_philox_uniform <<<num_blocks, NUM_THREADS, stream_idx>>> ( data, elements, key );
+	
+}
+
+/* one thread per 32-bit word, bit i set with probability p */
+__global__ void kernel_philox_mask ( uint32_t *__restrict__ mask, size_t words, philox_key key, dtype p ) {
+
+	int tid = blockDim.x * blockIdx.x + threadIdx.x;
+	
+	if ( tid < words ) mask[tid] = philox_mask_word ( key, tid, ( float ) p );
+	
+}
+
+void cu_philox_mask ( uint32_t *__restrict__ mask, size_t bits, philox_key key, dtype p, int stream_idx ) {
+
+	size_t words = ( bits + 31 ) / 32;
+	size_t num_blocks = ( words + NUM_THREADS - 1 ) / NUM_THREADS;
+	kernel_philox_mask <<<num_blocks, NUM_THREADS, stream_idx>>> ( mask, words, key, p );
+	
+}
+
 __global__ void kernel_elementwise_tanh ( dtype *__restrict__ c, size_t n ) {
 
 	int tid = blockDim.x * blockIdx.x + threadIdx.x;
@@ -555,13 +587,13 @@ void cu_elementwise_hardattlstm_forward (
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
 	dtype *__restrict__ prev_h,
-	dtype *__restrict__ rands,
+	philox_key key,
 	size_t N, size_t L, size_t B, int stream_idx ) {
 	
 	size_t num_blocks = ( N * B + NUM_THREADS - 1 ) / NUM_THREADS;
 	kernel_elementwise_hardattlstm_forward <<<num_blocks, NUM_THREADS, stream_idx>>> ( g, g2, G, b, h, max_o, c, ct,
 			prev_c,
-			prev_h, rands, N, L, B );
+			prev_h, key, N, L, B );
 			
 }
 
@@ -842,7 +874,7 @@ __global__ void kernel_row_max ( dtype *__restrict__ v,  dtype *__restrict__ m,
 	/* TODO make this better, I really didn't have time to do this properly, need to implement parallel reduction */
 #pragma unroll
 	
-	for ( int n = 0; n < 256; n++ )
+	for ( int n = 0; n < N; n++ )
 	
 		local_max = fmaxf ( local_max, m[tid + B * n] );
 		
@@ -2045,7 +2077,7 @@ __global__ void kernel_elementwise_hardattlstm_forward ( dtype *__restrict__ g,
 		dtype *__restrict__ ct,
 		dtype *__restrict__ prev_c,
 		dtype *__restrict__ prev_h,
-		dtype *__restrict__ rands,
+		philox_key key,
 		size_t N, size_t L, size_t B ) {
 		
 	size_t elements = N * B;
@@ -2125,9 +2157,11 @@ __global__ void kernel_elementwise_hardattlstm_forward ( dtype *__restrict__ g,
 			
 		}
 		
+		dtype r = ( dtype ) philox_uniform ( key, tid );
+		
 		for ( int l = 0; l < L; l++ ) {
 		
-			if ( rands[tid] <= ( dtype ) ( l + 1 ) / ( dtype ) L ) {
+			if ( r <= ( dtype ) ( l + 1 ) / ( dtype ) L ) {
 			
 				int ltid = tid + l * N * B;
 				max_o_idx = ltid;
@@ -3423,11 +3457,11 @@ void cu_elementwise_alstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	philox_key key,
 	size_t N, size_t L, size_t B, int stream_idx ) {
 	
 	size_t num_blocks = ( N * B + NUM_THREADS - 1 ) / NUM_THREADS;
-	kernel_elementwise_alstm_forward <<<num_blocks, NUM_THREADS, stream_idx>>> ( g, g2, b, h, max_o, c, ct, prev_c, rands,
+	kernel_elementwise_alstm_forward <<<num_blocks, NUM_THREADS, stream_idx>>> ( g, g2, b, h, max_o, c, ct, prev_c, key,
 			N, L, B );
 			
 }
@@ -3461,11 +3495,11 @@ void cu_elementwise_dolstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	const uint32_t *__restrict__ mask,
 	size_t N, size_t L, size_t B, int stream_idx ) {
 	
 	size_t num_blocks = ( N * B + NUM_THREADS - 1 ) / NUM_THREADS;
-	kernel_elementwise_dolstm_forward <<<num_blocks, NUM_THREADS, stream_idx>>> ( g, g2, b, h, max_o, c, ct, prev_c, rands,
+	kernel_elementwise_dolstm_forward <<<num_blocks, NUM_THREADS, stream_idx>>> ( g, g2, b, h, max_o, c, ct, prev_c, mask,
 			N, L, B );
 			
 }
@@ -3507,7 +3541,7 @@ __global__ void kernel_elementwise_dolstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	const uint32_t *__restrict__ mask,
 	size_t N, size_t L, size_t B ) {
 	
 	size_t elements = N * B;
@@ -3533,7 +3567,7 @@ __global__ void kernel_elementwise_dolstm_forward (
 			int ltid = tid + l * N * B;
 			
 			//max_o[ltid] = tid;
-			if ( rands[ltid] <= ( dtype ) 0.5 ) {
+			if ( mask_test ( mask, ltid ) ) {
 			
 				max_o[ltid] = ( dtype ) ( tid + 2 * l * N * B );
 				
@@ -3666,7 +3700,7 @@ __global__ void kernel_elementwise_alstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	philox_key key,
 	size_t N, size_t L, size_t B ) {
 	
 	size_t elements = N * B;
@@ -3716,6 +3750,8 @@ __global__ void kernel_elementwise_alstm_forward (
 		
 		//max_o_idx = tid + 1 * N * B;
 		
+		dtype r = ( dtype ) philox_uniform ( key, tid );
+		
 		for ( int l = 0; l < L; l++ ) {
 		
 			// 	if (rands[tid] <= cumsum[l]) {
@@ -3727,7 +3763,7 @@ __global__ void kernel_elementwise_alstm_forward (
 			// 		break;
 			
 			// 	}
-			if ( rands[tid] <= ( dtype ) ( l + 1 ) / ( dtype ) L ) {
+			if ( r <= ( dtype ) ( l + 1 ) / ( dtype ) L ) {
 			
 				int ltid = tid + l * N * B;
 				max_o_idx = ltid;
@@ -4304,11 +4340,11 @@ void cu_elementwise_splstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	philox_key key,
 	size_t N, size_t L, size_t B, int stream_idx ) {
 	
 	size_t num_blocks = ( N * B + NUM_THREADS - 1 ) / NUM_THREADS;
-	kernel_elementwise_splstm_forward <<<num_blocks, NUM_THREADS, stream_idx>>> ( g, g2, b, h, max_o, c, ct, prev_c, rands,
+	kernel_elementwise_splstm_forward <<<num_blocks, NUM_THREADS, stream_idx>>> ( g, g2, b, h, max_o, c, ct, prev_c, key,
 			N, L, B );
 			
 }
@@ -4348,7 +4384,7 @@ __global__ void kernel_elementwise_splstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	philox_key key,
 	size_t N, size_t L, size_t B ) {
 	
 	size_t elements = N * B;
@@ -4419,11 +4455,13 @@ __global__ void kernel_elementwise_splstm_forward (
 		
 		//max_o_idx = tid;
 		
+		dtype r = ( dtype ) philox_uniform ( key, tid );
+		
 		for ( int l = 0; l < L; l++ ) {
 			int ltid = tid + l * N * B;
-			//printf("l = %d, rand %f, total %f, cumsum %f\n", l, rands[tid], total_prob, cumsum[l]);
+			//printf("l = %d, rand %f, total %f, cumsum %f\n", l, r, total_prob, cumsum[l]);
 			
-			if ( rands[tid] <= cumsum[l] ) {
+			if ( r <= cumsum[l] ) {
 			
 				//max_o_val = g[o_gates + ltid];
 				max_o_idx = ltid;
@@ -4547,6 +4585,20 @@ void cu_elementwise_adadelta_decay (
 			
 }
 
+void cu_elementwise_dynamic (
+	dtype learning_rate, dtype rho, dtype decay,
+	dtype *__restrict__ p,
+	dtype *__restrict__ d,
+	dtype *__restrict__ m,
+	const dtype *__restrict__ p0,
+	size_t N, int stream_idx ) {
+	
+	
+	size_t num_blocks = ( N + NUM_THREADS - 1 ) / NUM_THREADS;
+	kernel_elementwise_dynamic <<<num_blocks, NUM_THREADS, stream_idx>>> ( learning_rate, rho, decay, p, d, m, p0, N );
+	
+}
+
 __global__ void kernel_elementwise_adagrad (
 	dtype learning_rate,
 	dtype *__restrict__ p,
@@ -4627,3 +4679,286 @@ __global__ void kernel_elementwise_adadelta_decay (
 	}
 	
 }
+
+/* dynamic evaluation, RMS-normalized step and decay towards p0 (optimization.h) */
+__global__ void kernel_elementwise_dynamic (
+	dtype learning_rate, dtype rho, dtype decay,
+	dtype *__restrict__ p,
+	dtype *__restrict__ d,
+	dtype *__restrict__ m,
+	const dtype *__restrict__ p0,
+	size_t N ) {
+	
+	size_t elements = N;
+	
+	int tid = blockDim.x * blockIdx.x + threadIdx.x;
+	
+	if ( tid < elements ) {
+	
+		//clip
+		d[tid] = fminf ( d[tid], 1.0f );
+		d[tid] = fmaxf ( d[tid], -1.0f );
+		
+		m[tid] = rho * m[tid] + ( ( dtype ) 1 - rho ) * d[tid] * d[tid];
+		
+		p[tid] += decay * ( p0[tid] - p[tid] ) - learning_rate * d[tid] / device_sqrt_eps ( m[tid], ( dtype ) 1e-4 );
+		
+	}
+	
+}
+
+/*
+	class-factored softmax (layers/cu_class_softmax.h)
+
+	one block per batch row, only the members of the target's
+	class are touched; columns of W are in class order, class c
+	owns columns [bounds[c], bounds[c + 1]), the tables are
+	indexed by token id
+*/
+
+__device__ void device_class_lookup ( const dtype *__restrict__ targets, const dtype *__restrict__ token_class,
+									  const dtype *__restrict__ token_column, const dtype *__restrict__ bounds, int row,
+									  int &c, int &first, int &members, int &target ) {
+									  
+	int token = ( int ) targets[row];
+	
+	c = ( int ) token_class[token];
+	first = ( int ) bounds[c];
+	members = ( int ) bounds[c + 1] - first;
+	target = ( int ) token_column[token] - first;
+	
+}
+
+/* blockDim.x is a power of 2, all threads have to call it */
+__device__ dtype device_block_reduce ( dtype v, dtype *__restrict__ reduce, bool maximum ) {
+
+	reduce[threadIdx.x] = v;
+	__syncthreads();
+	
+	for ( int s = blockDim.x / 2; s > 0; s >>= 1 ) {
+	
+		if ( threadIdx.x < s )
+			reduce[threadIdx.x] = maximum ? fmaxf ( reduce[threadIdx.x], reduce[threadIdx.x + s] ) :
+								  reduce[threadIdx.x] + reduce[threadIdx.x + s];
+								  
+		__syncthreads();
+		
+	}
+	
+	v = reduce[0];
+	__syncthreads();
+	
+	return v;
+	
+}
+
+__global__ void kernel_class_softmax_forward ( dtype *__restrict__ p, dtype *__restrict__ pw,
+		const dtype *__restrict__ pc, const dtype *__restrict__ x, const dtype *__restrict__ W,
+		const dtype *__restrict__ b, const dtype *__restrict__ targets, const dtype *__restrict__ token_class,
+		const dtype *__restrict__ token_column, const dtype *__restrict__ bounds, int N, int B, int K ) {
+		
+	/* x of this row, then the logits of the class members */
+	extern __shared__ dtype shared[];
+	dtype *xs = shared;
+	dtype *logits = shared + N;
+	
+	__shared__ dtype reduce[NUM_THREADS];
+	
+	int row = blockIdx.x;
+	int c, first, members, target;
+	
+	device_class_lookup ( targets, token_class, token_column, bounds, row, c, first, members, target );
+	
+	for ( int i = threadIdx.x; i < N; i += blockDim.x )
+		xs[i] = x[row + i * B];
+		
+	__syncthreads();
+	
+	/* a warp per column, so that reads of W are coalesced */
+	int warp = threadIdx.x / 32, lane = threadIdx.x % 32, warps = blockDim.x / 32;
+	
+	for ( int j = warp; j < members; j += warps ) {
+	
+		const dtype *w = W + ( size_t ) ( first + j ) * N;
+		dtype sum = 0;
+		
+		for ( int i = lane; i < N; i += 32 )
+			sum += xs[i] * w[i];
+			
+		for ( int offset = 16; offset > 0; offset >>= 1 )
+			sum += __shfl_down_sync ( 0xFFFFFFFF, sum, offset );
+			
+		if ( lane == 0 ) logits[j] = sum + b[first + j];
+		
+	}
+	
+	__syncthreads();
+	
+	dtype local = -INFINITY;
+	
+	for ( int j = threadIdx.x; j < members; j += blockDim.x )
+		local = fmaxf ( local, logits[j] );
+		
+	dtype maximum = device_block_reduce ( local, reduce, true );
+	
+	local = 0;
+	
+	for ( int j = threadIdx.x; j < members; j += blockDim.x ) {
+	
+		logits[j] = exp ( logits[j] - maximum );
+		local += logits[j];
+		
+	}
+	
+	dtype sum = device_block_reduce ( local, reduce, false );
+	
+	for ( int j = threadIdx.x; j < K; j += blockDim.x )
+		pw[row + j * B] = j < members ? logits[j] / sum : 0;
+		
+	if ( threadIdx.x == 0 ) p[row] = pc[row + c * B] * logits[target] / sum;
+	
+}
+
+void cu_class_softmax_forward ( dtype *__restrict__ p, dtype *__restrict__ pw, dtype *__restrict__ pc,
+								dtype *__restrict__ x, dtype *__restrict__ W, dtype *__restrict__ b, dtype *__restrict__ targets,
+								dtype *__restrict__ token_class, dtype *__restrict__ token_column, dtype *__restrict__ bounds, size_t N,
+								size_t B, size_t K ) {
+								
+	size_t shared = ( N + K ) * sizeof ( dtype );
+	kernel_class_softmax_forward <<<B, NUM_THREADS, shared>>> ( p, pw, pc, x, W, b, targets, token_class,
+			token_column, bounds, N, B, K );
+			
+}
+
+/* error of the class distribution, pc - 1 { class ( target ) } */
+__global__ void kernel_class_softmax_error ( dtype *__restrict__ gc, const dtype *__restrict__ pc,
+		const dtype *__restrict__ targets, const dtype *__restrict__ token_class, size_t C, size_t B ) {
+		
+	int tid = blockDim.x * blockIdx.x + threadIdx.x;
+	
+	if ( tid < C * B ) {
+	
+		int row = tid % B;
+		int c = tid / B;
+		
+		gc[tid] = pc[tid] - ( c == ( int ) token_class[( int ) targets[row]] ? ( dtype ) 1 : ( dtype ) 0 );
+		
+	}
+	
+}
+
+void cu_class_softmax_error ( dtype *__restrict__ gc, dtype *__restrict__ pc, dtype *__restrict__ targets,
+							  dtype *__restrict__ token_class, size_t C, size_t B ) {
+							  
+	size_t num_blocks = ( C * B + NUM_THREADS - 1 ) / NUM_THREADS;
+	kernel_class_softmax_error <<<num_blocks, NUM_THREADS>>> ( gc, pc, targets, token_class, C, B );
+	
+}
+
+/* dW, db accumulated (rows sharing a class collide), dx added to */
+__global__ void kernel_class_softmax_backward ( dtype *__restrict__ dx, dtype *__restrict__ dW,
+		dtype *__restrict__ db, const dtype *__restrict__ pw, const dtype *__restrict__ x,
+		const dtype *__restrict__ W, const dtype *__restrict__ targets, const dtype *__restrict__ token_class,
+		const dtype *__restrict__ token_column, const dtype *__restrict__ bounds, int N, int B ) {
+		
+	/* x of this row, then the error of the class members */
+	extern __shared__ dtype shared[];
+	dtype *xs = shared;
+	dtype *error = shared + N;
+	
+	int row = blockIdx.x;
+	int c, first, members, target;
+	
+	device_class_lookup ( targets, token_class, token_column, bounds, row, c, first, members, target );
+	
+	for ( int i = threadIdx.x; i < N; i += blockDim.x )
+		xs[i] = x[row + i * B];
+		
+	for ( int j = threadIdx.x; j < members; j += blockDim.x ) {
+	
+		error[j] = pw[row + j * B] - ( j == target ? ( dtype ) 1 : ( dtype ) 0 );
+		atomicAdd ( &db[first + j], error[j] );
+		
+	}
+	
+	__syncthreads();
+	
+	for ( size_t k = threadIdx.x; k < ( size_t ) N * members; k += blockDim.x ) {
+	
+		int i = k % N, j = k / N;
+		atomicAdd ( &dW[( size_t ) ( first + j ) * N + i], xs[i] * error[j] );
+		
+	}
+	
+	for ( int i = threadIdx.x; i < N; i += blockDim.x ) {
+	
+		dtype sum = 0;
+		
+		for ( int j = 0; j < members; j++ )
+			sum += W[( size_t ) ( first + j ) * N + i] * error[j];
+			
+		dx[row + i * B] += sum;
+		
+	}
+	
+}
+
+void cu_class_softmax_backward ( dtype *__restrict__ dx, dtype *__restrict__ dW, dtype *__restrict__ db,
+								 dtype *__restrict__ pw, dtype *__restrict__ x, dtype *__restrict__ W, dtype *__restrict__ targets,
+								 dtype *__restrict__ token_class, dtype *__restrict__ token_column, dtype *__restrict__ bounds, size_t N,
+								 size_t B, size_t K ) {
+								 
+	size_t shared = ( N + K ) * sizeof ( dtype );
+	kernel_class_softmax_backward <<<B, NUM_THREADS, shared>>> ( dx, dW, db, pw, x, W, targets, token_class,
+			token_column, bounds, N, B );
+			
+}
+
+/* x in [lo, hi] -> round ( ( x - lo ) / ( hi - lo ) * ( 2^bits - 1 ) ), 8 or 16 bits */
+__global__ void kernel_stash_encode ( void *__restrict__ q, const dtype *__restrict__ x, size_t n, dtype lo,
+									  dtype hi, int bits ) {
+									  
+	int tid = blockDim.x * blockIdx.x + threadIdx.x;
+	
+	if ( tid < n ) {
+	
+		dtype levels = bits == 8 ? 255 : 65535;
+		dtype v = rint ( ( x[tid] - lo ) / ( hi - lo ) * levels );
+		v = fmin ( fmax ( v, ( dtype ) 0 ), levels );
+		
+		if ( bits == 8 ) ( ( uint8_t * ) q ) [tid] = ( uint8_t ) v;
+		else ( ( uint16_t * ) q ) [tid] = ( uint16_t ) v;
+		
+	}
+	
+}
+
+void cu_stash_encode ( void *__restrict__ q, dtype *__restrict__ x, size_t elements, dtype lo, dtype hi, int bits,
+					   int stream_idx ) {
+					   
+	size_t num_blocks = ( elements + NUM_THREADS - 1 ) / NUM_THREADS;
+	kernel_stash_encode <<<num_blocks, NUM_THREADS, stream_idx>>> ( q, x, elements, lo, hi, bits );
+	
+}
+
+__global__ void kernel_stash_decode ( dtype *__restrict__ x, const void *__restrict__ q, size_t n, dtype lo,
+									  dtype hi, int bits ) {
+									  
+	int tid = blockDim.x * blockIdx.x + threadIdx.x;
+	
+	if ( tid < n ) {
+	
+		dtype v = bits == 8 ? ( ( const uint8_t * ) q ) [tid] : ( ( const uint16_t * ) q ) [tid];
+		x[tid] = lo + v * ( ( hi - lo ) / ( bits == 8 ? 255 : 65535 ) );
+		
+	}
+	
+}
+
+void cu_stash_decode ( dtype *__restrict__ x, void *__restrict__ q, size_t elements, dtype lo, dtype hi, int bits,
+					   int stream_idx ) {
+					   
+	size_t num_blocks = ( elements + NUM_THREADS - 1 ) / NUM_THREADS;
+	kernel_stash_decode <<<num_blocks, NUM_THREADS, stream_idx>>> ( x, q, elements, lo, hi, bits );
+	
+}
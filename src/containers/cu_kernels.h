@@ -16,6 +16,7 @@
 #define __KERNELS_H__
 
 #include <curand.h>
+#include <containers/philox.h>
 extern curandGenerator_t prng;
 
 void cu_sub (
@@ -563,7 +564,7 @@ void cu_elementwise_hardattlstm_forward (
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
 	dtype *__restrict__ prev_h,
-	dtype *__restrict__ rands,
+	philox_key key,
 	size_t N, size_t L, size_t B, int stream_idx = 0 );
 
 
@@ -578,7 +579,7 @@ __global__ void kernel_elementwise_hardattlstm_forward (
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
 	dtype *__restrict__ prev_h,
-	dtype *__restrict__ rands,
+	philox_key key,
 	size_t N, size_t L, size_t B );
 
 void cu_elementwise_hardattlstm_backward (
@@ -849,7 +850,7 @@ void cu_elementwise_alstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	philox_key key,
 	size_t N, size_t L, size_t B, int stream_idx = 0 );
 
 
@@ -862,7 +863,7 @@ __global__ void kernel_elementwise_alstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	philox_key key,
 	size_t N, size_t L, size_t B );
 
 void cu_elementwise_alstm_backward (
@@ -902,7 +903,7 @@ void cu_elementwise_dolstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	const uint32_t *__restrict__ mask,
 	size_t N, size_t L, size_t B, int stream_idx = 0 );
 
 
@@ -915,7 +916,7 @@ __global__ void kernel_elementwise_dolstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	const uint32_t *__restrict__ mask,
 	size_t N, size_t L, size_t B );
 
 void cu_elementwise_dolstm_backward (
@@ -1055,7 +1056,7 @@ void cu_elementwise_splstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	philox_key key,
 	size_t N, size_t L, size_t B, int stream_idx = 0 );
 
 
@@ -1068,7 +1069,7 @@ __global__ void kernel_elementwise_splstm_forward (
 	dtype *__restrict__ c,
 	dtype *__restrict__ ct,
 	dtype *__restrict__ prev_c,
-	dtype *__restrict__ rands,
+	philox_key key,
 	size_t N, size_t L, size_t B );
 
 void cu_elementwise_splstm_backward (
@@ -1151,9 +1152,33 @@ __global__ void kernel_elementwise_adadelta_decay (
 	dtype *__restrict__ u,
 	size_t N, dtype decay );
 
+void cu_elementwise_dynamic (
+	dtype learning_rate, dtype rho, dtype decay,
+	dtype *__restrict__ p,
+	dtype *__restrict__ d,
+	dtype *__restrict__ m,
+	const dtype *__restrict__ p0,
+	size_t N, int stream_idx = 0 );
+
+
+__global__ void kernel_elementwise_dynamic (
+	dtype learning_rate, dtype rho, dtype decay,
+	dtype *__restrict__ p,
+	dtype *__restrict__ d,
+	dtype *__restrict__ m,
+	const dtype *__restrict__ p0,
+	size_t N );
+
 
 void cu_rand ( dtype *__restrict__ data, size_t elements );
 void cu_randn ( dtype *__restrict__ data, size_t elements, dtype mean, dtype stddev );
+
+/* counter-based, see philox.h */
+void cu_philox_uniform ( dtype *__restrict__ data, size_t elements, philox_key key, int stream_idx = 0 );
+__global__ void kernel_philox_uniform ( dtype *__restrict__ data, size_t n, philox_key key );
+void cu_philox_mask ( uint32_t *__restrict__ mask, size_t bits, philox_key key, dtype p, int stream_idx = 0 );
+__global__ void kernel_philox_mask ( uint32_t *__restrict__ mask, size_t words, philox_key key, dtype p );
+
 __global__ void kernel_elementwise_div_scalar ( dtype *__restrict__ c, dtype *__restrict__ src, dtype scalar,
 		size_t n );
 void cu_div_scalar ( dtype *__restrict__ data, dtype *__restrict__ src, dtype scalar, size_t elements,
@@ -1176,4 +1201,36 @@ void cu_elementwise_sparselstm_sparsity ( size_t N, size_t L, size_t B, size_t S
 __global__ void kernel_elementwise_sparselstm_sparsity ( size_t N, size_t L, size_t B, size_t S,
 		dtype *__restrict__ b, dtype corr );
 
+/* class-factored softmax, see layers/cu_class_softmax.h */
+void cu_class_softmax_forward ( dtype *__restrict__ p, dtype *__restrict__ pw, dtype *__restrict__ pc,
+								dtype *__restrict__ x, dtype *__restrict__ W, dtype *__restrict__ b, dtype *__restrict__ targets,
+								dtype *__restrict__ token_class, dtype *__restrict__ token_column, dtype *__restrict__ bounds, size_t N,
+								size_t B, size_t K );
+__global__ void kernel_class_softmax_forward ( dtype *__restrict__ p, dtype *__restrict__ pw,
+		const dtype *__restrict__ pc, const dtype *__restrict__ x, const dtype *__restrict__ W,
+		const dtype *__restrict__ b, const dtype *__restrict__ targets, const dtype *__restrict__ token_class,
+		const dtype *__restrict__ token_column, const dtype *__restrict__ bounds, int N, int B, int K );
+void cu_class_softmax_error ( dtype *__restrict__ gc, dtype *__restrict__ pc, dtype *__restrict__ targets,
+							  dtype *__restrict__ token_class, size_t C, size_t B );
+__global__ void kernel_class_softmax_error ( dtype *__restrict__ gc, const dtype *__restrict__ pc,
+		const dtype *__restrict__ targets, const dtype *__restrict__ token_class, size_t C, size_t B );
+void cu_class_softmax_backward ( dtype *__restrict__ dx, dtype *__restrict__ dW, dtype *__restrict__ db,
+								 dtype *__restrict__ pw, dtype *__restrict__ x, dtype *__restrict__ W, dtype *__restrict__ targets,
+								 dtype *__restrict__ token_class, dtype *__restrict__ token_column, dtype *__restrict__ bounds, size_t N,
+								 size_t B, size_t K );
+__global__ void kernel_class_softmax_backward ( dtype *__restrict__ dx, dtype *__restrict__ dW,
+		dtype *__restrict__ db, const dtype *__restrict__ pw, const dtype *__restrict__ x,
+		const dtype *__restrict__ W, const dtype *__restrict__ targets, const dtype *__restrict__ token_class,
+		const dtype *__restrict__ token_column, const dtype *__restrict__ bounds, int N, int B );
+
+/* fixed-point activation stash, see stash.h */
+void cu_stash_encode ( void *__restrict__ q, dtype *__restrict__ x, size_t elements, dtype lo, dtype hi, int bits,
+					   int stream_idx = 0 );
+__global__ void kernel_stash_encode ( void *__restrict__ q, const dtype *__restrict__ x, size_t n, dtype lo,
+									  dtype hi, int bits );
+void cu_stash_decode ( dtype *__restrict__ x, void *__restrict__ q, size_t elements, dtype lo, dtype hi, int bits,
+					   int stream_idx = 0 );
+__global__ void kernel_stash_decode ( dtype *__restrict__ x, const void *__restrict__ q, size_t n, dtype lo,
+									  dtype hi, int bits );
+
 #endif
@@ -22,7 +22,9 @@
 #include <state.h>
 
 curandGenerator_t prng;
-cublasHandle_t handle;
+
+// per thread, every thread calling CU_GEMM runs init_cublas first (see evaluator.h)
+thread_local cublasHandle_t handle;
 
 #ifdef __PRECISE_MATH__
 	#define cublas_gemm cublasDgemm
@@ -33,7 +35,7 @@ cublasHandle_t handle;
 #endif
 
 #define STREAMS 8
-cudaStream_t streams[STREAMS];
+thread_local cudaStream_t streams[STREAMS];
 
 template <typename T>
 class cu_matrix : public matrix<T> {
@@ -42,6 +44,7 @@ class cu_matrix : public matrix<T> {
 	
 		T *cu_data;
 		size_t cu_bytes_allocated = 0;
+		bool cu_owns_data = true;
 		
 		cu_matrix() : matrix<T>() { };
 		
@@ -62,18 +65,39 @@ class cu_matrix : public matrix<T> {
 		
 			cudaMalloc ( ( void ** ) & ( cu_data ), rows * cols * sizeof ( dtype ) );
 			cu_bytes_allocated = rows * cols * sizeof ( dtype );
+			cu_owns_data = true;
 			
 		}
 		
 		void cu_dealloc() {
 		
 			if ( cu_bytes_allocated > 0 ) {
-				cudaFree ( cu_data );
+				if ( cu_owns_data ) cudaFree ( cu_data );
 				cu_bytes_allocated = 0;
 			}
 			
 		}
 		
+		/* host and device storage shared with other */
+		void alias ( cu_matrix &other ) {
+		
+			matrix<T>::alias ( other );
+			alias_device ( other );
+			
+		}
+		
+		void alias ( T *ptr ) { matrix<T>::alias ( ptr ); }
+		
+		/* only device storage shared with other */
+		void alias_device ( cu_matrix &other ) {
+		
+			cu_dealloc();
+			cu_data = other.cu_data;
+			cu_bytes_allocated = other.cu_bytes_allocated;
+			cu_owns_data = false;
+			
+		}
+		
 		void cu_resize ( const size_t new_rows, const size_t new_cols ) {
 		
 			size_t other_bytes = new_rows * new_cols * sizeof ( T );
@@ -133,10 +157,81 @@ class cu_matrix : public matrix<T> {
 		
 };
 
+/*
+	bit-packed device mask (1 bit per element), filled by the
+	counter-based generator; 32x less traffic than a dtype matrix
+	of randoms and can be kept for backward
+*/
+class cu_mask {
+
+	public:
+	
+		uint32_t *cu_data = nullptr;
+		size_t bits = 0;
+		size_t cu_bytes_allocated = 0;
+		
+		cu_mask() { };
+		
+		cu_mask ( size_t _bits ) { cu_resize ( _bits ); cu_zero(); };
+		
+		virtual ~cu_mask() {
+		
+			cu_dealloc();
+		}
+		
+		size_t words() const { return ( bits + 31 ) / 32; }
+		
+		void cu_dealloc() {
+		
+			if ( cu_bytes_allocated > 0 ) {
+				cudaFree ( cu_data );
+				cu_bytes_allocated = 0;
+			}
+			
+		}
+		
+		void cu_resize ( const size_t new_bits ) {
+		
+			bits = new_bits;
+			
+			if ( words() * sizeof ( uint32_t ) > cu_bytes_allocated ) {
+			
+				cu_dealloc();
+				cudaMalloc ( ( void ** ) & ( cu_data ), words() * sizeof ( uint32_t ) );
+				cu_bytes_allocated = words() * sizeof ( uint32_t );
+				
+			}
+			
+		}
+		
+		void cu_zero() {
+		
+			cudaMemset ( cu_data, '\0', words() * sizeof ( uint32_t ) );
+		}
+		
+		/* each bit set with probability p */
+		void fill ( philox_key key, dtype p ) {
+		
+			cu_philox_mask ( cu_data, bits, key, p );
+			
+		}
+		
+		cu_mask &operator= ( const cu_mask &other ) {
+		
+			cu_resize ( other.bits );
+			cudaMemcpy ( cu_data, other.cu_data, words() * sizeof ( uint32_t ), cudaMemcpyDeviceToDevice );
+			return *this;
+			
+		};
+		
+		cu_mask ( const cu_mask &other ) { operator= ( other ); }
+		
+};
+
 void init_curand ( void ) {
 
 	curandCreateGenerator ( &prng, CURAND_RNG_PSEUDO_DEFAULT );
-	curandSetPseudoRandomGeneratorSeed ( prng, ( unsigned long long ) clock() );
+	curandSetPseudoRandomGeneratorSeed ( prng, ( unsigned long long ) philox_seed );
 	
 }
 
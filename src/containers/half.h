@@ -0,0 +1,270 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * 16-bit weights for GEMV (host), see engine.h
+ *
+ * bfloat16 (the upper half of a float: 8-bit exponent, 7-bit
+ * mantissa) or IEEE fp16 (5-bit exponent, 10-bit mantissa);
+ * stored only, every product and sum is fp32. The conversion to
+ * fp32 is done on the fly, 8 values at a time:
+ *
+ * - bf16: zero-extend and shift left by 16 (AVX2), nothing else
+ *   is needed, so no native bf16 support is assumed
+ * - fp16: vcvtph2ps (F16C)
+ * - otherwise scalar, bit by bit
+ *
+ * and fed straight to the FMAs of gemv (), for up to 4 inputs;
+ * the columns are stored in groups of 16 (all rows of a group
+ * contiguous), so the sums of a group stay in registers.
+ *
+ * fp32 -> 16 bits rounds to nearest even, once, when packing.
+ *
+ */
+
+#ifndef __HALF_H__
+#define __HALF_H__
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#endif
+
+#define HALF_BF16 0
+#define HALF_FP16 1
+
+inline uint16_t float_to_bf16 ( float f ) {
+
+	uint32_t x;
+	memcpy ( &x, &f, 4 );
+	
+	// NaN stays NaN
+	if ( ( x & 0x7fffffff ) > 0x7f800000 ) return ( x >> 16 ) | 0x40;
+	
+	return ( x + 0x7fff + ( ( x >> 16 ) & 1 ) ) >> 16;
+	
+}
+
+inline float bf16_to_float ( uint16_t h ) {
+
+	uint32_t x = ( uint32_t ) h << 16;
+	float f;
+	memcpy ( &f, &x, 4 );
+	return f;
+	
+}
+
+inline uint16_t float_to_fp16 ( float f ) {
+
+	uint32_t x;
+	memcpy ( &x, &f, 4 );
+	
+	uint32_t sign = ( x >> 16 ) & 0x8000, magnitude = x & 0x7fffffff;
+	
+	// Inf / NaN, overflow
+	if ( magnitude >= 0x7f800000 ) return sign | 0x7c00 | ( magnitude > 0x7f800000 ? 0x200 : 0 );
+	
+	if ( magnitude >= 0x477ff000 ) return sign | 0x7c00;
+	
+	// subnormal or zero: scale by 2^-24 and round
+	if ( magnitude < 0x38800000 ) {
+	
+		float a;
+		memcpy ( &a, &magnitude, 4 );
+		return sign | ( uint16_t ) nearbyintf ( a * 16777216.0f );
+		
+	}
+	
+	// rebias the exponent, round the 13 dropped bits to nearest even
+	uint32_t h = ( magnitude - 0x38000000 ) >> 13;
+	uint32_t rest = magnitude & 0x1fff;
+	
+	if ( rest > 0x1000 || ( rest == 0x1000 && ( h & 1 ) ) ) h++;
+	
+	return sign | h;
+	
+}
+
+inline float fp16_to_float ( uint16_t h ) {
+
+	uint32_t sign = ( uint32_t ) ( h & 0x8000 ) << 16, exponent = ( h >> 10 ) & 0x1f, mantissa = h & 0x3ff;
+	uint32_t x;
+	
+	if ( exponent == 0x1f ) x = sign | 0x7f800000 | ( mantissa << 13 );
+	else if ( exponent > 0 ) x = sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+	else {
+	
+		// subnormal or zero
+		float f = mantissa / 16777216.0f;
+		return sign ? -f : f;
+		
+	}
+	
+	float f;
+	memcpy ( &f, &x, 4 );
+	return f;
+	
+}
+
+class HalfMatrix {
+
+	public:
+	
+		HalfMatrix() = default;
+		
+		/* w - rows x cols, row-major; stored as groups of 16 columns, each holding all rows */
+		HalfMatrix ( const float *w, size_t _rows, size_t _cols, int _format ) : rows ( _rows ), cols ( _cols ),
+			format ( _format ) {
+			
+			h.assign ( ( cols + 15 ) / 16 * 16 * rows, 0 );
+			
+			for ( size_t k = 0; k < rows; k++ )
+				for ( size_t c = 0; c < cols; c++ )
+					h[at ( k, c )] = format == HALF_BF16 ? float_to_bf16 ( w[k * cols + c] ) : float_to_fp16 ( w[k * cols + c] );
+					
+		}
+		
+		/* n values of row k from column first (a multiple of 16), as floats */
+		void row ( size_t k, size_t first, size_t n, float *out ) const {
+		
+			for ( size_t c = 0; c < n; c += 16 ) {
+			
+				const uint16_t *src = &h[at ( k, first + c )];
+				size_t i = 0, count = std::min<size_t> ( 16, n - c );
+				
+				#if defined(__AVX2__) && defined(__FMA__)
+				
+				for ( ; i + 8 <= count; i += 8 )
+					_mm256_storeu_ps ( out + c + i, load8 ( src + i ) );
+					
+				#endif
+				
+				for ( ; i < count; i++ )
+					out[c + i] = convert ( src[i] );
+					
+			}
+			
+		}
+		
+		/*
+			acc[b * stride + c - first] += sum_k x_b[k] w[row + k][c], for
+			columns [first, first + width) (first a multiple of 16) and B <= 4
+			inputs x + b * ldx; the weights are converted in registers, the
+			sums stay there for a whole group
+		*/
+		void gemv ( size_t row, size_t rows, const float *x, size_t ldx, size_t B, size_t first, size_t width, float *acc,
+					size_t stride ) const {
+					
+			for ( size_t c = 0; c < width; c += 16 ) {
+			
+				const uint16_t *w = &h[at ( row, first + c )];
+				float *out = acc + c;
+				
+				#if defined(__AVX2__) && defined(__FMA__)
+				
+				if ( c + 16 <= width ) {
+				
+					// even and odd rows into separate sums, more FMAs in flight
+					__m256 sums[2][4][2];
+					
+					for ( size_t b = 0; b < B; b++ )
+						for ( size_t j = 0; j < 2; j++ ) {
+						
+							sums[0][b][j] = _mm256_loadu_ps ( out + b * stride + 8 * j );
+							sums[1][b][j] = _mm256_setzero_ps();
+							
+						}
+						
+					size_t k = 0;
+					
+					for ( ; k < rows; k++ ) {
+					
+						__m256 w0 = load8 ( w + k * 16 ), w1 = load8 ( w + k * 16 + 8 );
+						
+						for ( size_t b = 0; b < B; b++ ) {
+						
+							__m256 v = _mm256_set1_ps ( x[b * ldx + k] );
+							sums[k & 1][b][0] = _mm256_fmadd_ps ( v, w0, sums[k & 1][b][0] );
+							sums[k & 1][b][1] = _mm256_fmadd_ps ( v, w1, sums[k & 1][b][1] );
+							
+						}
+						
+					}
+					
+					for ( size_t b = 0; b < B; b++ )
+						for ( size_t j = 0; j < 2; j++ )
+							_mm256_storeu_ps ( out + b * stride + 8 * j, _mm256_add_ps ( sums[0][b][j], sums[1][b][j] ) );
+							
+					continue;
+					
+				}
+				
+				#endif
+				
+				for ( size_t k = 0; k < rows; k++ )
+					for ( size_t i = 0; i < 16 && c + i < width; i++ ) {
+					
+						float weight = convert ( w[k * 16 + i] );
+						
+						for ( size_t b = 0; b < B; b++ )
+							out[b * stride + i] += x[b * ldx + k] * weight;
+							
+					}
+					
+			}
+			
+		}
+		
+		size_t bytes() const { return h.size() * sizeof ( uint16_t ); }
+		
+		size_t rows = 0, cols = 0;
+		int format = HALF_BF16;
+		
+		std::vector<uint16_t> h;
+		
+	protected:
+	
+		inline size_t at ( size_t k, size_t c ) const { return ( c / 16 ) * rows * 16 + k * 16 + c % 16; }
+		
+		inline float convert ( uint16_t x ) const { return format == HALF_BF16 ? bf16_to_float ( x ) : fp16_to_float ( x ); }
+		
+		#if defined(__AVX2__) && defined(__FMA__)
+		
+		/* 8 values as floats */
+		inline __m256 load8 ( const uint16_t *src ) const {
+		
+			__m128i packed = _mm_loadu_si128 ( ( const __m128i * ) src );
+			
+			#if defined(__F16C__)
+			
+			if ( format == HALF_FP16 ) return _mm256_cvtph_ps ( packed );
+			
+			#else
+			
+			if ( format == HALF_FP16 ) {
+			
+				float out[8];
+				
+				for ( size_t i = 0; i < 8; i++ )
+					out[i] = fp16_to_float ( src[i] );
+					
+				return _mm256_loadu_ps ( out );
+				
+			}
+			
+			#endif
+			
+			return _mm256_castsi256_ps ( _mm256_slli_epi32 ( _mm256_cvtepu16_epi32 ( packed ), 16 ) );
+			
+		}
+		
+		#endif
+		
+};
+
+#endif /* __HALF_H__ */
@@ -0,0 +1,184 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Int8 weights for GEMV (host), see engine.h
+ *
+ * Symmetric post-training quantization, one scale per output
+ * (column c of a rows x cols row-major matrix, i.e. a row of the
+ * transposed weights): q = round ( w / scale ), scale = max |w|
+ * / 127, so q is in [-127, 127]. Inputs are int8 as well (h is in
+ * ( -1, 1 ), quantized with a fixed 1 / 127), the products are
+ * summed in int32 and scaled back once.
+ *
+ * Layout: groups of 8 columns, each holding all rows, 4 rows x 8
+ * columns (32 bytes, one register) at a time; rows are padded to
+ * a multiple of 4, columns to a multiple of 8. A group is then
+ * streamed once for up to 4 inputs, with the sums in registers:
+ *
+ * - VNNI (AVX512-VNNI + VL, or AVX-VNNI): dpbusd
+ * - AVX2: maddubs ( int16 pairs ) + madd ( int32 )
+ * - otherwise plain loops
+ *
+ * dpbusd / maddubs take unsigned x signed bytes, so the input is
+ * passed as | x | and its sign moved to the weights (sign_epi8);
+ * with | q | <= 127 a maddubs pair cannot saturate.
+ *
+ */
+
+#ifndef __INT8_H__
+#define __INT8_H__
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#endif
+
+/* quantized input: x / scale rounded into [-127, 127] */
+inline int8_t quantize_int8 ( float x, float scale ) {
+
+	float q = nearbyintf ( x / scale );
+	
+	return ( int8_t ) ( q > 127 ? 127 : ( q < -127 ? -127 : q ) );
+	
+}
+
+class Int8Matrix {
+
+	public:
+	
+		Int8Matrix() = default;
+		
+		/* w - rows x cols, row-major */
+		Int8Matrix ( const float *w, size_t _rows, size_t _cols ) : rows ( _rows ), cols ( _cols ) {
+		
+			blocks = ( rows + 3 ) / 4;
+			groups = ( cols + 7 ) / 8;
+			
+			q.assign ( groups * blocks * 32, 0 );
+			scales.assign ( groups * 8, 0 );
+			
+			for ( size_t c = 0; c < cols; c++ ) {
+			
+				float largest = 0;
+				
+				for ( size_t k = 0; k < rows; k++ )
+					largest = std::max ( largest, fabsf ( w[k * cols + c] ) );
+					
+				scales[c] = largest > 0 ? largest / 127 : 1;
+				
+				for ( size_t k = 0; k < rows; k++ )
+					q[ ( ( c / 8 ) * blocks + k / 4 ) * 32 + ( c % 8 ) * 4 + k % 4] = quantize_int8 ( w[k * cols + c], scales[c] );
+					
+			}
+			
+		}
+		
+		/*
+			acc[b * stride + c - first] = sum_k x_b[k] q[k][c] for columns
+			[first, last) (first a multiple of 8) and B <= 4 inputs; rows
+			[0, split) are read from x0 + b * ldx, the rest from x1 + b * ldx
+			(split a multiple of 4, both padded with zeros)
+		*/
+		void gemv ( const int8_t *x0, const int8_t *x1, size_t split, size_t ldx, size_t B, size_t first, size_t last,
+					int32_t *acc, size_t stride ) const {
+					
+			const size_t head = split / 4;
+			
+			for ( size_t group = first / 8; group < ( last + 7 ) / 8; group++ ) {
+			
+				const int8_t *w = &q[group * blocks * 32];
+				int32_t *out = acc + group * 8 - first;
+				
+				#if defined(__AVX2__)
+				
+				__m256i sums[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+				
+				for ( size_t kb = 0; kb < blocks; kb++ ) {
+				
+					__m256i weights = _mm256_loadu_si256 ( ( const __m256i * ) ( w + kb * 32 ) );
+					const int8_t *x = kb < head ? x0 + kb * 4 : x1 + ( kb - head ) * 4;
+					
+					for ( size_t b = 0; b < B; b++ ) {
+					
+						int32_t packed;
+						memcpy ( &packed, x + b * ldx, 4 );
+						
+						__m256i input = _mm256_set1_epi32 ( packed );
+						sums[b] = dot ( sums[b], _mm256_abs_epi8 ( input ), _mm256_sign_epi8 ( weights, input ) );
+						
+					}
+					
+				}
+				
+				for ( size_t b = 0; b < B; b++ ) {
+				
+					int32_t lanes[8];
+					_mm256_storeu_si256 ( ( __m256i * ) lanes, sums[b] );
+					
+					for ( size_t c = 0; c < 8 && group * 8 + c < last; c++ )
+						out[b * stride + c] = lanes[c];
+						
+				}
+				
+				#else
+				
+				for ( size_t b = 0; b < B; b++ ) {
+				
+					int32_t lanes[8] = { 0 };
+					
+					for ( size_t kb = 0; kb < blocks; kb++ ) {
+					
+						const int8_t *x = ( kb < head ? x0 + kb * 4 : x1 + ( kb - head ) * 4 ) + b * ldx;
+						
+						for ( size_t c = 0; c < 8; c++ )
+							for ( size_t i = 0; i < 4; i++ )
+								lanes[c] += ( int32_t ) x[i] * w[kb * 32 + c * 4 + i];
+								
+					}
+					
+					for ( size_t c = 0; c < 8 && group * 8 + c < last; c++ )
+						out[b * stride + c] = lanes[c];
+						
+				}
+				
+				#endif
+				
+			}
+			
+		}
+		
+		size_t bytes() const { return q.size() + scales.size() * sizeof ( float ); }
+		
+		size_t rows = 0, cols = 0, blocks = 0, groups = 0;
+		
+		std::vector<int8_t> q;
+		std::vector<float> scales;
+		
+	protected:
+	
+		#if defined(__AVX2__)
+		
+		/* sums + 4-byte dot products of unsigned x and signed w, per int32 lane */
+		static inline __m256i dot ( __m256i sums, __m256i x, __m256i w ) {
+		
+			#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+			return _mm256_dpbusd_epi32 ( sums, x, w );
+			#elif defined(__AVXVNNI__)
+			return _mm256_dpbusd_avx_epi32 ( sums, x, w );
+			#else
+			return _mm256_add_epi32 ( sums, _mm256_madd_epi16 ( _mm256_maddubs_epi16 ( x, w ), _mm256_set1_epi16 ( 1 ) ) );
+			#endif
+			
+		}
+		
+		#endif
+		
+};
+
+#endif /* __INT8_H__ */
@@ -11,47 +11,131 @@
 
 #include <fstream>
 #include <sstream>
-#include <containers/datatype.h>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include <containers/shards.h>
 
-MatrixXi rawread ( const char *filename ) {
+#include <containers/datatype.h>
 
-	MatrixXi m ( 0, 0 );
+/*
+	read-only byte corpus
+	
+	either a raw file or a packed directory (containers/shards.h),
+	mapped, not copied; block() returns a view sharing the
+	mapping (e.g. train / valid / test splits or one part per
+	worker), the mapping goes away with the last view
 	
-	if ( FILE *fp = fopen ( filename, "rb" ) ) {
+	a BPE-encoded corpus (containers/bpe.h) has 2-byte elements,
+	sizes and offsets are in elements
+*/
+
+class Corpus {
+
+	public:
 	
-		std::vector<unsigned char> v;
-		char buf[1024];
+		Corpus() = default;
+		
+		Corpus ( const char *filename ) {
 		
-		while ( size_t len = fread ( buf, 1, sizeof ( buf ), fp ) )
-			v.insert ( v.end(), buf, buf + len );
+			ShardIndex index;
+			struct stat st;
+			
+			if ( index.load ( filename ) ) {
+			
+				source = std::make_shared<Shards> ( filename, index );
+				_size = index.total_bytes;
+				
+				std::cout << "Packed corpus " << _size << " bytes in " << index.shards() << " shards (" << filename <<
+						  ")" << std::endl;
+						
+			} else if ( stat ( filename, &st ) != 0 )
+			
+				std::cout << "open error: (" << filename << ")" << std::endl;
+				
+			else if ( st.st_size == 0 )
+			
+				std::cout << "Empty file! (" << filename << ")" << std::endl;
+				
+			else {
+			
+				source = std::make_shared<Shards> ( filename, st.st_size );
+				_size = st.st_size;
+				
+				std::cout << "Mapped " << _size << " bytes (" << filename << ")" << std::endl;
+				
+			}
 			
-		fclose ( fp );
+		}
+		
+		Corpus ( std::shared_ptr<Shards> _source, size_t _width = 1 ) :
+			source ( _source ), _size ( _source->index.total_bytes / _width ), width ( _width ) {}
 		
-		if ( v.size() > 0 ) {
+		/* zero-copy view of [offset, offset + length) */
+		Corpus block ( size_t offset, size_t length ) const {
 		
-			std::cout << "Read " << v.size() << " bytes (" << filename
-					  << ")" << std::endl;
-					  
-			m.resize ( v.size(), 1 );
+			Corpus view;
 			
-			// TODO: probably there is a better way to map std::vector to Eigen::MatrixXi
-			for ( int i = 0; i < v.size(); i++ )
+			view.source = source;
+			view._offset = _offset + offset;
+			view._size = length;
+			view.width = width;
+			view.tokens_per_byte = tokens_per_byte;
 			
-				m ( i ) = ( int ) v[i];
-				
+			return view;
+			
+		}
+		
+		/* contiguous part k of n, e.g. for worker k */
+		Corpus part ( size_t k, size_t n ) const {
+		
+			return block ( k * ( _size / n ), k + 1 < n ? _size / n : _size - k * ( _size / n ) );
+			
+		}
+		
+		/* 0 - train, 1 - valid, 2 - test, as recorded by the packer */
+		Corpus split ( size_t k ) const {
+		
+			const size_t *range = source->index.splits[k];
+			return block ( range[0], range[1] - range[0] );
+			
+		}
+		
+		bool packed() const { return source != nullptr && source->packed; }
+		
+		size_t operator[] ( size_t i ) const {
+		
+			size_t j = ( _offset + i ) * width;
+			return width == 1 ? source->at ( j ) : source->at ( j ) | ( size_t ) source->at ( j + 1 ) << 8;
+			
+		}
+		
+		size_t size() const { return _size; }
+		size_t rows() const { return _size; }
+		
+		/* occurrences of each of the values 0 .. symbols - 1 among the first max_elements */
+		std::vector<size_t> histogram ( size_t symbols, size_t max_elements ) const {
+		
+			std::vector<size_t> counts ( symbols );
+			
+			for ( size_t i = 0; i < std::min ( _size, max_elements ); i++ )
+				counts[( *this ) [i]]++;
 				
-		} else
+			return counts;
+			
+		}
 		
-			std::cout << "Empty file! (" << filename << ")" <<
-					  std::endl;
-					  
-					  
-	} else
+		/* to report losses per original byte */
+		double tokens_per_byte = 1.0;
+		
+	protected:
 	
-		std::cout << "fopen error: (" << filename << ")" <<
-				  std::endl;
-				  
-	return m;
+		std::shared_ptr<Shards> source;
+		size_t _offset = 0;
+		size_t _size = 0;
+		size_t width = 1;
+		
 };
 
 void save_matrix_to_file ( Matrix &m,
@@ -133,6 +133,24 @@ class MatrixArray {
 				matrices[i].sync_host();
 		}
 		
+		void sync_device() {
+		
+			for ( size_t i = 0; i < matrices.size(); i++ )
+				matrices[i].sync_device();
+		}
+		
+		/* same columns, new number of rows; storage is only reallocated if it grows */
+		void resize_rows ( size_t rows ) {
+		
+			for ( size_t i = 0; i < matrices.size(); i++ ) {
+			
+				matrices[i].resize ( rows, matrices[i].cols() );
+				matrices[i].cu_resize ( rows, matrices[i].cols() );
+				
+			}
+			
+		}
+		
 		template<class Archive>
 		void serialize ( Archive &archive ) {
 		
@@ -0,0 +1,163 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Counter-based RNG (Philox4x32-10, Salmon et al., SC'11)
+ *
+ * Every random number is a pure function of
+ * (seed, layer, step, element), so kernels can draw
+ * inline without a pre-filled B x N matrix of randoms and
+ * the result does not depend on how the work is split
+ * between threads. Compiles for both host and device.
+ *
+ */
+
+#ifndef __PHILOX_H__
+#define __PHILOX_H__
+
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__CUDACC__)
+	#define PHILOX_HD __host__ __device__ __forceinline__
+#else
+	#define PHILOX_HD inline
+#endif
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+/* layer id used by the host-side helpers (randn, rand_uniform, ...) */
+#define PHILOX_HOST_STREAM 0xFFFFFFFFu
+/* layer id used for batch positions (batcher.h) */
+#define PHILOX_BATCH_STREAM 0xFFFFFFFEu
+
+/* passed by value to kernels */
+typedef struct {
+
+	uint64_t seed;
+	uint32_t layer;
+	uint32_t step;
+	
+} philox_key;
+
+typedef struct {
+
+	uint32_t x[4];
+	
+} philox_out;
+
+PHILOX_HD philox_key make_philox_key ( uint64_t seed, uint32_t layer, uint32_t step ) {
+
+	philox_key k;
+	k.seed = seed;
+	k.layer = layer;
+	k.step = step;
+	return k;
+	
+}
+
+PHILOX_HD uint32_t philox_mulhilo ( uint32_t a, uint32_t b, uint32_t *hi ) {
+
+	#if defined(__CUDA_ARCH__)
+	*hi = __umulhi ( a, b );
+	return a * b;
+	#else
+	uint64_t p = ( uint64_t ) a * ( uint64_t ) b;
+	*hi = ( uint32_t ) ( p >> 32 );
+	return ( uint32_t ) p;
+	#endif
+	
+}
+
+/* counter = (element lo, element hi, step, layer), key = seed */
+PHILOX_HD philox_out philox4x32 ( philox_key key, uint64_t element ) {
+
+	uint32_t c0 = ( uint32_t ) element;
+	uint32_t c1 = ( uint32_t ) ( element >> 32 );
+	uint32_t c2 = key.step;
+	uint32_t c3 = key.layer;
+	uint32_t k0 = ( uint32_t ) key.seed;
+	uint32_t k1 = ( uint32_t ) ( key.seed >> 32 );
+	
+	#ifdef __CUDACC__
+	#pragma unroll
+	#endif
+	
+	for ( int r = 0; r < 10; r++ ) {
+	
+		uint32_t hi0, hi1;
+		uint32_t lo0 = philox_mulhilo ( PHILOX_M0, c0, &hi0 );
+		uint32_t lo1 = philox_mulhilo ( PHILOX_M1, c2, &hi1 );
+		
+		c0 = hi1 ^ c1 ^ k0;
+		c1 = lo1;
+		c2 = hi0 ^ c3 ^ k1;
+		c3 = lo0;
+		
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+		
+	}
+	
+	philox_out out;
+	out.x[0] = c0; out.x[1] = c1; out.x[2] = c2; out.x[3] = c3;
+	return out;
+	
+}
+
+/* uniform in (0, 1], 24 bits so that it is exact in float */
+PHILOX_HD float philox_u01 ( uint32_t x ) {
+
+	return ( float ) ( ( x >> 8 ) + 1 ) * ( 1.0f / 16777216.0f );
+	
+}
+
+PHILOX_HD float philox_uniform ( philox_key key, uint64_t element ) {
+
+	return philox_u01 ( philox4x32 ( key, element ).x[0] );
+	
+}
+
+/* Box-Muller on two words of the same block */
+PHILOX_HD float philox_normal ( philox_key key, uint64_t element ) {
+
+	philox_out r = philox4x32 ( key, element );
+	float u1 = philox_u01 ( r.x[0] );
+	float u2 = philox_u01 ( r.x[1] );
+	
+	#if defined(__CUDA_ARCH__)
+	return sqrtf ( -2.0f * __logf ( u1 ) ) * __cosf ( 6.283185307f * u2 );
+	#else
+	return sqrtf ( -2.0f * logf ( u1 ) ) * cosf ( 6.283185307f * u2 );
+	#endif
+	
+}
+
+/* bit-packed masks: 32 Bernoulli draws per word */
+PHILOX_HD uint32_t philox_mask_word ( philox_key key, uint64_t word, float p ) {
+
+	uint32_t bits = 0;
+	
+	for ( int j = 0; j < 8; j++ ) {
+	
+		philox_out r = philox4x32 ( key, word * 8 + j );
+		
+		for ( int k = 0; k < 4; k++ )
+			if ( philox_u01 ( r.x[k] ) <= p ) bits |= 1u << ( j * 4 + k );
+			
+	}
+	
+	return bits;
+	
+}
+
+PHILOX_HD bool mask_test ( const uint32_t *mask, uint64_t i ) {
+
+	return ( mask[i >> 5] >> ( i & 31 ) ) & 1u;
+	
+}
+
+#endif /* __PHILOX_H__ */
@@ -0,0 +1,135 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Range coder (LZMA-style carry propagation)
+ *
+ * 32-bit range, renormalized a byte at a time below 2^24;
+ * a symbol is the interval [start, start + size) of total,
+ * total at most 2^16, so that range / total keeps at least
+ * 8 bits. The decoder has to see exactly the same intervals
+ * as the encoder did.
+ *
+ */
+
+#ifndef __RANGE_CODER_H__
+#define __RANGE_CODER_H__
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+#define RANGE_TOP ( 1u << 24 )
+#define RANGE_TOTAL_BITS 16
+
+class RangeEncoder {
+
+	public:
+	
+		void encode ( uint32_t start, uint32_t size, uint32_t total ) {
+		
+			range /= total;
+			low += ( uint64_t ) start * range;
+			range *= size;
+			
+			while ( range < RANGE_TOP ) {
+			
+				range <<= 8;
+				shift_low();
+				
+			}
+			
+		}
+		
+		/* flushes the pending bytes, once, after the last symbol */
+		std::vector<uint8_t> &finish() {
+		
+			for ( size_t i = 0; i < 5; i++ )
+				shift_low();
+				
+			return out;
+			
+		}
+		
+		std::vector<uint8_t> out;
+		
+	protected:
+	
+		/* the top byte of low is held back until no carry can reach it */
+		void shift_low() {
+		
+			if ( ( uint32_t ) low < 0xFF000000u || ( low >> 32 ) != 0 ) {
+			
+				uint8_t carry = ( uint8_t ) ( low >> 32 );
+				uint8_t pending = cache;
+				
+				do {
+				
+					out.push_back ( pending + carry );
+					pending = 0xFF;
+					
+				} while ( --cache_size != 0 );
+				
+				cache = ( uint8_t ) ( low >> 24 );
+				
+			}
+			
+			cache_size++;
+			low = ( low & 0x00FFFFFFu ) << 8;
+			
+		}
+		
+		uint64_t low = 0;
+		uint32_t range = 0xFFFFFFFFu;
+		
+		uint8_t cache = 0;
+		uint64_t cache_size = 1;
+		
+};
+
+class RangeDecoder {
+
+	public:
+	
+		RangeDecoder ( const uint8_t *_data, size_t _length ) : data ( _data ), length ( _length ) {
+		
+			for ( size_t i = 0; i < 5; i++ )
+				code = ( code << 8 ) | next();
+				
+		}
+		
+		/* position of the next symbol within [0, total), then consume() its interval */
+		uint32_t target ( uint32_t total ) {
+		
+			range /= total;
+			return std::min ( code / range, total - 1 );
+			
+		}
+		
+		void consume ( uint32_t start, uint32_t size ) {
+		
+			code -= start * range;
+			range *= size;
+			
+			while ( range < RANGE_TOP ) {
+			
+				code = ( code << 8 ) | next();
+				range <<= 8;
+				
+			}
+			
+		}
+		
+	protected:
+	
+		uint8_t next() { return position < length ? data[position++] : 0; }
+		
+		const uint8_t *data;
+		size_t length, position = 0;
+		
+		uint32_t code = 0;
+		uint32_t range = 0xFFFFFFFFu;
+		
+};
+
+#endif /* __RANGE_CODER_H__ */
@@ -0,0 +1,290 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Packed corpus format (see pack.cc)
+ *
+ * dir/index      - text, one "key values" entry per line
+ * dir/shard.NNNNN - raw bytes, shard_bytes each (the last one may
+ *                   be shorter)
+ *
+ * The index holds the total size, the shard size, the
+ * train / valid / test boundaries (global byte offsets) and
+ * an FNV-1a checksum per shard. Shards are mapped on first
+ * access and verified at that point, so a reader only ever
+ * touches the shards its positions fall into.
+ *
+ */
+
+#ifndef __SHARDS_H__
+#define __SHARDS_H__
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHARDS_VERSION 1
+
+inline uint64_t fnv1a ( const uint8_t *data, size_t length, uint64_t h = 0xcbf29ce484222325ULL ) {
+
+	for ( size_t i = 0; i < length; i++ ) {
+	
+		h ^= data[i];
+		h *= 0x100000001b3ULL;
+		
+	}
+	
+	return h;
+	
+}
+
+inline std::string shard_name ( const std::string &dir, size_t i ) {
+
+	char name[32];
+	snprintf ( name, sizeof ( name ), "/shard.%05zu", i );
+	return dir + name;
+	
+}
+
+class ShardIndex {
+
+	public:
+	
+		size_t total_bytes = 0;
+		size_t shard_bytes = 0;
+		
+		/* [begin, end) of train, valid, test */
+		size_t splits[3][2] = { {0, 0}, {0, 0}, {0, 0} };
+		
+		std::vector<uint64_t> checksums;
+		
+		size_t shards() const { return checksums.size(); }
+		
+		size_t shard_length ( size_t i ) const {
+		
+			return i + 1 < shards() ? shard_bytes : total_bytes - i * shard_bytes;
+			
+		}
+		
+		bool save ( const std::string &dir ) const {
+		
+			std::ofstream out ( dir + "/index" );
+			
+			if ( !out.is_open() ) return false;
+			
+			out << "version " << SHARDS_VERSION << std::endl;
+			out << "total_bytes " << total_bytes << std::endl;
+			out << "shard_bytes " << shard_bytes << std::endl;
+			out << "train " << splits[0][0] << " " << splits[0][1] << std::endl;
+			out << "valid " << splits[1][0] << " " << splits[1][1] << std::endl;
+			out << "test " << splits[2][0] << " " << splits[2][1] << std::endl;
+			
+			for ( size_t i = 0; i < shards(); i++ )
+				out << "shard " << i << " " << shard_length ( i ) << " " << std::hex << checksums[i] << std::dec <<
+					std::endl;
+					
+			return out.good();
+			
+		}
+		
+		bool load ( const std::string &dir ) {
+		
+			std::ifstream in ( dir + "/index" );
+			
+			if ( !in.is_open() ) return false;
+			
+			std::string line;
+			size_t version = 0;
+			checksums.clear();
+			
+			while ( getline ( in, line ) ) {
+			
+				std::stringstream stream ( line );
+				std::string key;
+				stream >> key;
+				
+				if ( key == "version" ) stream >> version;
+				else if ( key == "total_bytes" ) stream >> total_bytes;
+				else if ( key == "shard_bytes" ) stream >> shard_bytes;
+				else if ( key == "train" ) stream >> splits[0][0] >> splits[0][1];
+				else if ( key == "valid" ) stream >> splits[1][0] >> splits[1][1];
+				else if ( key == "test" ) stream >> splits[2][0] >> splits[2][1];
+				else if ( key == "shard" ) {
+				
+					size_t i, length;
+					uint64_t checksum;
+					stream >> i >> length >> std::hex >> checksum;
+					checksums.push_back ( checksum );
+					
+				}
+				
+			}
+			
+			if ( version != SHARDS_VERSION || shard_bytes == 0 ||
+					shards() != ( total_bytes + shard_bytes - 1 ) / shard_bytes ) {
+					
+				std::cout << "bad index: (" << dir << "/index)" << std::endl;
+				return false;
+				
+			}
+			
+			return true;
+			
+		}
+		
+};
+
+/*
+	byte storage split into equally sized, read-only mapped
+	pieces; a raw file is a single piece without a checksum
+*/
+
+class Shards {
+
+	public:
+	
+		/* packed directory */
+		Shards ( const std::string &_dir, const ShardIndex &_index ) :
+			dir ( _dir ), index ( _index ), packed ( true ),
+			ptrs ( _index.shards() ) {
+			
+			for ( size_t i = 0; i < ptrs.size(); i++ ) ptrs[i] = nullptr;
+			
+		}
+		
+		/* single file, mapped right away */
+		Shards ( const std::string &filename, size_t length ) : dir ( filename ), packed ( false ), ptrs ( 1 ) {
+		
+			index.total_bytes = length;
+			index.shard_bytes = length;
+			index.checksums.push_back ( 0 );
+			
+			ptrs[0] = map ( filename, length );
+			
+		}
+		
+		/* bytes already in memory (e.g. a decompressed block) */
+		Shards ( std::vector<uint8_t> &&bytes ) : packed ( false ), ptrs ( 1 ), memory ( std::move ( bytes ) ) {
+		
+			index.total_bytes = memory.size();
+			index.shard_bytes = memory.size();
+			index.checksums.push_back ( 0 );
+			
+			ptrs[0] = &memory[0];
+			
+		}
+		
+		~Shards() {
+		
+			if ( memory.size() > 0 ) return;
+			
+			for ( size_t i = 0; i < ptrs.size(); i++ )
+				if ( ptrs[i] != nullptr ) munmap ( ( void * ) ptrs[i].load(), index.shard_length ( i ) );
+				
+		}
+		
+		uint8_t at ( size_t i ) {
+		
+			size_t k = i / index.shard_bytes;
+			const uint8_t *ptr = ptrs[k].load ( std::memory_order_acquire );
+			
+			if ( ptr == nullptr ) ptr = load ( k );
+			
+			return ptr[i - k * index.shard_bytes];
+			
+		}
+		
+		std::string dir;
+		ShardIndex index;
+		bool packed;
+		
+	protected:
+	
+		const uint8_t *load ( size_t k ) {
+		
+			std::lock_guard<std::mutex> lock ( mtx );
+			
+			if ( ptrs[k] != nullptr ) return ptrs[k];
+			
+			// a raw file is mapped by the constructor, nothing to retry
+			std::string name = packed ? shard_name ( dir, k ) : dir;
+			size_t length = index.shard_length ( k );
+			const uint8_t *ptr = packed ? map ( name, length ) : nullptr;
+			
+			// missing or corrupt bytes would end up in training batches
+			if ( ptr == nullptr ) {
+			
+				std::cout << "could not map, stopping: (" << name << ")" << std::endl;
+				exit ( -1 );
+				
+			}
+			
+			if ( fnv1a ( ptr, length ) != index.checksums[k] ) {
+			
+				std::cout << "checksum mismatch, stopping: (" << name << ")" << std::endl;
+				exit ( -1 );
+				
+			}
+			
+			ptrs[k].store ( ptr, std::memory_order_release );
+			return ptr;
+			
+		}
+		
+		static const uint8_t *map ( const std::string &name, size_t length ) {
+		
+			int fd = open ( name.c_str(), O_RDONLY );
+			
+			if ( fd < 0 ) {
+			
+				std::cout << "open error: (" << name << ")" << std::endl;
+				return nullptr;
+				
+			}
+			
+			struct stat st;
+			
+			// reading past the end of a short file would raise SIGBUS
+			if ( fstat ( fd, &st ) != 0 || ( size_t ) st.st_size < length ) {
+			
+				std::cout << "size error: (" << name << "), expected " << length << " bytes" << std::endl;
+				close ( fd );
+				return nullptr;
+				
+			}
+			
+			void *ptr = mmap ( NULL, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+			close ( fd );
+			
+			if ( ptr == MAP_FAILED ) {
+			
+				std::cout << "mmap error: (" << name << ")" << std::endl;
+				return nullptr;
+				
+			}
+			
+			return ( const uint8_t * ) ptr;
+			
+		}
+		
+		std::vector<std::atomic<const uint8_t *>> ptrs;
+		std::mutex mtx;
+		
+		std::vector<uint8_t> memory;
+		
+};
+
+#endif /* __SHARDS_H__ */
@@ -0,0 +1,55 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Lock-free single-producer / single-consumer ring
+ *
+ */
+
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__
+
+#include <atomic>
+#include <utility>
+
+#include <stddef.h>
+
+/* Size - 1 items fit */
+template <typename T, size_t Size>
+class spsc_queue {
+
+	public:
+	
+		bool push ( const T &item ) {
+		
+			size_t h = head.load ( std::memory_order_relaxed );
+			size_t next = ( h + 1 ) % Size;
+			
+			if ( next == tail.load ( std::memory_order_acquire ) ) return false;
+			
+			items[h] = item;
+			head.store ( next, std::memory_order_release );
+			return true;
+			
+		}
+		
+		bool pop ( T &item ) {
+		
+			size_t t = tail.load ( std::memory_order_relaxed );
+			
+			if ( t == head.load ( std::memory_order_acquire ) ) return false;
+			
+			item = std::move ( items[t] );
+			tail.store ( ( t + 1 ) % Size, std::memory_order_release );
+			return true;
+			
+		}
+		
+	protected:
+	
+		T items[Size];
+		std::atomic<size_t> head {0}, tail {0};
+		
+};
+
+#endif /* __SPSC_QUEUE_H__ */
@@ -0,0 +1,314 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Streaming input from a compressed corpus (.gz, or .zst
+ * with USE_ZSTD=1)
+ *
+ * A background thread decompresses the file block by block
+ * into a bounded ring; when the end is reached it starts over.
+ * There is no random access into the compressed file, so the
+ * batcher samples from one decoded block at a time
+ * (sequential-window sampling) and moves to the next block
+ * after a fixed number of epochs.
+ *
+ * The first held_out blocks (validation / test) are delivered
+ * on the first pass only and skipped on every pass after it.
+ * If the decoder stops (open error, no data, no zstd support),
+ * next() reports it and exits instead of waiting forever.
+ *
+ */
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <stdlib.h>
+
+#include <zlib.h>
+
+#ifdef __USE_ZSTD__
+	#include <zstd.h>
+#endif
+
+#include <containers/io.h>
+#include <containers/spsc_queue.h>
+#include <timer.h>
+
+class BlockStream {
+
+	public:
+	
+		BlockStream ( const std::string &_filename, size_t _held_out = 0, size_t _block_bytes = ( size_t ) 16 << 20 ) :
+			block_bytes ( _block_bytes ), filename ( _filename ), held_out ( _held_out ), input ( 1 << 20 ) {
+			
+			zstd = ends_with ( filename, ".zst" );
+			decoder = std::thread ( &BlockStream::run, this );
+			
+		}
+		
+		~BlockStream() {
+		
+			stop = true;
+			decoder.join();
+			
+		}
+		
+		static bool compressed ( const std::string &name ) {
+		
+			return ends_with ( name, ".gz" ) || ends_with ( name, ".zst" );
+			
+		}
+		
+		/* the next decoded block, waits for the decoder */
+		Corpus next() {
+		
+			std::shared_ptr<Shards> block;
+			
+			while ( !blocks.pop ( block ) ) {
+			
+				// finished is set after the last push, so the queue is checked once more
+				if ( finished ) {
+				
+					if ( blocks.pop ( block ) ) break;
+					
+					std::cout << "the decoder has stopped, no more blocks: (" << filename << ")" << std::endl;
+					exit ( -1 );
+					
+				}
+				
+				std::this_thread::sleep_for ( std::chrono::microseconds ( 100 ) );
+				
+			}
+			
+			return Corpus ( block );
+			
+		}
+		
+		/* MB/s of decompressed output while decoding */
+		double rate() {
+		
+			double seconds = decode_us.load() * 1e-6;
+			return seconds > 0 ? decoded_bytes.load() / seconds / ( 1 << 20 ) : 0.0;
+			
+		}
+		
+		const size_t block_bytes;
+		
+	protected:
+	
+		static bool ends_with ( const std::string &s, const std::string &suffix ) {
+		
+			return s.size() >= suffix.size() && s.compare ( s.size() - suffix.size(), suffix.size(), suffix ) == 0;
+			
+		}
+		
+		void run() {
+		
+			decode();
+			finished = true;
+			
+		}
+		
+		void decode() {
+		
+			for ( size_t pass = 0; !stop; pass++ ) {
+			
+				if ( !open() ) return;
+				
+				size_t passed = 0;
+				
+				for ( size_t k = 0; !stop; k++ ) {
+				
+					std::vector<uint8_t> bytes ( block_bytes );
+					size_t length = 0;
+					
+					Timer timer;
+					timer.start();
+					
+					while ( length < block_bytes ) {
+					
+						size_t n = read ( &bytes[length], block_bytes - length );
+						
+						if ( n == 0 ) break;
+						
+						length += n;
+						
+					}
+					
+					decode_us += ( uint64_t ) ( timer.end() * 1e6 );
+					decoded_bytes += length;
+					
+					if ( length == 0 ) break;
+					
+					// validation / test blocks are not reused for training
+					if ( pass > 0 && k < held_out ) continue;
+					
+					bytes.resize ( length );
+					std::shared_ptr<Shards> block = std::make_shared<Shards> ( std::move ( bytes ) );
+					
+					while ( !blocks.push ( block ) ) {
+					
+						if ( stop ) break;
+						
+						std::this_thread::sleep_for ( std::chrono::milliseconds ( 1 ) );
+						
+					}
+					
+					passed += length;
+					
+				}
+				
+				close();
+				
+				if ( passed == 0 ) {
+				
+					std::cout << ( pass == 0 ? "no data: (" : "no data after the held-out blocks: (" ) << filename << ")" << std::endl;
+					return;
+					
+				}
+				
+			}
+			
+		}
+		
+		bool open() {
+		
+			in = fopen ( filename.c_str(), "rb" );
+			
+			if ( !in ) {
+			
+				std::cout << "fopen error: (" << filename << ")" << std::endl;
+				return false;
+				
+			}
+			
+			available = 0;
+			next_in = nullptr;
+			
+			if ( zstd ) {
+			
+				#ifdef __USE_ZSTD__
+				zds = ZSTD_createDStream();
+				ZSTD_initDStream ( zds );
+				#else
+				std::cout << "zstd support not compiled in (USE_ZSTD=1): (" << filename << ")" << std::endl;
+				fclose ( in );
+				return false;
+				#endif
+				
+			} else {
+			
+				z = z_stream();
+				
+				// 32 - detect gzip or zlib header
+				inflateInit2 ( &z, 15 + 32 );
+				
+			}
+			
+			return true;
+			
+		}
+		
+		void close() {
+		
+			#ifdef __USE_ZSTD__
+			
+			if ( zstd ) ZSTD_freeDStream ( zds );
+			
+			#endif
+			
+			if ( !zstd ) inflateEnd ( &z );
+			
+			fclose ( in );
+			
+		}
+		
+		/* up to n decompressed bytes, 0 at the end of the input */
+		size_t read ( uint8_t *dst, size_t n ) {
+		
+			while ( true ) {
+			
+				if ( available == 0 ) {
+				
+					available = fread ( &input[0], 1, input.size(), in );
+					next_in = &input[0];
+					
+					if ( available == 0 ) return 0;
+					
+				}
+				
+				size_t produced = 0, consumed = 0;
+				
+				if ( zstd ) {
+				
+					#ifdef __USE_ZSTD__
+					ZSTD_inBuffer src = { next_in, available, 0 };
+					ZSTD_outBuffer out = { dst, n, 0 };
+					
+					if ( ZSTD_isError ( ZSTD_decompressStream ( zds, &out, &src ) ) ) return 0;
+					
+					consumed = src.pos;
+					produced = out.pos;
+					#endif
+					
+				} else {
+				
+					z.next_in = next_in;
+					z.avail_in = available;
+					z.next_out = dst;
+					z.avail_out = n;
+					
+					int ret = inflate ( &z, Z_NO_FLUSH );
+					
+					consumed = available - z.avail_in;
+					produced = n - z.avail_out;
+					
+					// concatenated gzip members
+					if ( ret == Z_STREAM_END ) inflateReset ( &z );
+					else if ( ret != Z_OK && ret != Z_BUF_ERROR ) return 0;
+					
+				}
+				
+				next_in += consumed;
+				available -= consumed;
+				
+				if ( produced > 0 ) return produced;
+				
+			}
+			
+		}
+		
+		std::string filename;
+		size_t held_out;
+		bool zstd;
+		
+		FILE *in = nullptr;
+		std::vector<uint8_t> input;
+		uint8_t *next_in = nullptr;
+		size_t available = 0;
+		
+		z_stream z;
+		
+		#ifdef __USE_ZSTD__
+		ZSTD_DStream *zds = nullptr;
+		#endif
+		
+		/* decoded blocks waiting for the batcher */
+		spsc_queue<std::shared_ptr<Shards>, 5> blocks;
+		
+		std::thread decoder;
+		std::atomic<bool> stop {false};
+		std::atomic<bool> finished {false};
+		
+		std::atomic<uint64_t> decoded_bytes {0};
+		std::atomic<uint64_t> decode_us {0};
+		
+};
+
+#endif /* __STREAM_H__ */
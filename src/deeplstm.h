@@ -9,8 +9,15 @@
 #ifndef __DEEPLSTM_H_
 #define __DEEPLSTM_H_
 
+// before timelayer.h, which defines s ( t, x ) and g ( t, x )
+#include <serialization.h>
+
 #include <timelayer.h>
 #include <containers/datatype.h>
+#include <containers/io.h>
+#include <timer.h>
+#include <sampler.h>
+#include <checkpoint.h>
 
 /* different layer types */
 
@@ -19,6 +26,7 @@
 	#include <layers/lstm_cuda.h>
 	//#include <layers/hlstm.h>
 	#include <layers/cu_softmax.h>
+	#include <layers/cu_class_softmax.h>
 	//#include <layers/splstm.h>
 	//#include <layers/clstm.h>
 	//#include <layers/hmlstm.h>
@@ -54,11 +62,15 @@ class DeepLSTM {
 	
 		Timelayer<MatrixType> *outputlayer;
 		
+		// set if the output is class-factored
+		ClassSoftmax<MatrixType> *classlayer = nullptr;
+		
 		std::vector<Timelayer<MatrixType> *> layers;
 		
 		DeepLSTM ( size_t _M, size_t _N, size_t _B, size_t _S, size_t _D,
-				   std::initializer_list<Timelayer<MatrixType> *> args = {} ) :
-			M ( _M ), N ( _N ), B ( _B ), S ( _S ), D ( _D ) {
+				   std::initializer_list<Timelayer<MatrixType> *> args = {}, const std::vector<size_t> &_counts = {},
+				   size_t _classes = 0 ) :
+			M ( _M ), N ( _N ), B ( _B ), S ( _S ), D ( _D ), counts ( _counts ), classes ( _classes ) {
 			
 			for ( auto i : args ) {
 			
@@ -80,14 +92,43 @@ class DeepLSTM {
 			for ( size_t d = 1; d < D; d++ )
 				layers.push_back ( new LSTM<MatrixType> ( _N, _N, _B, _S ) );
 				
-			//+ 1 softmax layer
-			layers.push_back ( new Softmax<MatrixType> ( _N, _M, _B, _S ) );
+			//+ 1 softmax layer, class-factored for large vocabularies
+			if ( classes > 0 ) {
 			
+				classlayer = new ClassSoftmax<MatrixType> ( _N, counts, classes, _B, _S );
+				layers.push_back ( classlayer );
+				
+			} else
+			
+				layers.push_back ( new Softmax<MatrixType> ( _N, _M, _B, _S ) );
+				
 			//pointer to the output layer
 			outputlayer = layers[D];
 			
+			for ( size_t d = 0; d <= D; d++ )
+				layers[d]->rng_layer = d;
+			
 			//temp storage
-			surprisals.resize ( B, M );
+			surprisals.resize ( B, classlayer ? 1 : M );
+			
+		}
+		
+		/*
+			evaluation context, shares the parameters of src (read-only),
+			or owns a copy of them if !shared (see copy_parameters)
+		*/
+		DeepLSTM ( DeepLSTM &src, size_t _B, size_t _S, bool shared = true ) :
+			DeepLSTM ( src.M, src.N, _B, _S, src.D, {}, src.counts, src.classes ) {
+			
+			for ( size_t d = 0; d <= D; d++ )
+				if ( shared ) layers[d]->share_parameters ( *src.layers[d] );
+				
+			// single steps (sample / test), forward only otherwise or if there is no inference mode with this config
+			if ( _S != 2 || !inference_mode() )
+				for ( size_t d = 0; d <= D; d++ )
+					layers[d]->release_gradients();
+					
+			if ( !shared ) copy_parameters ( src );
 			
 		}
 		
@@ -174,6 +215,268 @@ class DeepLSTM {
 			
 		}
 		
+		/* forward only, one step at a time (S = 2), see Timelayer::inference_mode; all layers or none */
+		bool inference_mode() {
+		
+			for ( size_t d = 0; d <= D; d++ )
+				if ( !layers[d]->inference_ready() ) return false;
+				
+			for ( size_t d = 0; d <= D; d++ )
+				layers[d]->inference_mode();
+				
+			return true;
+			
+		}
+		
+		bool in_inference_mode() const { return layers[0]->inference; }
+		
+		/* new streams in some rows of a running batch */
+		void reset_rows ( const std::vector<size_t> &rows ) {
+		
+			for ( size_t d = 0; d < D; d++ )
+				layers[d]->reset_rows ( rows );
+				
+		}
+		
+		/* carried state of a row, all layers */
+		size_t state_size() {
+		
+			size_t size = 0;
+			
+			for ( size_t d = 0; d < D; d++ )
+				size += layers[d]->carried_size();
+				
+			return size;
+			
+		}
+		
+		/*
+			carried state of rows, state_size () values each: after a
+			single-step forward (t = 1) or after carryContext (t = 0)
+		*/
+		void store_rows ( const std::vector<size_t> &rows, std::vector<dtype *> out, size_t t = 1 ) {
+		
+			for ( size_t d = 0; d < D; d++ ) {
+			
+				layers[d]->store_rows ( t, rows, out );
+				
+				for ( size_t k = 0; k < out.size(); k++ )
+					out[k] += layers[d]->carried_size();
+					
+			}
+			
+		}
+		
+		/* state of rows for the next single-step forward, nullptr - zero state */
+		void load_rows ( const std::vector<size_t> &rows, std::vector<const dtype *> in ) {
+		
+			for ( size_t d = 0; d < D; d++ ) {
+			
+				layers[d]->load_rows ( rows, in );
+				
+				for ( size_t k = 0; k < in.size(); k++ )
+					if ( in[k] ) in[k] += layers[d]->carried_size();
+					
+			}
+			
+		}
+		
+		/*
+			full training state, see checkpoint.h: parameters, optimizer
+			memory (m, u), the carried state ( 0 ) and the random number
+			steps of every layer, the seed and the host step of the RNG;
+			the host copies are synced here and have to stay as they are
+			until out.write ()
+		*/
+		void checkpoint ( Checkpoint &out ) {
+		
+			out.add ( "M", ( uint64_t ) M );
+			out.add ( "N", ( uint64_t ) N );
+			out.add ( "D", ( uint64_t ) D );
+			out.add ( "classes", ( uint64_t ) classes );
+			
+			out.add ( "rng.seed", ( uint64_t ) philox_seed );
+			out.add ( "rng.host_step", ( uint64_t ) philox_host_step );
+			
+			for ( size_t d = 0; d <= D; d++ ) {
+			
+				std::string prefix = std::to_string ( d ) + ".";
+				
+				auto add = [&] ( const std::string & kind, MatrixArray<MatrixType> &array, bool carried_only ) {
+				
+					for ( auto &i : array.namemap ) {
+					
+						if ( carried_only && !layers[d]->is_carried ( i.first ) ) continue;
+						
+						MatrixType &m = array.matrices[i.second];
+						
+						m.sync_host();
+						out.add ( prefix + kind + "." + i.first, m.data(), m.rows(), m.cols() );
+						
+					}
+					
+				};
+				
+				add ( "p", layers[d]->p, false );
+				add ( "m", layers[d]->m, false );
+				add ( "u", layers[d]->u, false );
+				add ( "s", layers[d]->s[0], true );
+				
+				out.add ( prefix + "rng_step", ( uint64_t ) layers[d]->rng_step );
+				
+			}
+			
+		}
+		
+		/*
+			parameters from a checkpoint, and with training also the
+			rest of checkpoint (); parameters of another shape (B_ones
+			of another B) are skipped, as in the JSON snapshots
+		*/
+		bool restore ( const Checkpoint &in, bool training ) {
+		
+			uint64_t _M = 0, _N = 0, _D = 0, _classes = 0;
+			
+			if ( !in.read ( "M", _M ) || !in.read ( "N", _N ) || !in.read ( "D", _D ) || !in.read ( "classes", _classes ) )
+				return false;
+				
+			if ( _M != M || _N != N || _D != D || _classes != classes ) {
+			
+				std::cout << "checkpoint has M = " << _M << ", N = " << _N << ", D = " << _D << ", " << _classes << " classes" <<
+						  std::endl;
+				return false;
+				
+			}
+			
+			for ( size_t d = 0; d <= D; d++ ) {
+			
+				std::string prefix = std::to_string ( d ) + ".";
+				
+				auto read = [&] ( const std::string & kind, MatrixArray<MatrixType> &array, bool carried_only ) -> bool {
+				
+					for ( auto &i : array.namemap ) {
+					
+						if ( carried_only && !layers[d]->is_carried ( i.first ) ) continue;
+						
+						MatrixType &m = array.matrices[i.second];
+						std::string name = prefix + kind + "." + i.first;
+						const CheckpointEntry *entry = in.find ( name );
+						
+						if ( !carried_only && entry != nullptr && ( entry->rows != m.rows() || entry->cols != m.cols() ) ) continue;
+						
+						if ( !in.read ( name, m.data(), m.rows(), m.cols() ) ) return false;
+						
+						m.sync_device();
+						
+					}
+					
+					return true;
+					
+				};
+				
+				if ( !read ( "p", layers[d]->p, false ) ) return false;
+				
+				if ( !training ) continue;
+				
+				uint64_t step;
+				
+				if ( !read ( "m", layers[d]->m, false ) || !read ( "u", layers[d]->u, false ) || !read ( "s", layers[d]->s[0], true )
+						|| !in.read ( prefix + "rng_step", step ) ) return false;
+						
+				layers[d]->rng_step = step;
+				
+			}
+			
+			if ( training ) {
+			
+				uint64_t seed, step;
+				
+				if ( !in.read ( "rng.seed", seed ) || !in.read ( "rng.host_step", step ) ) return false;
+				
+				philox_seed = seed;
+				philox_host_step = step;
+				
+			}
+			
+			return true;
+			
+		}
+		
+		/* parameters from a checkpoint (see checkpoint) or from a JSON snapshot of serialize */
+		bool load ( const std::string &filename ) {
+		
+			if ( Checkpoint::is_checkpoint ( filename ) ) {
+			
+				Checkpoint in;
+				
+				if ( in.open ( filename ) && restore ( in, false ) ) return true;
+				
+				std::cout << "could not load (" << filename << ")" << std::endl;
+				return false;
+				
+			}
+			
+			#ifdef __USE_CEREAL__
+			
+			std::ifstream in ( filename );
+			
+			if ( !in.is_open() ) {
+			
+				std::cout << "open error: (" << filename << ")" << std::endl;
+				return false;
+				
+			}
+			
+			cereal::JSONInputArchive archive ( in );
+			
+			size_t _M, _N, _B, _S, _D;
+			archive ( _M, _N, _B, _S, _D );
+			
+			if ( _M != M || _N != N || _D != D ) {
+			
+				std::cout << "snapshot has M = " << _M << ", N = " << _N << ", D = " << _D << ": (" << filename << ")" << std::endl;
+				return false;
+				
+			}
+			
+			for ( size_t d = 0; d <= D; d++ ) {
+			
+				// e.g. a class-factored output; B_ones of another B is skipped (see matrix::serialize)
+				auto names = layers[d]->p.namemap;
+				size_t count = layers[d]->p.matrices.size();
+				
+				archive ( *layers[d] );
+				
+				if ( names != layers[d]->p.namemap || count != layers[d]->p.matrices.size() ) {
+				
+					std::cout << "snapshot layer " << d << " does not match the model: (" << filename << ")" << std::endl;
+					return false;
+					
+				}
+				
+			}
+			
+			sync_params();
+			
+			return true;
+			
+			#else
+			
+			std::cout << "not a checkpoint: (" << filename << ")" << std::endl;
+			return false;
+			
+			#endif
+			
+		}
+		
+		/* parameter snapshot, device to device, see evaluator.h */
+		void copy_parameters ( DeepLSTM &src ) {
+		
+			for ( size_t d = 0; d <= D; d++ )
+				layers[d]->copy_parameters ( *src.layers[d] );
+				
+		}
+		
 		void sync_memory() {
 		
 			for ( size_t d = 0; d <= D; d++ ) {
@@ -188,23 +491,36 @@ class DeepLSTM {
 		
 		void forward ( bool apply_dropout, std::vector<MatrixType> &x ) {
 		
-			layers[0]->forward ( apply_dropout, x );
-			
-			for ( size_t d = 1; d <= D; d++ )
-			
-				layers[d]->forward ( apply_dropout, layers[d - 1]->s, 'h' );
+			for ( size_t d = 0; d <= D; d++ )
+				layers[d]->start_sequence ( apply_dropout );
+				
+			// time-major, so that h(t) of a layer is consumed before
+			// a checkpointed layer recycles its storage
+			for ( size_t t = 1; t < S; t++ )
+				forward ( apply_dropout, x[t], t );
 				
 		}
 		
+		/* the class-factored output is evaluated at the targets (token ids) */
+		void forward ( bool apply_dropout, std::vector<MatrixType> &x, std::vector<MatrixType> &target ) {
+		
+			if ( classlayer )
+				for ( size_t t = 1; t < S; t++ )
+					classlayer->s[t]['y'] = target[t];
+					
+			forward ( apply_dropout, x );
+			
+		}
+		
 		void forward ( bool apply_dropout, MatrixType &x, size_t t = 1 ) {
 		
 			layers[0]->s[t]['x'] = x ;
-			layers[0]->forward ( apply_dropout, t );
+			layers[0]->step ( apply_dropout, t );
 			
 			for ( size_t d = 1; d <= D; d++ ) {
 			
 				layers[d]->s[t]['x'] = layers[d - 1]->s[t]['h'];
-				layers[d]->forward ( apply_dropout, t );
+				layers[d]->step ( apply_dropout, t );
 				
 				
 			}
@@ -215,16 +531,9 @@ class DeepLSTM {
 		
 			dx = target;
 			
-			for ( size_t d = D; d > 0; d-- ) {
-			
-				layers[d]->backward ( apply_dropout, dx );
-				
-				for ( size_t t = 0; t < S; t++ )
-					dx[t] = layers[d]->g[t]['x'];
-					
-			}
-			
-			layers[0]->backward ( apply_dropout, dx );
+			// dx is replaced with the error wrt each layer's inputs
+			for ( size_t d = D + 1; d > 0; d-- )
+				layers[d - 1]->backward ( apply_dropout, dx );
 			
 		}
 		
@@ -244,14 +553,25 @@ class DeepLSTM {
 			
 		}
 		
-		dtype loss ( std::vector<MatrixType> &target, size_t symbols, bool bits = false ) {
+		/* the last symbols steps before end (0 - S) */
+		dtype loss ( std::vector<MatrixType> &target, size_t symbols, bool bits = false, size_t end = 0 ) {
 		
 			dtype loss = 0.0;
 			
-			for ( size_t t = S - symbols; t < S;
+			if ( end == 0 ) end = S;
+			
+			for ( size_t t = end - symbols; t < end;
 					t++ ) { // compute activations for sequence
 					
-				if ( bits ) {
+				if ( classlayer ) {
+				
+					// p is already the probability of the target
+					for ( size_t k = 0; k < surprisals.size(); k++ )
+						surprisals ( k ) = bits ? -_log2 ( outputlayer->s[t]['p'] ( k ) ) : -_log ( outputlayer->s[t]['p'] ( k ) );
+						
+				}
+				
+				else if ( bits ) {
 				
 					for ( size_t k = 0; k < surprisals.size(); k++ )
 						surprisals ( k ) = -_log2 ( outputlayer->s[t]['p'] ( k ) ) * target[t] ( k );
@@ -286,84 +606,107 @@ class DeepLSTM {
 			
 		}
 		
-		std::vector<char> sample ( size_t characters_to_generate, MatrixType &codes, std::string seed = " ",
-								   dtype reset_std = 0.0 ) {
-								   
-			std::vector<char> generated_text;
+		/* change B and S in place, buffers are reused if large enough; all layers or none */
+		bool reshape ( size_t _B, size_t _S ) {
+		
+			for ( size_t d = 0; d <= D; d++ )
+				if ( !layers[d]->reshapable ( _S ) ) return false;
+				
+			for ( size_t d = 0; d <= D; d++ )
+				layers[d]->reshape ( _B, _S );
+				
+			B = _B;
+			S = _S;
 			
-			//make a copy
-			DeepLSTM<MatrixType> testnet ( M, N, 1, S, D );
-			sync_params_host();
-			testnet.loadParams<MatrixType> ( *this );
-			testnet.sync_params();
+			surprisals.resize ( B, classlayer ? 1 : M );
 			
+			return true;
+			
+		}
+		
+		/*
+			B x S view of the current parameters for sample / test,
+			created once and reshaped afterwards (created again if it
+			cannot be reshaped, e.g. a checkpointed context)
+		*/
+		DeepLSTM &evaluation_context ( size_t _B, size_t _S ) {
+		
+			if ( !context || !context->reshape ( _B, _S ) ) context.reset ( new DeepLSTM ( *this, _B, _S ) );
+			
+			return *context;
+			
+		}
+		
+		/* token ids, see BPE::decode */
+		std::vector<size_t> sample ( size_t characters_to_generate, std::string seed = " ",
+									 dtype reset_std = 0.0 ) {
+									 
+			return generate ( std::vector<std::string> ( 1, seed ), characters_to_generate - 1, Sampler(), reset_std ) [0];
+			
+		}
+		
+		/*
+			K = prompts.size() independent streams advanced as one
+			batch, length tokens each (the prompt included); stream b
+			is fed prompts[b] and then its own draws, which are keyed
+			by ( b, position ) and do not depend on K
+		*/
+		std::vector<std::vector<size_t>> generate ( const std::vector<std::string> &prompts, size_t length,
+									  Sampler sampler = Sampler(), dtype reset_std = 0.0 ) {
+									  
+			size_t K = prompts.size();
+			std::vector<std::vector<size_t>> streams ( K );
+			
+			// the class-factored output samples from the host copy
+			if ( classlayer ) sync_params_host();
+			
+			DeepLSTM<MatrixType> &testnet = evaluation_context ( K, 2 );
 			testnet.resetContext ( reset_std );
-			MatrixType probs ( 1, M );
-			MatrixType cdf ( 1, M );
-			cdf.setZero();
 			
-			std::random_device rd;
-			std::mt19937 gen ( rd() );
-			std::uniform_real_distribution<> dis ( 0, 1 );
+			philox_key key = next_host_key();
 			
-			size_t index;
+			MatrixType x ( K, M );
+			std::vector<size_t> next ( K );
 			
-			MatrixType x ( 1, M );
+			for ( size_t ii = 0; ii < length; ii++ ) {
 			
-			for ( size_t ii = 0; ii < characters_to_generate - 1;
-					ii++ ) {
-					
-				size_t ev_x;
+				x.setZero();
 				
-				if ( ii < seed.length() )
+				for ( size_t b = 0; b < K; b++ ) {
 				
-					ev_x = ( size_t ) seed[ii];
+					size_t ev_x = ii < prompts[b].length() ? ( unsigned char ) prompts[b][ii] : next[b];
 					
-				else
-				
-					ev_x = index;
+					streams[b].push_back ( ev_x );
+					set_row_one_hot ( x, b, ev_x );
 					
-					
-				generated_text.push_back ( ( char ) ev_x );
+				}
 				
-				row ( x, codes, ev_x );
+				if ( ii + 1 == length ) break;
 				
 				testnet.forward ( false, x );
 				testnet.carryContext ( 1 );
-				probs = testnet.outputlayer->s[1]['p'];
-				
-				dtype sum = probs.sum();
-				
-				for ( size_t k = 0; k < probs.size(); k++ )
-					probs ( k ) = probs ( k ) / sum;
-					
-				//cumsum, TODO: something nicer
-				cdf ( 0 ) = probs ( 0 );
-				
-				for ( size_t ii = 1; ii < probs.size(); ii++ )
-					cdf ( ii ) = cdf ( ii - 1 ) + probs ( ii );
-					
-				dtype r = dis ( gen );
-				
-				// find the lowest number in cdf that's larger or equal to r
 				
-				for ( size_t ii = 0; ii < cdf.size(); ii++ ) {
+				for ( size_t b = 0; b < K; b++ ) {
 				
-					if ( r < cdf ( ii ) ) {
+					// still in the prompt
+					if ( ii + 1 < prompts[b].length() ) continue;
 					
-						index = ii;
-						break;
-					}
+					philox_out r = philox4x32 ( key, ( ( uint64_t ) b << 32 ) | ii );
 					
+					if ( testnet.classlayer )
+						next[b] = testnet.classlayer->draw ( 1, b, philox_u01 ( r.x[0] ), philox_u01 ( r.x[1] ), sampler.temperature );
+					else
+						next[b] = sampler.draw ( testnet.outputlayer->s[1]['p'], b, philox_u01 ( r.x[0] ) );
+						
 				}
 				
 			}
 			
-			return generated_text;
+			return streams;
 			
 		}
 		
-		dtype test ( MatrixXi &test, size_t seq_length, MatrixType &codes, dtype reset_std = 0.0, bool bits = false ) {
+		dtype test ( Corpus &test, size_t seq_length, dtype reset_std = 0.0, bool bits = false ) {
 		
 			dtype error = 0;
 			size_t trials = 100;
@@ -371,17 +714,12 @@ class DeepLSTM {
 			
 			size_t test_length = test.rows();
 			
-			//make a copy
-			DeepLSTM<MatrixType> testnet ( M, N, 1, 2, D );
-			sync_params_host();
-			testnet.loadParams<MatrixType> ( *this );
-			testnet.sync_params();
+			DeepLSTM<MatrixType> &testnet = evaluation_context ( 1, 2 );
 			
 			for ( size_t k = 0; k < trials; k++ ) {
 			
 				testnet.resetContext ( reset_std );
 				
-				MatrixType probs ( 1, M );
 				MatrixType x ( 1, M );
 				
 				size_t pos = rand() % ( test.size() - length - 2 );
@@ -390,19 +728,20 @@ class DeepLSTM {
 				
 				for ( size_t ii = pos; ii < pos + length; ii++ ) {
 				
-					size_t ev_x = ( ( int * ) test.data() ) [ii];
-					size_t ev_t = ( ( int * ) test.data() ) [ii + 1];
+					size_t ev_x = test[ii];
+					size_t ev_t = test[ii + 1];
 					
-					row ( x, codes, ev_x );
+					x.setZero();
+					set_row_one_hot ( x, 0, ev_x );
+					testnet.set_target ( 0, ev_t );
 					
 					testnet.forward ( false, x );
 					testnet.carryContext ( 1 );
-					probs = testnet.outputlayer->s[1]['p'];
 					
 					if ( bits )
-						partial_error += -log2 ( probs ( ev_t ) );
+						partial_error += -log2 ( testnet.probability ( 0, ev_t ) );
 					else
-						partial_error += -log ( probs ( ev_t ) );
+						partial_error += -log ( testnet.probability ( 0, ev_t ) );
 						
 					std::cout << std::setprecision ( 2 ) << std::setw (
 								  15 ) << "Testing... " <<
@@ -412,6 +751,9 @@ class DeepLSTM {
 				
 				partial_error /= length;
 				
+				// per original byte
+				partial_error *= test.tokens_per_byte;
+				
 				error += partial_error;
 			}
 			
@@ -429,7 +771,7 @@ class DeepLSTM {
 		*/
 		
 		std::tuple<size_t, dtype, dtype, dtype, dtype>
-		test_batch ( MatrixXi &test, size_t seq_length, MatrixType &codes, dtype reset_std = 0.0,
+		test_batch ( Corpus &test, size_t seq_length, dtype reset_std = 0.0,
 					 bool bits = false ) {
 					 
 			dtype error = 0;
@@ -442,11 +784,7 @@ class DeepLSTM {
 			
 			std::vector<dtype> datapoints;
 			
-			//make a copy
-			DeepLSTM<MatrixType> testnet ( M, N, __B, 2, D );
-			sync_params_host();
-			testnet.loadParams<MatrixType> ( *this );
-			testnet.sync_params();
+			DeepLSTM<MatrixType> &testnet = evaluation_context ( __B, 2 );
 			
 			size_t ev_x[__B];
 			size_t ev_t[__B];
@@ -456,7 +794,6 @@ class DeepLSTM {
 			
 				testnet.resetContext ( reset_std );
 				
-				MatrixType probs ( __B, M );
 				MatrixType x ( __B, M );
 				
 				for ( size_t b = 0; b < __B; b++ )
@@ -470,26 +807,25 @@ class DeepLSTM {
 					
 					for ( size_t b = 0; b < __B; b++ ) {
 					
-						ev_x[b] = ( ( int * ) test.data() ) [pos[b] + ii];
-						ev_t[b] = ( ( int * ) test.data() ) [pos[b] + ii + 1];
+						ev_x[b] = test[pos[b] + ii];
+						ev_t[b] = test[pos[b] + ii + 1];
 						
 						set_row_one_hot ( x, b, ev_x[b] );
+						testnet.set_target ( b, ev_t[b] );
 						
 					}
 					
 					testnet.forward ( false, x );
 					testnet.carryContext ( 1 );
 					
-					probs = testnet.outputlayer->s[1]['p'];
-					
 					for ( size_t b = 0; b < __B; b++ ) {
 					
 						float b_error;
 						
 						if ( bits )
-							b_error = -log2 ( probs ( b, ev_t[b] ) );
+							b_error = -log2 ( testnet.probability ( b, ev_t[b] ) );
 						else
-							b_error = -log ( probs ( b, ev_t[b] ) );
+							b_error = -log ( testnet.probability ( b, ev_t[b] ) );
 							
 						if ( !std::isnan ( b_error ) && !std::isinf ( b_error ) )
 							partial_error += b_error;
@@ -507,6 +843,9 @@ class DeepLSTM {
 				
 				partial_error /= ( length * B );
 				
+				// per original byte
+				partial_error *= test.tokens_per_byte;
+				
 				error += partial_error;
 				
 				datapoints.push_back ( partial_error );
@@ -532,6 +871,112 @@ class DeepLSTM {
 			
 		}
 		
+		/*
+			the whole of test, exactly once: B contiguous streams with
+			the state carried through, each stream but the first starts
+			burn_in tokens early and does not score them
+		
+			- tokens scored
+			- loss per original byte
+			- tokens / s
+			- seconds
+		*/
+		
+		std::tuple<size_t, dtype, dtype, dtype>
+		test_full ( Corpus &test, size_t burn_in = 100, dtype reset_std = 0.0, bool bits = false ) {
+		
+			Timer timer;
+			timer.start();
+			
+			size_t __B = B;
+			size_t predictions = test.size() - 1;
+			
+			DeepLSTM<MatrixType> &testnet = evaluation_context ( __B, 2 );
+			testnet.resetContext ( reset_std );
+			
+			// stream b scores [begin[b], end[b]) and is fed from first[b]
+			std::vector<size_t> first ( __B ), begin ( __B ), end ( __B );
+			size_t steps = 0;
+			
+			for ( size_t b = 0; b < __B; b++ ) {
+			
+				begin[b] = predictions * b / __B;
+				end[b] = predictions * ( b + 1 ) / __B;
+				first[b] = begin[b] - std::min ( burn_in, begin[b] );
+				steps = std::max ( steps, end[b] - first[b] );
+				
+			}
+			
+			MatrixType x ( __B, M );
+			double loss = 0;
+			size_t scored = 0;
+			
+			for ( size_t k = 0; k < steps; k++ ) {
+			
+				// streams that are done get an empty input
+				x.setZero();
+				
+				for ( size_t b = 0; b < __B; b++ ) {
+				
+					size_t i = first[b] + k;
+					
+					if ( i < end[b] ) {
+					
+						set_row_one_hot ( x, b, test[i] );
+						testnet.set_target ( b, test[i + 1] );
+						
+					}
+					
+				}
+				
+				testnet.forward ( false, x );
+				testnet.carryContext ( 1 );
+				
+				for ( size_t b = 0; b < __B; b++ ) {
+				
+					size_t i = first[b] + k;
+					
+					if ( i >= begin[b] && i < end[b] ) {
+					
+						dtype prob = testnet.probability ( b, test[i + 1] );
+						loss += bits ? -log2 ( prob ) : -log ( prob );
+						scored++;
+						
+					}
+					
+				}
+				
+				if ( k % 1000 == 0 )
+					std::cout << std::setprecision ( 3 ) << std::setw (
+								  15 ) << "Testing... " <<
+							  100.0f * ( float ) ( k ) / ( float ) ( steps ) <<
+							  "%\r" <<  std::flush;
+							  
+			}
+			
+			double seconds = timer.end();
+			
+			// per original byte
+			dtype error = loss / scored * test.tokens_per_byte;
+			
+			return std::make_tuple ( scored, error, scored / seconds, seconds );
+			
+		}
+		
+		/* target of row b for the next single-step forward */
+		void set_target ( size_t b, size_t token ) {
+		
+			if ( classlayer ) classlayer->s[1]['y'] ( b, 0 ) = token;
+			
+		}
+		
+		/* probability of token in row b after a single-step forward */
+		dtype probability ( size_t b, size_t token ) {
+		
+			return classlayer ? outputlayer->s[1]['p'] ( b, 0 ) : outputlayer->s[1]['p'] ( b, token );
+			
+		}
+		
 		void resetContext ( dtype std, size_t T = 0 ) {
 		
 			for ( size_t d = 0; d < D; d++ )
@@ -542,7 +987,7 @@ class DeepLSTM {
 		void carryContext ( size_t T ) {
 		
 			for ( size_t d = 0; d < D; d++ )
-				layers[d]->s[0] = layers[d]->s[T];
+				layers[d]->carry ( T );
 				
 		}
 		
@@ -640,7 +1085,70 @@ class DeepLSTM {
 			
 		}
 		
-		const size_t M, N, B, S, D;
+		/*
+			error of the gradients of the last forward / backward (x,
+			target) due to the activation stash (Timelayer::stash_bits):
+			the same pass is repeated from the same state ( 0 ), with the
+			same random numbers, by a net which keeps all states in
+			dtype and is released afterwards (as large as this one
+			without the stash, only with STASH_REPORT=1, see deeplstm.cc);
+			relative L2 error and largest difference per parameter
+		*/
+		void stash_report ( bool apply_dropout, std::vector<MatrixType> &x, std::vector<MatrixType> &target ) {
+		
+			int bits = Timelayer<MatrixType>::stash_bits;
+			std::unique_ptr<DeepLSTM> reference;
+			
+			{
+				ResidentStates<MatrixType> resident;
+				reference.reset ( new DeepLSTM ( M, N, B, S, D, {}, counts, classes ) );
+			}
+			
+			reference->copy_parameters ( *this );
+			
+			for ( size_t d = 0; d <= D; d++ ) {
+			
+				reference->layers[d]->s[0] = layers[d]->s[0];
+				reference->layers[d]->rng_step = layers[d]->rng_base;
+				
+			}
+			
+			reference->forward ( apply_dropout, x, target );
+			reference->backward ( apply_dropout, target );
+			
+			reference->sync_grads_host();
+			sync_grads_host();
+			
+			std::cout << "stash (" << bits << " bits), gradient error vs dtype states:" << std::endl;
+			
+			for ( size_t d = 0; d <= D; d++ ) {
+			
+				for ( auto &i : layers[d]->d.namemap ) {
+				
+					dtype largest;
+					dtype error = relative_error ( reference->layers[d]->d.matrices[i.second], layers[d]->d.matrices[i.second], largest );
+					
+					if ( error == 0 && largest == 0 ) continue;
+					
+					std::cout << std::setw ( 8 ) << "layer " << d << std::setw ( 8 ) << i.first << "  rel. error " <<
+							  std::setw ( 12 ) << error << "  max |diff| " << std::setw ( 12 ) << largest << std::endl;
+							  
+				}
+				
+			}
+			
+		}
+		
+		const size_t M, N;
+		size_t B, S;
+		const size_t D;
+		
+		// token counts and number of classes of a class-factored output
+		const std::vector<size_t> counts;
+		const size_t classes;
+		
+		// see evaluation_context
+		std::unique_ptr<DeepLSTM> context;
 		
 		//temp var using backward pass
 		std::vector<MatrixType> dx;
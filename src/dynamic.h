@@ -0,0 +1,161 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Dynamic evaluation (Krause et al. 2017)
+ *
+ * Scores a split while adapting to it: B contiguous streams
+ * are fed k tokens at a time, every window is scored first and
+ * then used for one update (forward, backward over the window,
+ * dynamic_update in optimization.h), so a token is never seen
+ * by the weights that predict it. The weights start from a
+ * net's parameters and are pulled back towards them.
+ *
+ * Keeps a k + 1 step net with its own parameters, gradients
+ * and m; the states are always resident (no checkpointing,
+ * spilling or stashing, see ResidentStates), nothing depends on
+ * the length of the split. The net is never reshaped: a last
+ * window shorter than k is padded with empty steps, only its
+ * first steps are scored and it is not used for an update
+ * (nothing comes after it).
+ *
+ */
+
+#ifndef __DYNAMIC_H__
+#define __DYNAMIC_H__
+
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include <deeplstm.h>
+#include <optimization.h>
+#include <timer.h>
+
+template <typename T>
+class DynamicEvaluation {
+
+	public:
+	
+		/* shaped like net, B streams, an update every k tokens */
+		DynamicEvaluation ( DeepLSTM<T> &net, size_t _B, size_t _k, dtype _learning_rate = 1e-4, dtype _decay = 1e-3,
+							dtype _rho = 0.95 ) : B ( _B ), k ( _k ), learning_rate ( _learning_rate ), decay ( _decay ), rho ( _rho ) {
+							
+			{
+				ResidentStates<T> resident;
+				adapted.reset ( new DeepLSTM<T> ( net.M, net.N, B, k + 1, net.D, {}, net.counts, net.classes ) );
+			}
+			
+			for ( size_t d = 0; d <= adapted->D; d++ )
+				adapted->layers[d]->release_updates();
+				
+			x.resize ( k + 1, T ( B, net.M ) );
+			target.resize ( k + 1, T ( B, net.classlayer ? 1 : net.M ) );
+			
+		}
+		
+		/*
+			data, adapting from the parameters of origin (device copies),
+			which are not modified; the last ( size - 1 ) % B predictions
+			are not scored
+			
+			- tokens scored
+			- loss per original byte
+			- tokens / s
+			- seconds
+		*/
+		std::tuple<size_t, dtype, dtype, dtype> score ( DeepLSTM<T> &origin, Corpus &data, dtype reset_std = 0.0,
+				bool bits = false ) {
+				
+			Timer timer, adapt_timer;
+			timer.start();
+			
+			DeepLSTM<T> &net = *adapted;
+			size_t length = ( data.size() - 1 ) / B;
+			double loss = 0;
+			size_t scored = 0;
+			
+			adapting = 0;
+			
+			net.copy_parameters ( origin );
+			
+			for ( size_t d = 0; d <= net.D; d++ ) {
+			
+				net.layers[d]->m.zero();
+				net.layers[d]->m.sync_device();
+				
+			}
+			
+			net.resetContext ( reset_std );
+			
+			for ( size_t first = 0; first < length; first += k ) {
+			
+				// the last window may be shorter, it is padded with empty steps after w
+				size_t w = std::min ( k, length - first );
+				
+				for ( size_t t = 1; t <= k; t++ ) {
+				
+					x[t].setZero();
+					target[t].setZero();
+					
+					for ( size_t b = 0; b < B && t <= w; b++ ) {
+					
+						size_t i = b * length + first + t - 1;
+						
+						set_row_one_hot ( x[t], b, data[i] );
+						
+						if ( net.classlayer ) target[t] ( b, 0 ) = data[i + 1];
+						else set_row_one_hot ( target[t], b, data[i + 1] );
+						
+					}
+					
+				}
+				
+				net.forward ( false, x, target );
+				
+				// steps 1 .. w, the padding does not reach them
+				loss += net.loss ( target, w, bits, w + 1 );
+				scored += w * B;
+				
+				// an update after the last window would not be used, and the padding would be in its gradients
+				if ( first + k >= length ) break;
+				
+				adapt_timer.start();
+				
+				net.backward ( false, target );
+				
+				for ( size_t d = 0; d <= net.D; d++ )
+					dynamic_update ( net.layers[d]->p, net.layers[d]->d, net.layers[d]->m, origin.layers[d]->p, learning_rate, rho,
+									 decay );
+									
+				adapting += adapt_timer.end();
+				
+				net.carryContext ( w );
+				
+			}
+			
+			double seconds = timer.end();
+			
+			// per original byte, loss () is in nats unless bits
+			dtype error = scored > 0 ? loss / scored * data.tokens_per_byte : 0;
+			
+			return std::make_tuple ( scored, error, scored / seconds, seconds );
+			
+		}
+		
+		const size_t B, k;
+		
+		dtype learning_rate, decay, rho;
+		
+		// seconds spent in backward and updates during the last score ()
+		double adapting = 0;
+		
+	protected:
+	
+		std::unique_ptr<DeepLSTM<T>> adapted;
+		
+		std::vector<T> x, target;
+		
+};
+
+#endif /* __DYNAMIC_H__ */
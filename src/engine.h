@@ -0,0 +1,656 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Low-latency inference for 1 - 4 streams (host)
+ *
+ * At B = 1 a step of the generic path is a few tiny GEMMs (1 x N
+ * by N x 4N), each followed by separate passes for the bias, the
+ * nonlinearities, the softmax and the carryContext copies; call
+ * overhead and memory traffic dominate. Here:
+ *
+ * - the parameters are packed once, gate-interleaved (i, o, f, u
+ *   of unit j in columns 4j .. 4j + 3), row-major, so a step is a
+ *   GEMV streaming every weight row once for all B rows
+ * - the first layer's input is a row of W gathered by token index
+ *   (the input is one-hot), layers above stack [W; U] into one
+ *   matrix fed [h below, h]
+ * - bias, gates, cell and h of a unit are done in the same pass,
+ *   h and c stay in place (h double-buffered), there is nothing
+ *   to carry
+ * - the softmax is fused into the output GEMV (max, exp, sum)
+ *
+ * With threads > 1 every layer's units and the output columns are
+ * split between persistent threads (the caller is thread 0), which
+ * meet at spinning barriers; they spin between steps, too.
+ *
+ * quantize () switches to int8 weights (containers/int8.h): [W;] U
+ * and the softmax W with a scale per output, the first layer's
+ * rows with a scale per token; h is kept as int8 next to the
+ * float copy, the GEMVs sum in int32 and are scaled back into the
+ * fused passes. A quarter of the weight traffic, at the cost of
+ * the rounding (see quantize.cc for the bpc).
+ *
+ * half () stores the same weights in bfloat16 or fp16 instead
+ * (containers/half.h), converted to fp32 in registers on the
+ * way into the FMAs, everything else stays fp32: half the weight
+ * traffic and memory.
+ *
+ */
+
+#ifndef __ENGINE_H__
+#define __ENGINE_H__
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <iostream>
+#include <math.h>
+
+#include <containers/datatype.h>
+#include <containers/int8.h>
+#include <containers/half.h>
+
+template <typename T> class DeepLSTM;
+
+/* all of n threads wait () until the last one arrives */
+class SpinBarrier {
+
+	public:
+	
+		SpinBarrier ( size_t _n ) : n ( _n ) { }
+		
+		void wait() {
+		
+			size_t current = generation.load ( std::memory_order_acquire );
+			
+			if ( count.fetch_add ( 1, std::memory_order_acq_rel ) + 1 == n ) {
+			
+				count.store ( 0, std::memory_order_relaxed );
+				generation.fetch_add ( 1, std::memory_order_release );
+				return;
+				
+			}
+			
+			for ( size_t spins = 0; generation.load ( std::memory_order_acquire ) == current; spins++ )
+				if ( spins > 1024 ) std::this_thread::yield();
+				
+		}
+		
+	protected:
+	
+		const size_t n;
+		std::atomic<size_t> count { 0 }, generation { 0 };
+		
+};
+
+class Engine {
+
+	public:
+	
+		/* M symbols, N units, D layers, B <= 4 streams */
+		Engine ( size_t _M, size_t _N, size_t _D, size_t _B = 1, size_t _threads = 1 ) : M ( _M ), N ( _N ), D ( _D ),
+			B ( _B ), threads ( std::max<size_t> ( 1, _threads ) ), barrier ( std::max<size_t> ( 1, _threads ) ) {
+			
+			weights.resize ( D );
+			biases.resize ( D );
+			h.resize ( D );
+			c.resize ( D );
+			
+			for ( size_t d = 0; d < D; d++ ) {
+			
+				// layer 0: U only, its W is the gather table
+				weights[d].resize ( ( d == 0 ? N : 2 * N ) * 4 * N );
+				biases[d].resize ( 4 * N );
+				
+				for ( size_t k = 0; k < 2; k++ )
+					h[d][k].assign ( B * N, 0 );
+					
+				c[d].assign ( B * N, 0 );
+				
+			}
+			
+			input.resize ( M * 4 * N );
+			output.resize ( N * M );
+			output_bias.resize ( M );
+			
+			gates.resize ( B * 4 * N );
+			probs.resize ( B * M );
+			tokens.assign ( B, M );
+			
+			maxima.resize ( threads * B );
+			sums.resize ( threads * B );
+			
+			for ( size_t id = 1; id < threads; id++ )
+				workers.push_back ( std::thread ( &Engine::work, this, id ) );
+				
+		}
+		
+		~Engine() {
+		
+			if ( threads > 1 ) {
+			
+				stopping = true;
+				barrier.wait();
+				
+			}
+			
+			for ( size_t k = 0; k < workers.size(); k++ )
+				workers[k].join();
+				
+		}
+		
+		/*
+			parameters of LSTM layer d, as in layers/lstm.h (column-major):
+			W - in x 4N, U - N x 4N, b - 1 x 4N
+		*/
+		void pack_layer ( size_t d, const dtype *W, const dtype *U, const dtype *b ) {
+		
+			size_t in = d == 0 ? M : N;
+			
+			for ( size_t gate = 0; gate < 4; gate++ )
+				for ( size_t j = 0; j < N; j++ ) {
+				
+					size_t col = 4 * j + gate, src = gate * N + j;
+					
+					for ( size_t k = 0; k < in; k++ )
+						( d == 0 ? input : weights[d] ) [k * 4 * N + col] = W[src * in + k];
+						
+					for ( size_t k = 0; k < N; k++ )
+						weights[d][ ( d == 0 ? k : N + k ) * 4 * N + col] = U[src * N + k];
+						
+					biases[d][col] = b[src];
+					
+				}
+				
+		}
+		
+		/* softmax parameters: W - N x M, b - 1 x M (column-major) */
+		void pack_output ( const dtype *W, const dtype *b ) {
+		
+			for ( size_t m = 0; m < M; m++ ) {
+			
+				for ( size_t k = 0; k < N; k++ )
+					output[k * M + m] = W[m * N + k];
+					
+				output_bias[m] = b[m];
+				
+			}
+			
+		}
+		
+		/* the parameters of a net (host copies are synced), full softmax only */
+		template <typename T>
+		bool pack ( DeepLSTM<T> &net ) {
+		
+			if ( net.classlayer || net.M != M || net.N != N || net.D != D ) {
+			
+				std::cout << "Engine::pack() : needs a full softmax, M = " << M << ", N = " << N << ", D = " << D << std::endl;
+				return false;
+				
+			}
+			
+			net.sync_params_host();
+			
+			for ( size_t d = 0; d < D; d++ )
+				pack_layer ( d, net.layers[d]->p['W'].data(), net.layers[d]->p['U'].data(), net.layers[d]->p['b'].data() );
+				
+			pack_output ( net.outputlayer->p['W'].data(), net.outputlayer->p['b'].data() );
+			
+			return true;
+			
+		}
+		
+		/* int8 weights from the packed ones, which are released */
+		void quantize() {
+		
+			const size_t G = 4 * N, N4 = ( N + 3 ) / 4 * 4;
+			
+			if ( quantized || halved ) {
+			
+				std::cout << "Engine::quantize() : weights are not fp32" << std::endl;
+				return;
+				
+			}
+			
+			qweights.resize ( D );
+			hq.resize ( D );
+			
+			for ( size_t d = 0; d < D; d++ ) {
+			
+				// [W;] U with rows padded to N4, so that U starts at a block of 4
+				std::vector<dtype> padded ( ( d == 0 ? N4 : 2 * N4 ) * G, 0 );
+				
+				for ( size_t k = 0; k < ( d == 0 ? N : 2 * N ); k++ )
+					std::copy ( &weights[d][k * G], &weights[d][ ( k + 1 ) * G], &padded[ ( k < N || d == 0 ? k : N4 + k - N ) * G] );
+					
+				qweights[d] = Int8Matrix ( padded.data(), padded.size() / G, G );
+				
+				for ( size_t k = 0; k < 2; k++ )
+					hq[d][k].assign ( B * N4, 0 );
+					
+				std::vector<dtype>().swap ( weights[d] );
+				
+			}
+			
+			qinput.resize ( M * G );
+			qinput_scales.resize ( M );
+			
+			for ( size_t m = 0; m < M; m++ ) {
+			
+				dtype largest = 0;
+				
+				for ( size_t k = 0; k < G; k++ )
+					largest = std::max ( largest, _fabs ( input[m * G + k] ) );
+					
+				qinput_scales[m] = largest > 0 ? largest / 127 : 1;
+				
+				for ( size_t k = 0; k < G; k++ )
+					qinput[m * G + k] = quantize_int8 ( input[m * G + k], qinput_scales[m] );
+					
+			}
+			
+			std::vector<dtype> padded ( N4 * M, 0 );
+			std::copy ( output.begin(), output.end(), padded.begin() );
+			qoutput = Int8Matrix ( padded.data(), N4, M );
+			
+			std::vector<dtype>().swap ( input );
+			std::vector<dtype>().swap ( output );
+			
+			accumulators.resize ( B * std::max ( G, M ) );
+			quantized = true;
+			
+		}
+		
+		/* 16-bit weights (HALF_BF16 or HALF_FP16) from the packed ones, which are released */
+		void half ( int format = HALF_BF16 ) {
+		
+			const size_t G = 4 * N;
+			
+			if ( quantized || halved ) {
+			
+				std::cout << "Engine::half() : weights are not fp32" << std::endl;
+				return;
+				
+			}
+			
+			hweights.resize ( D );
+			
+			for ( size_t d = 0; d < D; d++ ) {
+			
+				hweights[d] = HalfMatrix ( weights[d].data(), weights[d].size() / G, G, format );
+				std::vector<dtype>().swap ( weights[d] );
+				
+			}
+			
+			hinput = HalfMatrix ( input.data(), M, G, format );
+			houtput = HalfMatrix ( output.data(), N, M, format );
+			
+			std::vector<dtype>().swap ( input );
+			std::vector<dtype>().swap ( output );
+			
+			buffers.assign ( threads, std::vector<dtype> ( std::max ( G, M ) ) );
+			halved = true;
+			
+		}
+		
+		/* bytes of weights read by the steps (the first layer's W: one row per stream) */
+		size_t weight_bytes() const {
+		
+			size_t bytes = 0;
+			
+			for ( size_t d = 0; d < D; d++ )
+				bytes += quantized ? qweights[d].bytes() : halved ? hweights[d].bytes() : weights[d].size() * sizeof ( dtype );
+				
+			return bytes + ( quantized ? qoutput.bytes() : halved ? houtput.bytes() : output.size() * sizeof ( dtype ) );
+			
+		}
+		
+		/* zero state of stream b */
+		void reset ( size_t b ) {
+		
+			for ( size_t d = 0; d < D; d++ ) {
+			
+				std::fill ( &h[d][current][b * N], &h[d][current][ ( b + 1 ) * N], 0 );
+				std::fill ( &c[d][b * N], &c[d][ ( b + 1 ) * N], 0 );
+				
+				if ( quantized ) std::fill ( &hq[d][current][b * hq[d][current].size() / B], &hq[d][current][ ( b + 1 ) * hq[d][current].size() / B], 0 );
+				
+			}
+			
+		}
+		
+		/* feeds _tokens[b] to stream b (>= M: an empty input), then probabilities ( b ) is p ( next ) */
+		void step ( const size_t *_tokens ) {
+		
+			for ( size_t b = 0; b < B; b++ )
+				tokens[b] = _tokens[b];
+				
+			if ( threads > 1 ) barrier.wait();
+			
+			run ( 0 );
+			
+			current ^= 1;
+			
+		}
+		
+		const dtype *probabilities ( size_t b ) const { return &probs[b * M]; }
+		
+		const size_t M, N, D, B, threads;
+		
+	protected:
+	
+		void work ( size_t id ) {
+		
+			while ( true ) {
+			
+				// a step or the destructor
+				barrier.wait();
+				
+				if ( stopping ) return;
+				
+				run ( id );
+				
+			}
+			
+		}
+		
+		void sync() { if ( threads > 1 ) barrier.wait(); }
+		
+		/* [first, last) of n owned by thread id, in multiples of 16 (cache lines) */
+		void range ( size_t n, size_t id, size_t &first, size_t &last ) const {
+		
+			size_t chunks = ( n + 15 ) / 16;
+			
+			first = std::min ( n, chunks * id / threads * 16 );
+			last = std::min ( n, chunks * ( id + 1 ) / threads * 16 );
+			
+		}
+		
+		void run ( size_t id ) {
+		
+			size_t first, last;
+			
+			range ( N, id, first, last );
+			
+			for ( size_t d = 0; d < D; d++ ) {
+			
+				layer ( d, id, first, last );
+				
+				// h of layer d is complete
+				sync();
+				
+			}
+			
+			range ( M, id, first, last );
+			
+			softmax ( id, first, last );
+			
+		}
+		
+		/* units [first, last) of layer d, thread id */
+		void layer ( size_t d, size_t id, size_t first, size_t last ) {
+		
+			const size_t G = 4 * N, width = 4 * ( last - first );
+			
+			for ( size_t b = 0; b < B; b++ ) {
+			
+				dtype *__restrict__ gb = &gates[b * G + 4 * first];
+				const dtype *bias = &biases[d][4 * first];
+				
+				if ( d == 0 && tokens[b] < M && quantized ) {
+				
+					const int8_t *row = &qinput[tokens[b] * G + 4 * first];
+					const dtype scale = qinput_scales[tokens[b]];
+					
+					for ( size_t k = 0; k < width; k++ )
+						gb[k] = bias[k] + scale * row[k];
+						
+				} else if ( d == 0 && tokens[b] < M ) {
+				
+					const dtype *row = &input[tokens[b] * G + 4 * first];
+					
+					if ( halved ) {
+					
+						hinput.row ( tokens[b], 4 * first, width, &buffers[id][0] );
+						row = &buffers[id][0];
+						
+					}
+					
+					for ( size_t k = 0; k < width; k++ )
+						gb[k] = bias[k] + row[k];
+						
+				} else
+				
+					for ( size_t k = 0; k < width; k++ )
+						gb[k] = bias[k];
+						
+			}
+			
+			// [h below, h] x [W; U]
+			if ( quantized ) {
+			
+				const size_t N4 = hq[d][0].size() / B;
+				const int8_t *below = d > 0 ? hq[d - 1][current ^ 1].data() : hq[d][current].data();
+				
+				// columns [4 first, 4 last) of every row, the slice of this thread
+				qweights[d].gemv ( below, hq[d][current].data(), d > 0 ? N4 : 0, N4, B, 4 * first, 4 * last,
+								   &accumulators[4 * first], G );
+								   
+				for ( size_t b = 0; b < B; b++ ) {
+				
+					dtype *__restrict__ gb = &gates[b * G];
+					const int32_t *ab = &accumulators[b * G];
+					
+					for ( size_t k = 4 * first; k < 4 * last; k++ )
+						gb[k] += qweights[d].scales[k] * ( dtype ) ( 1.0 / 127 ) * ab[k];
+						
+				}
+				
+			} else if ( halved ) {
+			
+				if ( d > 0 ) hweights[d].gemv ( 0, N, h[d - 1][current ^ 1].data(), N, B, 4 * first, width, &gates[4 * first], G );
+				
+				hweights[d].gemv ( d > 0 ? N : 0, N, h[d][current].data(), N, B, 4 * first, width, &gates[4 * first], G );
+				
+			} else {
+			
+				if ( d > 0 ) accumulate ( &weights[d][4 * first], h[d - 1][current ^ 1].data(), N, first, width );
+				
+				accumulate ( &weights[d][ ( d > 0 ? N : 0 ) * G + 4 * first], h[d][current].data(), N, first, width );
+				
+			}
+			
+			for ( size_t b = 0; b < B; b++ ) {
+			
+				const dtype *gb = &gates[b * G];
+				dtype *cb = &c[d][b * N];
+				dtype *hb = &h[d][current ^ 1][b * N];
+				
+				for ( size_t j = first; j < last; j++ ) {
+				
+					dtype i = logistic ( gb[4 * j] ), o = logistic ( gb[4 * j + 1] ), f = logistic ( gb[4 * j + 2] );
+					dtype u = _tanh ( gb[4 * j + 3] );
+					
+					cb[j] = f * cb[j] + i * u;
+					hb[j] = o * _tanh ( cb[j] );
+					
+				}
+				
+				if ( quantized ) {
+				
+					int8_t *qb = &hq[d][current ^ 1][b * ( hq[d][0].size() / B )];
+					
+					for ( size_t j = first; j < last; j++ )
+						qb[j] = quantize_int8 ( hb[j], ( dtype ) ( 1.0 / 127 ) );
+						
+				}
+				
+			}
+			
+		}
+		
+		/* gates of units from first += x ( B x rows ) times rows of w (stride 4N), width columns */
+		void accumulate ( const dtype *w, const dtype *x, size_t rows, size_t first, size_t width ) {
+		
+			const size_t G = 4 * N;
+			
+			for ( size_t k = 0; k < rows; k++ ) {
+			
+				const dtype *__restrict__ row = w + k * G;
+				
+				for ( size_t b = 0; b < B; b++ ) {
+				
+					const dtype v = x[b * N + k];
+					dtype *__restrict__ gb = &gates[b * G + 4 * first];
+					
+					for ( size_t col = 0; col < width; col++ )
+						gb[col] += v * row[col];
+						
+				}
+				
+			}
+			
+		}
+		
+		/* output columns [first, last) of thread id */
+		void softmax ( size_t id, size_t first, size_t last ) {
+		
+			const dtype *top = h[D - 1][current ^ 1].data();
+			
+			if ( quantized ) {
+			
+				const size_t N4 = hq[D - 1][0].size() / B;
+				const int8_t *qtop = hq[D - 1][current ^ 1].data();
+				
+				qoutput.gemv ( qtop, qtop, 0, N4, B, first, last, &accumulators[first], M );
+				
+				for ( size_t b = 0; b < B; b++ ) {
+				
+					const int32_t *ab = &accumulators[b * M];
+					
+					for ( size_t m = first; m < last; m++ )
+						probs[b * M + m] = output_bias[m] + qoutput.scales[m] * ( dtype ) ( 1.0 / 127 ) * ab[m];
+						
+				}
+				
+			} else {
+			
+				for ( size_t b = 0; b < B; b++ )
+					for ( size_t m = first; m < last; m++ )
+						probs[b * M + m] = output_bias[m];
+						
+				if ( halved ) houtput.gemv ( 0, N, top, N, B, first, last - first, &probs[first], M );
+				else
+				
+					for ( size_t k = 0; k < N; k++ ) {
+					
+						const dtype *__restrict__ w = &output[k * M];
+						
+						for ( size_t b = 0; b < B; b++ ) {
+						
+							dtype *__restrict__ pb = &probs[b * M];
+							dtype v = top[b * N + k];
+							
+							for ( size_t m = first; m < last; m++ )
+								pb[m] += v * w[m];
+								
+						}
+						
+					}
+					
+			}
+			
+			for ( size_t b = 0; b < B; b++ ) {
+			
+				dtype *pb = &probs[b * M];
+				dtype maximum = -INFINITY;
+				
+				for ( size_t m = first; m < last; m++ )
+					maximum = std::max ( maximum, pb[m] );
+					
+				maxima[id * B + b] = maximum;
+				
+			}
+			
+			sync();
+			
+			for ( size_t b = 0; b < B; b++ ) {
+			
+				dtype *pb = &probs[b * M];
+				dtype maximum = -INFINITY, sum = 0;
+				
+				for ( size_t t = 0; t < threads; t++ )
+					maximum = std::max ( maximum, maxima[t * B + b] );
+					
+				for ( size_t m = first; m < last; m++ ) {
+				
+					pb[m] = _exp ( pb[m] - maximum );
+					sum += pb[m];
+					
+				}
+				
+				sums[id * B + b] = sum;
+				
+			}
+			
+			sync();
+			
+			for ( size_t b = 0; b < B; b++ ) {
+			
+				dtype sum = 0;
+				
+				for ( size_t t = 0; t < threads; t++ )
+					sum += sums[t * B + b];
+					
+				for ( size_t m = first; m < last; m++ )
+					probs[b * M + m] /= sum;
+					
+			}
+			
+			// all of probs is ready, nobody reads h any more
+			sync();
+			
+		}
+		
+		// layers: [W;] U gate-interleaved row-major, biases, h (two buffers), c
+		std::vector<std::vector<dtype>> weights, biases;
+		std::vector<std::array<std::vector<dtype>, 2>> h;
+		std::vector<std::vector<dtype>> c;
+		
+		// rows of the first layer's W, indexed by token; softmax N x M
+		std::vector<dtype> input, output, output_bias;
+		
+		// int8: [W;] U, softmax W, first layer's rows and their scales, h (two buffers, N padded to 4)
+		bool quantized = false;
+		std::vector<Int8Matrix> qweights;
+		Int8Matrix qoutput;
+		std::vector<int8_t> qinput;
+		std::vector<dtype> qinput_scales;
+		std::vector<std::array<std::vector<int8_t>, 2>> hq;
+		std::vector<int32_t> accumulators;
+		
+		// 16-bit: [W;] U, first layer's rows, softmax W, a converted row per thread (gathers)
+		bool halved = false;
+		std::vector<HalfMatrix> hweights;
+		HalfMatrix hinput, houtput;
+		std::vector<std::vector<dtype>> buffers;
+		
+		std::vector<dtype> gates, probs;
+		std::vector<size_t> tokens;
+		
+		// per thread and stream
+		std::vector<dtype> maxima, sums;
+		
+		// h[d][current] holds the carried h
+		size_t current = 0;
+		
+		SpinBarrier barrier;
+		std::vector<std::thread> workers;
+		std::atomic<bool> stopping { false };
+		
+};
+
+#endif /* __ENGINE_H__ */
@@ -0,0 +1,167 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Evaluation in a background thread
+ *
+ * submit() copies the parameters of the training net into one
+ * of two snapshots (device to device, between iterations) and
+ * queues a job for it (sample, test_batch, serialization);
+ * training goes on while the worker runs the job. The worker
+ * only reads the snapshot it picked and submit() only writes
+ * the other one, so a running job is never disturbed and a
+ * job that has not started yet is replaced by a newer one.
+ *
+ * Values which outlive a job (e.g. smoothed test errors) are
+ * kept by the evaluator under its lock (get / set), not in
+ * variables shared with the main thread.
+ *
+ * The worker has its own cuBLAS handle and streams (thread_local
+ * in cu_matrix.h); kernels still go to the default stream and
+ * are interleaved with training.
+ *
+ */
+
+#ifndef __EVALUATOR_H__
+#define __EVALUATOR_H__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <map>
+#include <string>
+
+#include <deeplstm.h>
+
+template <typename T>
+class Evaluator {
+
+	public:
+	
+		/* the snapshot, stamped by the caller through the captures */
+		typedef std::function<void ( DeepLSTM<T> & )> Job;
+		
+		Evaluator ( DeepLSTM<T> &_net, int _device ) : net ( _net ), device ( _device ) {
+		
+			for ( size_t k = 0; k < 2; k++ )
+				snapshots[k].reset ( new DeepLSTM<T> ( net, net.B, 2, false ) );
+				
+			worker = std::thread ( &Evaluator::run, this );
+			
+		}
+		
+		/* a job already submitted still runs */
+		~Evaluator() {
+		
+			{
+				std::lock_guard<std::mutex> lock ( mtx );
+				stop = true;
+			}
+			
+			ready.notify_one();
+			worker.join();
+			
+		}
+		
+		/* between iterations, i.e. not between forward and adapt of a step */
+		void submit ( Job job ) {
+		
+			std::lock_guard<std::mutex> lock ( mtx );
+			
+			int k = running == 0 ? 1 : 0;
+			
+			snapshots[k]->copy_parameters ( net );
+			jobs[k] = job;
+			pending = k;
+			
+			ready.notify_one();
+			
+		}
+		
+		/* value of a job, initial if it was never set; any thread */
+		double get ( const std::string &name, double initial = 0.0 ) {
+		
+			std::lock_guard<std::mutex> lock ( mtx );
+			
+			auto i = values.find ( name );
+			return i == values.end() ? initial : i->second;
+			
+		}
+		
+		void set ( const std::string &name, double value ) {
+		
+			std::lock_guard<std::mutex> lock ( mtx );
+			values[name] = value;
+			
+		}
+		
+		/* until nothing is queued or running */
+		void wait() {
+		
+			std::unique_lock<std::mutex> lock ( mtx );
+			done.wait ( lock, [&] { return pending < 0 && running < 0; } );
+			
+		}
+		
+	protected:
+	
+		void run() {
+		
+			#ifdef __USE_CUDA__
+			cudaSetDevice ( device );
+			init_cublas ( device );
+			#endif
+			
+			std::unique_lock<std::mutex> lock ( mtx );
+			
+			while ( true ) {
+			
+				ready.wait ( lock, [&] { return stop || pending >= 0; } );
+				
+				if ( pending < 0 ) break;
+				
+				running = pending;
+				pending = -1;
+				
+				Job job;
+				job.swap ( jobs[running] );
+				
+				lock.unlock();
+				job ( *snapshots[running] );
+				lock.lock();
+				
+				running = -1;
+				done.notify_all();
+				
+			}
+			
+			#ifdef __USE_CUDA__
+			teardown_cublas();
+			#endif
+			
+		}
+		
+		DeepLSTM<T> &net;
+		int device;
+		
+		std::unique_ptr<DeepLSTM<T>> snapshots[2];
+		Job jobs[2];
+		
+		// snapshot index, -1 if none
+		int pending = -1;
+		int running = -1;
+		bool stop = false;
+		
+		// see get / set
+		std::map<std::string, double> values;
+		
+		std::mutex mtx;
+		std::condition_variable ready, done;
+		
+		std::thread worker;
+		
+};
+
+#endif /* __EVALUATOR_H__ */
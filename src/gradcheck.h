@@ -84,6 +84,26 @@ bool check_gradient_error ( const char *message, const matrix<dtype> &n,
 	return okMean && okMax;
 }
 
+/* || m - reference || / || reference || and max | m - reference | */
+dtype relative_error ( const matrix<dtype> &reference, const matrix<dtype> &m, dtype &largest ) {
+
+	double difference = 0, norm = 0;
+	largest = 0;
+	
+	for ( size_t i = 0; i < m.size(); i++ ) {
+	
+		dtype e = m ( i ) - reference ( i );
+		
+		difference += ( double ) e * e;
+		norm += ( double ) reference ( i ) * reference ( i );
+		largest = std::max ( largest, ( dtype ) fabs ( e ) );
+		
+	}
+	
+	return norm > 0 ? sqrt ( difference / norm ) : 0;
+	
+}
+
 // returns true if everything is OK
 template<typename T>
 bool check_gradients ( Parameters<T> &n, Parameters<T> &d ) {
@@ -31,7 +31,6 @@ class aLSTM : public Timelayer<T> {
 	public:
 	
 		using Timelayer<T>::s;
-		T rands;
 		
 		size_t L = 1; // memory cells per hidden neuron
 		
@@ -68,8 +67,6 @@ class aLSTM : public Timelayer<T> {
 			matrix_init ( p ( W ) );
 			matrix_init ( p ( U ) );
 			
-			rands = T ( _B, _N );
-			
 			// set biases of f gates to 1
 			// (http://jmlr.org/proceedings/papers/v37/jozefowicz15.pdf)
 			p ( b ).block_forall ( 2 * N * L, N * L, [ = ] () { return 1; } );
@@ -109,8 +106,6 @@ class aLSTM : public Timelayer<T> {
 			sync_stream ( 1 );
 			sync_stream ( 2 );
 			
-			cu_rand ( rands.cu_data, rands.size() );
-			
 			//fused
 			cu_elementwise_alstm_forward (
 				& ( s ( t, g ).cu_data[0] ),
@@ -121,7 +116,7 @@ class aLSTM : public Timelayer<T> {
 				& ( s ( t, c ).cu_data[0] ),
 				& ( s ( t, ct ).cu_data[0] ),
 				& ( s ( t - 1, c ).cu_data[0] ),
-				& ( rands.cu_data[0] ),
+				this->next_rng_key(),
 				N, L, s ( t, c ).rows() );
 				
 			s ( t, c ).sync_host();
@@ -0,0 +1,319 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Class-factored softmax (CUDA), for large vocabularies
+ *
+ * p ( w | h ) = p ( class ( w ) | h ) p ( w | class ( w ), h )
+ *
+ * Tokens are binned by frequency into about C = sqrt ( M )
+ * classes, each holding a similar share of the training data
+ * (Goodman 2001, Mikolov et al. 2011). Forward computes the
+ * B x C class distribution and, for every row, the distribution
+ * over the members of the target's class only, so training and
+ * scoring cost O ( N ( C + K ) ) per position instead of
+ * O ( N M ), K being the largest class.
+ *
+ * The layer is evaluated at the targets: token ids (B x 1) in
+ * s ( t, y ) during forward and in g ( t, y ) during backward;
+ * p holds the probability of the target.
+ *
+ */
+
+#ifndef __CLASS_SOFTMAX_H__
+#define __CLASS_SOFTMAX_H__
+
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <parameters.h>
+#include <timelayer.h>
+#include <state.h>
+#include <containers/cu_matrix.h>
+
+class VocabularyClasses {
+
+	public:
+	
+		VocabularyClasses ( const std::vector<size_t> &counts, size_t requested ) : tokens ( counts.size() ),
+			token_class ( counts.size() ), token_column ( counts.size() ) {
+			
+			size_t M = counts.size();
+			requested = std::max<size_t> ( 1, std::min ( requested, M ) );
+			
+			// most frequent first
+			std::iota ( tokens.begin(), tokens.end(), 0 );
+			std::stable_sort ( tokens.begin(), tokens.end(), [&] ( size_t a, size_t b ) { return counts[a] > counts[b]; } );
+			
+			// + 1, tokens missing from the sample still get a class
+			double total = 0, mass = 0;
+			
+			for ( size_t w = 0; w < M; w++ )
+				total += counts[w] + 1;
+				
+			// the tail is not allowed to pile up in one huge class
+			size_t largest_allowed = 2 * ( ( M + requested - 1 ) / requested );
+			
+			bounds.push_back ( 0 );
+			
+			for ( size_t k = 0; k < M; k++ ) {
+			
+				size_t members = k - bounds.back();
+				
+				if ( members > 0 && ( mass >= total / requested || members >= largest_allowed ) ) {
+				
+					bounds.push_back ( k );
+					mass = 0;
+					
+				}
+				
+				token_class[tokens[k]] = bounds.size() - 1;
+				token_column[tokens[k]] = k;
+				mass += counts[tokens[k]] + 1;
+				
+			}
+			
+			bounds.push_back ( M );
+			
+		}
+		
+		size_t classes() const { return bounds.size() - 1; }
+		
+		size_t largest() const {
+		
+			size_t K = 0;
+			
+			for ( size_t c = 0; c < classes(); c++ )
+				K = std::max ( K, bounds[c + 1] - bounds[c] );
+				
+			return K;
+			
+		}
+		
+		/* token in column k of W, class of a token, column of a token */
+		std::vector<size_t> tokens, token_class, token_column;
+		
+		/* class c owns columns [bounds[c], bounds[c + 1]) */
+		std::vector<size_t> bounds;
+		
+};
+
+template <typename T>
+class ClassSoftmax : public Timelayer<T> {
+
+	public:
+	
+		//temp storage for probability sums
+		T sums;
+		T maxima;
+		
+		VocabularyClasses vocabulary;
+		
+		// device copies of the tables
+		T token_class, token_column, bounds;
+		
+		size_t C, K;
+		
+		/* counts - occurrences of each token in (a sample of) the training data */
+		ClassSoftmax ( size_t _in, const std::vector<size_t> &counts, size_t classes, size_t _B, size_t _S ) :
+			ClassSoftmax ( _in, VocabularyClasses ( counts, classes ), _B, _S ) { }
+			
+		ClassSoftmax ( size_t _in, const VocabularyClasses &_vocabulary, size_t _B, size_t _S ) :
+			Timelayer<T> ( _in, 1, _B, _S,
+			
+		{	"class softmax"		},
+		
+		{
+			/* define states */
+			std::make_tuple ( "pc", _B, _vocabulary.classes() ),
+			std::make_tuple ( "pw", _B, _vocabulary.largest() ),
+			std::make_tuple ( "p", _B, 1 )
+			
+		}, {
+		
+			/* define params */
+			std::make_tuple ( "Wc", _in, _vocabulary.classes() ),
+			std::make_tuple ( "bc", 1, _vocabulary.classes() ),
+			std::make_tuple ( "W", _in, _vocabulary.tokens.size() ),
+			std::make_tuple ( "b", 1, _vocabulary.tokens.size() ),
+			
+			std::make_tuple ( "B_ones", _B, 1 ),
+			std::make_tuple ( "C_ones", _vocabulary.classes(), 1 )
+			
+		} ), vocabulary ( _vocabulary ), C ( _vocabulary.classes() ), K ( _vocabulary.largest() ) {
+		
+			/*init*/
+			matrix_init ( p ( Wc ) );
+			matrix_init ( p ( W ) );
+			
+			sums = T ( _B, 1 );
+			maxima = T ( _B, 1 );
+			
+			p ( C_ones ).forall ( [ = ] () { return 1; } );
+			p ( C_ones ).sync_device();
+			p ( B_ones ).forall ( [ = ] () { return 1; } );
+			p ( B_ones ).sync_device();
+			
+			size_t M = vocabulary.tokens.size();
+			
+			token_class = T ( M, 1 );
+			token_column = T ( M, 1 );
+			bounds = T ( C + 1, 1 );
+			
+			for ( size_t w = 0; w < M; w++ ) {
+			
+				token_class ( w ) = vocabulary.token_class[w];
+				token_column ( w ) = vocabulary.token_column[w];
+				
+			}
+			
+			for ( size_t c = 0; c <= C; c++ )
+				bounds ( c ) = vocabulary.bounds[c];
+				
+			token_class.sync_device();
+			token_column.sync_device();
+			bounds.sync_device();
+			
+			std::cout << "ClassSoftmax() : " << M << " tokens in " << C << " classes, largest " << K << std::endl;
+			
+		}
+		
+		virtual void forward ( bool dropout, size_t t = 1 ) {
+		
+			s ( t, x ).sync_device();
+			s ( t, y ).sync_device();
+			
+			// class distribution, as in cu_softmax.h
+			CU_GEMM ( s ( t, pc ), s ( t, x ), p ( Wc ), false, false, 1, 0 );
+			
+			cu_add_row_vector ( & ( s ( t, pc ) ).cu_data[0], & ( p ( bc ) ).cu_data[0], C, s ( t, pc ).rows() );
+			
+			cu_row_max ( maxima.cu_data,  s ( t, pc ).cu_data, C, s ( t, pc ).rows() );
+			cu_sub_col_vector ( & ( s ( t, pc ) ).cu_data[0], maxima.cu_data, C, s ( t, pc ).rows() );
+			
+			cu_exp ( & ( s ( t, pc ) ).cu_data[0], C * s ( t, pc ).rows() );
+			
+			CU_GEMM ( sums, s ( t, pc ), p ( C_ones ), false, false, 1, 0 );
+			
+			cu_div_col_vector ( & ( s ( t, pc ) ).cu_data[0], & ( sums.cu_data[0] ), C, s ( t, pc ).rows() );
+			
+			// distribution within the target's class, p = pc * pw
+			cu_class_softmax_forward ( s ( t, p ).cu_data, s ( t, pw ).cu_data, s ( t, pc ).cu_data, s ( t, x ).cu_data,
+									   p ( W ).cu_data, p ( b ).cu_data, s ( t, y ).cu_data, token_class.cu_data, token_column.cu_data,
+									   bounds.cu_data, this->M, s ( t, p ).rows(), K );
+									
+			s ( t, p ).sync_host();
+			
+		}
+		
+		virtual void backward ( bool dropout, size_t t ) {
+		
+			cu_class_softmax_error ( g ( t, pc ).cu_data, s ( t, pc ).cu_data, g ( t, y ).cu_data, token_class.cu_data, C,
+									 s ( t, pc ).rows() );
+									
+			// propagate through the class layer
+			cublasSetStream ( handle, streams[1] );
+			CU_GEMM ( d ( Wc ), s ( t, x ), g ( t, pc ), true, false );
+			cublasSetStream ( handle, streams[2] );
+			CU_GEMM ( d ( bc ), p ( B_ones ), g ( t, pc ), true, false );
+			cublasSetStream ( handle, streams[3] );
+			CU_GEMM ( g ( t, x ), g ( t, pc ), p ( Wc ), false, true, 1, 0 );
+			
+			sync_stream ( 1 );
+			sync_stream ( 2 );
+			sync_stream ( 3 );
+			
+			// members of the target's class, accumulated into d ( W ), d ( b ), g ( t, x )
+			cu_class_softmax_backward ( g ( t, x ).cu_data, d ( W ).cu_data, d ( b ).cu_data, s ( t, pw ).cu_data,
+										s ( t, x ).cu_data, p ( W ).cu_data, g ( t, y ).cu_data, token_class.cu_data, token_column.cu_data,
+										bounds.cu_data, this->M, s ( t, p ).rows(), K );
+										
+		}
+		
+		/*
+			sample the token of a row at t, class first, then a member
+			of that class, both at the given temperature (0 - argmax);
+			uses the host copy of the parameters
+		*/
+		size_t draw ( size_t t, size_t row, dtype r_class, dtype r_token, dtype temperature = 1 ) {
+		
+			s ( t, pc ).sync_host();
+			
+			std::vector<dtype> weights ( C );
+			dtype maximum = 0, sum = 0;
+			
+			for ( size_t c = 0; c < C; c++ )
+				maximum = std::max ( maximum, s ( t, pc ) ( row, c ) );
+				
+			for ( size_t c = 0; c < C; c++ ) {
+			
+				dtype pc_c = s ( t, pc ) ( row, c );
+				weights[c] = temperature <= 0 ? ( pc_c == maximum ) : temperature == 1 ? pc_c : powf ( pc_c / maximum,
+							 1 / temperature );
+				sum += weights[c];
+				
+			}
+			
+			size_t c = pick ( weights, r_class * sum );
+			
+			size_t first = vocabulary.bounds[c], members = vocabulary.bounds[c + 1] - first;
+			
+			std::vector<dtype> logits ( members );
+			maximum = -INFINITY;
+			sum = 0;
+			
+			for ( size_t j = 0; j < members; j++ ) {
+			
+				logits[j] = p ( b ) ( first + j );
+				
+				for ( size_t i = 0; i < this->M; i++ )
+					logits[j] += s ( t, x ) ( row, i ) * p ( W ) ( i, first + j );
+					
+				maximum = std::max ( maximum, logits[j] );
+				
+			}
+			
+			for ( size_t j = 0; j < members; j++ ) {
+			
+				logits[j] = temperature <= 0 ? ( logits[j] == maximum ) : exp ( ( logits[j] - maximum ) / temperature );
+				sum += logits[j];
+				
+			}
+			
+			return vocabulary.tokens[first + pick ( logits, r_token * sum )];
+			
+		}
+		
+		/* inverse CDF, the first nonzero weight reaching threshold */
+		static size_t pick ( const std::vector<dtype> &weights, dtype threshold ) {
+		
+			dtype cdf = 0;
+			
+			for ( size_t j = 0; j < weights.size(); j++ ) {
+			
+				cdf += weights[j];
+				
+				if ( weights[j] > 0 && threshold <= cdf ) return j;
+				
+			}
+			
+			return weights.size() - 1;
+			
+		}
+		
+		virtual bool reshape ( size_t _B, size_t _S ) {
+		
+			if ( !Timelayer<T>::reshape ( _B, _S ) ) return false;
+			
+			sums = T ( _B, 1 );
+			maxima = T ( _B, 1 );
+			
+			return true;
+			
+		}
+		
+		virtual void reset ( dtype std ) {};
+		
+};
+
+#endif /* __CLASS_SOFTMAX_H__ */
@@ -101,6 +101,17 @@ class Softmax : public Timelayer<T> {
 			
 		}
 		
+		virtual bool reshape ( size_t _B, size_t _S ) {
+		
+			if ( !Timelayer<T>::reshape ( _B, _S ) ) return false;
+			
+			sums = T ( _B, 1 );
+			maxima = T ( _B, 1 );
+			
+			return true;
+			
+		}
+		
 		virtual void reset ( dtype std ) {};
 		
 		/* optional */
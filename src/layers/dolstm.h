@@ -37,7 +37,9 @@ class doLSTM : public Timelayer<T> {
 	public:
 	
 		using Timelayer<T>::s;
-		T rands;
+		
+		// 1 bit per drawn choice, refilled every step
+		cu_mask mask;
 		
 		size_t L = 1; // memory cells per hidden neuron
 		
@@ -74,7 +76,7 @@ class doLSTM : public Timelayer<T> {
 			matrix_init ( p ( W ) );
 			matrix_init ( p ( U ) );
 			
-			rands = T ( _B, _N * _L / 2 );
+			mask.cu_resize ( _B * _N * _L / 2 );
 			
 			// set biases of f gates to 1
 			// (http://jmlr.org/proceedings/papers/v37/jozefowicz15.pdf)
@@ -115,7 +117,7 @@ class doLSTM : public Timelayer<T> {
 			sync_stream ( 1 );
 			sync_stream ( 2 );
 			
-			cu_rand ( rands.cu_data, rands.size() );
+			mask.fill ( this->next_rng_key(), ( dtype ) 0.5 );
 			
 			//fused
 			cu_elementwise_dolstm_forward (
@@ -127,7 +129,7 @@ class doLSTM : public Timelayer<T> {
 				& ( s ( t, c ).cu_data[0] ),
 				& ( s ( t, ct ).cu_data[0] ),
 				& ( s ( t - 1, c ).cu_data[0] ),
-				& ( rands.cu_data[0] ),
+				mask.cu_data,
 				N, L, s ( t, c ).rows() );
 				
 			s ( t, c ).sync_host();
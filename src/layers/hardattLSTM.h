@@ -33,7 +33,6 @@ class hardattLSTM : public Timelayer<T> {
 	public:
 	
 		using Timelayer<T>::s;
-		T rands;
 		
 		size_t L = 1; // memory cells per hidden neuron
 		
@@ -70,7 +69,6 @@ class hardattLSTM : public Timelayer<T> {
 			/*init*/
 			matrix_init ( p ( W ) );
 			matrix_init ( p ( U ) );
-			rands = T ( _B, 5 * _N * _L );
 			
 			// set biases of f gates to -x (don't forget - sparse lstm has inverted f gates)
 			// (http://jmlr.org/proceedings/papers/v37/jozefowicz15.pdf)
@@ -108,8 +106,6 @@ class hardattLSTM : public Timelayer<T> {
 			sync_stream ( 1 );
 			sync_stream ( 2 );
 			
-			cu_rand ( rands.cu_data, rands.size() );
-			
 			//fused
 			cu_elementwise_hardattlstm_forward (
 				& ( s ( t, g ).cu_data[0] ),
@@ -122,7 +118,7 @@ class hardattLSTM : public Timelayer<T> {
 				& ( s ( t, ct ).cu_data[0] ),
 				& ( s ( t - 1, c ).cu_data[0] ),
 				& ( s ( t - 1, h ).cu_data[0] ),
-				& ( rands.cu_data[0] ),
+				this->next_rng_key(),
 				N, L, s ( t, c ).rows() );
 				
 			s ( t, c ).sync_host();
@@ -89,8 +89,14 @@ class LSTM : public Timelayer<T> {
 		virtual void forward ( bool apply_dropout, size_t t = 1 ) {
 		
 			s ( t, x ).sync_device();
-			s ( t - 1, h ).sync_device();
-			s ( t - 1, c ).sync_device();
+			
+			// in inference mode h and c ( t - 1 ) are still on the device
+			if ( !this->inference ) {
+			
+				s ( t - 1, h ).sync_device();
+				s ( t - 1, c ).sync_device();
+				
+			}
 			
 			// put in 2 separate streams
 			cublasSetStream ( handle, streams[1] );
@@ -113,7 +119,8 @@ class LSTM : public Timelayer<T> {
 				& ( s ( t - 1, c ).cu_data[0] ),
 				N, s ( t, c ).rows() );
 				
-			s ( t, c ).sync_host();
+			if ( !this->inference ) s ( t, c ).sync_host();
+			
 			s ( t, h ).sync_host();
 			
 			// measure c and h activity
@@ -165,6 +172,14 @@ class LSTM : public Timelayer<T> {
 		
 			randn ( s ( 0, h ), ( dtype ) 0, ( dtype ) std );
 			randn ( s ( 0, c ), ( dtype ) 0, ( dtype ) std );
+			
+			if ( this->inference ) {
+			
+				s ( 0, h ).sync_device();
+				s ( 0, c ).sync_device();
+				
+			}
+			
 			// s ( 0, h ).cu_zero();
 			// s ( 0, c ).cu_zero();
 		}
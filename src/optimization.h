@@ -65,6 +65,49 @@ void adadelta ( Parameters<T> &weights, Parameters<T> &gradients, Parameters<T>
 	
 }
 
+/*
+	dynamic evaluation (Krause et al. 2017): RMS-normalized step,
+	pulled back towards the original weights by decay; only m is
+	kept as optimizer state, origin is read-only
+*/
+template<typename T>
+void dynamic_update ( Parameters<T> &weights, Parameters<T> &gradients, Parameters<T> &memory, Parameters<T> &origin,
+					  const dtype learning_rate, const dtype rho, const dtype decay ) {
+					  
+	assert ( weights.matrices.size() == gradients.matrices.size() &&
+			 weights.matrices.size() == memory.matrices.size() &&
+			 weights.matrices.size() == origin.matrices.size() );
+			 
+	for ( size_t i = 0; i < weights.matrices.size(); i++ ) {
+	
+		#ifdef __CUDA_MATRIX__
+	
+		cu_elementwise_dynamic (	learning_rate, rho, decay,
+									weights.matrices[i].cu_data,
+									gradients.matrices[i].cu_data,
+									memory.matrices[i].cu_data,
+									origin.matrices[i].cu_data,
+									weights.matrices[i].size() );
+									
+		#else
+									
+		T &p = weights.matrices[i], &d = gradients.matrices[i], &m = memory.matrices[i], &p0 = origin.matrices[i];
+		
+		for ( size_t j = 0; j < p.size(); j++ ) {
+		
+			dtype clipped = _max ( _min ( d ( j ), 1 ), -1 );
+			
+			m ( j ) = rho * m ( j ) + ( 1 - rho ) * clipped * clipped;
+			p ( j ) += decay * ( p0 ( j ) - p ( j ) ) - learning_rate * clipped / _sqrt ( m ( j ) + ( dtype ) 1e-4 );
+			
+		}
+		
+		#endif
+		
+	}
+	
+}
+
 template<typename T>
 void adagrad ( Parameters<T> &weights, Parameters<T> &gradients, Parameters<T> &memory,
 			   const dtype learning_rate ) {
@@ -0,0 +1,369 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Scoring many strings which share prefixes
+ *
+ * The strings are merged into a trie of tokens; every node is
+ * fed once, from the state its parent left, and gives the
+ * probabilities of all of its children (one row), so a shared
+ * prefix costs as much as a single string. Nodes from any depth
+ * and any branch are batched into one B-wide single-step forward
+ * (DeepLSTM::inference_mode), the carried state of each row is
+ * loaded from and stored into host buffers (load_rows /
+ * store_rows).
+ *
+ * States live in an LRU cache with a memory limit, a state is
+ * dropped as soon as all children of its node have been fed;
+ * the trie is walked depth-first, so the working set is about
+ * B x depth states. If a state was evicted, its node is fed
+ * again (recomputed) from the nearest ancestor still cached.
+ *
+ * Like test (), the first token of a string is only fed; the
+ * score is -log2 p of the others. With a class-factored output
+ * a row is evaluated at one target, so every child takes a row.
+ *
+ */
+
+#ifndef __PREFIX_H__
+#define __PREFIX_H__
+
+#include <vector>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <math.h>
+
+#include <deeplstm.h>
+#include <timer.h>
+
+/* node id -> carried state, least recently used evicted first */
+class StateCache {
+
+	public:
+	
+		StateCache ( size_t _capacity ) : capacity ( _capacity ) { }
+		
+		dtype *find ( size_t node ) {
+		
+			auto i = index.find ( node );
+			
+			if ( i == index.end() ) {
+			
+				misses++;
+				return nullptr;
+				
+			}
+			
+			hits++;
+			entries.splice ( entries.begin(), entries, i->second );
+			return i->second->second.data();
+			
+		}
+		
+		dtype *insert ( size_t node, size_t size ) {
+		
+			while ( entries.size() > 0 && entries.size() >= capacity ) {
+			
+				index.erase ( entries.back().first );
+				entries.pop_back();
+				evictions++;
+				
+			}
+			
+			entries.emplace_front ( node, std::vector<dtype> ( size ) );
+			index[node] = entries.begin();
+			return entries.front().second.data();
+			
+		}
+		
+		bool contains ( size_t node ) const { return index.count ( node ) > 0; }
+		
+		void erase ( size_t node ) {
+		
+			auto i = index.find ( node );
+			
+			if ( i == index.end() ) return;
+			
+			entries.erase ( i->second );
+			index.erase ( i );
+			
+		}
+		
+		const size_t capacity;
+		size_t hits = 0, misses = 0, evictions = 0;
+		
+	protected:
+	
+		std::list<std::pair<size_t, std::vector<dtype>>> entries;
+		std::unordered_map<size_t, std::list<std::pair<size_t, std::vector<dtype>>>::iterator> index;
+		
+};
+
+template <typename T>
+class PrefixScorer {
+
+	public:
+	
+		/* net - single-step batch, B rows; memory_limit - bytes of cached states */
+		PrefixScorer ( DeepLSTM<T> &_net, size_t _memory_limit = ( size_t ) 256 << 20 ) : net ( _net ),
+			memory_limit ( _memory_limit ), x ( _net.B, _net.M ) { }
+			
+		/* -log2 p of every string but its first token */
+		std::vector<double> score ( const std::vector<std::vector<size_t>> &strings ) {
+		
+			Timer timer;
+			timer.start();
+			
+			build ( strings );
+			
+			size_t state_size = net.state_size();
+			
+			// a state stored in one step is still there when its children are batched
+			StateCache cache ( std::max ( memory_limit / ( state_size * sizeof ( dtype ) ), 2 * net.B + 1 ) );
+			
+			// depth-first, the top is run first
+			std::vector<Item> stack;
+			
+			for ( size_t c : nodes[0].children )
+				push ( stack, c );
+				
+			steps = rows = recomputed = 0;
+			
+			while ( stack.size() > 0 ) {
+			
+				std::vector<Item> batch, deferred;
+				std::vector<const dtype *> in;
+				
+				while ( stack.size() > 0 && batch.size() < net.B ) {
+				
+					Item item = stack.back();
+					stack.pop_back();
+					
+					size_t parent = nodes[item.node].parent;
+					dtype *state = parent == 0 ? nullptr : cache.find ( parent );
+					
+					if ( parent == 0 || state ) {
+					
+						batch.push_back ( item );
+						in.push_back ( state );
+						
+					} else {
+					
+						// evicted, feed the parent again first
+						deferred.push_back ( item );
+						
+						if ( !nodes[parent].recomputing ) {
+						
+							nodes[parent].recomputing = true;
+							stack.push_back ( Item { parent, 0, 0, true } );
+							recomputed++;
+							
+						}
+						
+					}
+					
+				}
+				
+				stack.insert ( stack.end(), deferred.rbegin(), deferred.rend() );
+				
+				if ( batch.empty() ) continue;
+				
+				step ( batch, in, cache, state_size, stack );
+				
+			}
+			
+			std::vector<double> bits ( strings.size(), 0 );
+			
+			for ( size_t n = 0; n < nodes.size(); n++ )
+				for ( size_t k : nodes[n].ends )
+					bits[k] = nodes[n].bits;
+					
+			seconds = timer.end();
+			hits = cache.hits;
+			misses = cache.misses;
+			evictions = cache.evictions;
+			
+			return bits;
+			
+		}
+		
+		/* bytes */
+		std::vector<double> score ( const std::vector<std::string> &strings ) {
+		
+			std::vector<std::vector<size_t>> tokens ( strings.size() );
+			
+			for ( size_t k = 0; k < strings.size(); k++ )
+				for ( char c : strings[k] )
+					tokens[k].push_back ( ( unsigned char ) c );
+					
+			return score ( tokens );
+			
+		}
+		
+		// of the last score (): trie nodes, tokens in the strings, forward steps, rows fed
+		size_t trie_nodes = 0, tokens = 0, steps = 0, rows = 0;
+		
+		// nodes fed again, cache lookups / evictions
+		size_t recomputed = 0, hits = 0, misses = 0, evictions = 0;
+		double seconds = 0;
+		
+	protected:
+	
+		typedef struct {
+		
+			size_t token = 0, parent = 0;
+			std::vector<size_t> children;
+			
+			// -log2 p of the path, strings ending here
+			double bits = 0;
+			std::vector<size_t> ends;
+			
+			// items of the children that still need this state
+			size_t waiting = 0;
+			bool recomputing = false;
+			
+		} Node;
+		
+		/* feed node, score children [first, first + count); recompute - only its state is needed */
+		typedef struct {
+		
+			size_t node, first, count;
+			bool recompute;
+			
+		} Item;
+		
+		void build ( const std::vector<std::vector<size_t>> &strings ) {
+		
+			nodes.assign ( 1, Node() );
+			std::map<std::pair<size_t, size_t>, size_t> edges;
+			
+			tokens = 0;
+			
+			for ( size_t k = 0; k < strings.size(); k++ ) {
+			
+				size_t n = 0;
+				
+				for ( size_t token : strings[k] ) {
+				
+					auto edge = edges.find ( std::make_pair ( n, token ) );
+					
+					if ( edge != edges.end() ) n = edge->second;
+					else {
+					
+						nodes.push_back ( Node() );
+						nodes.back().token = token;
+						nodes.back().parent = n;
+						nodes[n].children.push_back ( nodes.size() - 1 );
+						edges[std::make_pair ( n, token )] = nodes.size() - 1;
+						n = nodes.size() - 1;
+						
+					}
+					
+				}
+				
+				nodes[n].ends.push_back ( k );
+				tokens += strings[k].size();
+				
+			}
+			
+			trie_nodes = nodes.size() - 1;
+			
+			for ( size_t n = 1; n < nodes.size(); n++ )
+				if ( nodes[n].children.size() > 0 ) nodes[nodes[n].parent].waiting += items ( n );
+				
+		}
+		
+		/* rows needed to feed node n and score its children */
+		size_t items ( size_t n ) { return net.classlayer ? nodes[n].children.size() : 1; }
+		
+		void push ( std::vector<Item> &stack, size_t n ) {
+		
+			if ( nodes[n].children.empty() ) return;
+			
+			if ( net.classlayer )
+				for ( size_t j = nodes[n].children.size(); j > 0; j-- )
+					stack.push_back ( Item { n, j - 1, 1, false } );
+			else
+				stack.push_back ( Item { n, 0, nodes[n].children.size(), false } );
+				
+		}
+		
+		void step ( const std::vector<Item> &batch, const std::vector<const dtype *> &in, StateCache &cache,
+					size_t state_size, std::vector<Item> &stack ) {
+					
+			std::vector<size_t> fed, kept;
+			std::vector<dtype *> out;
+			
+			x.setZero();
+			
+			for ( size_t r = 0; r < batch.size(); r++ ) {
+			
+				const Node &node = nodes[batch[r].node];
+				
+				fed.push_back ( r );
+				set_row_one_hot ( x, r, node.token );
+				
+				if ( net.classlayer ) net.set_target ( r, batch[r].count > 0 ? nodes[node.children[batch[r].first]].token : 0 );
+				
+			}
+			
+			net.load_rows ( fed, in );
+			net.forward ( false, x );
+			
+			steps++;
+			rows += batch.size();
+			
+			// states the children will start from
+			for ( size_t r = 0; r < batch.size(); r++ ) {
+			
+				size_t n = batch[r].node;
+				
+				if ( ( nodes[n].waiting > 0 || batch[r].recompute ) && !cache.contains ( n ) ) {
+				
+					kept.push_back ( r );
+					out.push_back ( cache.insert ( n, state_size ) );
+					
+				}
+				
+			}
+			
+			if ( kept.size() > 0 ) net.store_rows ( kept, out );
+			
+			for ( size_t r = 0; r < batch.size(); r++ ) {
+			
+				const Item &item = batch[r];
+				Node &node = nodes[item.node];
+				
+				if ( item.recompute ) {
+				
+					node.recomputing = false;
+					continue;
+					
+				}
+				
+				for ( size_t j = item.first; j < item.first + item.count; j++ ) {
+				
+					Node &child = nodes[node.children[j]];
+					child.bits = node.bits - log2 ( net.probability ( r, child.token ) );
+					push ( stack, node.children[j] );
+					
+				}
+				
+				// the parent's state is not needed any more
+				if ( node.parent > 0 && --nodes[node.parent].waiting == 0 ) cache.erase ( node.parent );
+				
+			}
+			
+		}
+		
+		DeepLSTM<T> &net;
+		size_t memory_limit;
+		
+		T x;
+		std::vector<Node> nodes;
+		
+};
+
+#endif /* __PREFIX_H__ */
@@ -0,0 +1,138 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Drawing a token from a row of output probabilities
+ *
+ * Temperature first (p ^ ( 1 / temperature ), temperature 0 is
+ * argmax), then top-k and top-p (nucleus) truncation, then a
+ * single inverse-CDF draw. The distribution is different at
+ * every step, so the prefix sums are not stored (an alias
+ * table only pays off for many draws from one distribution):
+ * one pass for the total, one for the draw.
+ *
+ * Keeps scratch space between calls, one Sampler per thread.
+ *
+ */
+
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include <containers/datatype.h>
+
+class Sampler {
+
+	public:
+	
+		Sampler ( dtype _temperature = 1.0, size_t _top_k = 0, dtype _top_p = 1.0 ) :
+			temperature ( _temperature ), top_k ( _top_k ), top_p ( _top_p ) { }
+			
+		bool greedy() const { return temperature <= 0; }
+		
+		/* token drawn from row of probs, r uniform in ( 0, 1 ] */
+		template <typename T>
+		size_t draw ( T &probs, size_t row, dtype r ) {
+		
+			size_t M = probs.cols();
+			size_t best = 0;
+			
+			for ( size_t k = 1; k < M; k++ )
+				if ( probs ( row, k ) > probs ( row, best ) ) best = k;
+				
+			if ( greedy() ) return best;
+			
+			// relative to the largest, so that small temperatures do not underflow
+			weights.resize ( M );
+			dtype largest = probs ( row, best );
+			
+			for ( size_t k = 0; k < M; k++ )
+				weights[k] = temperature == 1 ? probs ( row, k ) : powf ( probs ( row, k ) / largest, 1 / temperature );
+				
+			bool truncated = ( top_k > 0 && top_k < M ) || top_p < 1;
+			
+			if ( !truncated ) return scan ( r, M, [&] ( size_t k ) { return k; } );
+			
+			candidates.resize ( M );
+			
+			for ( size_t k = 0; k < M; k++ )
+				candidates[k] = k;
+				
+			auto heavier = [&] ( size_t a, size_t b ) { return weights[a] > weights[b]; };
+			
+			size_t kept = M;
+			
+			if ( top_k > 0 && top_k < M ) {
+			
+				std::nth_element ( candidates.begin(), candidates.begin() + top_k - 1, candidates.end(), heavier );
+				kept = top_k;
+				
+			}
+			
+			if ( top_p < 1 ) {
+			
+				std::sort ( candidates.begin(), candidates.begin() + kept, heavier );
+				
+				dtype total = 0, mass = 0;
+				
+				for ( size_t j = 0; j < kept; j++ )
+					total += weights[candidates[j]];
+					
+				size_t j = 0;
+				
+				// smallest prefix holding top_p of the mass
+				while ( j < kept ) {
+				
+					mass += weights[candidates[j++]];
+					
+					if ( mass >= top_p * total ) break;
+					
+				}
+				
+				kept = j;
+				
+			}
+			
+			return scan ( r, kept, [&] ( size_t j ) { return candidates[j]; } );
+			
+		}
+		
+		dtype temperature;
+		size_t top_k;
+		dtype top_p;
+		
+	protected:
+	
+		/* inverse CDF over weights[token ( j )], j < n */
+		template <typename F>
+		size_t scan ( dtype r, size_t n, const F &token ) {
+		
+			dtype total = 0;
+			
+			for ( size_t j = 0; j < n; j++ )
+				total += weights[token ( j )];
+				
+			dtype threshold = r * total, cdf = 0;
+			
+			for ( size_t j = 0; j < n; j++ ) {
+			
+				dtype w = weights[token ( j )];
+				cdf += w;
+				
+				if ( w > 0 && threshold <= cdf ) return token ( j );
+				
+			}
+			
+			return token ( n - 1 );
+			
+		}
+		
+		std::vector<dtype> weights;
+		std::vector<size_t> candidates;
+		
+};
+
+#endif /* __SAMPLER_H__ */
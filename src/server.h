@@ -0,0 +1,503 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Inference server over a Unix domain socket
+ *
+ * One thread per connection parses requests and queues them;
+ * the scheduler (the thread calling run(), which owns the GPU)
+ * keeps up to B streams in the rows of a single-step batch and
+ * between steps drops finished streams and starts queued ones
+ * in the free rows (continuous batching), so a long request
+ * does not hold back short ones. Free rows get an empty input.
+ *
+ * Requests, one header line, then the payload:
+ *
+ *   score <bytes>\n<text>
+ *     -> ok <bits> <bits per byte>\n   (all but the first token)
+ *
+ *   generate <tokens> <temperature> <top_k> <top_p> <bytes>\n<prompt>
+ *     -> ok <bytes>\n<continuation>
+ *
+ *   stats\n
+ *     -> ok <requests, latency percentiles, throughput>\n
+ *
+ * Errors are reported as "error <message>\n"; after a malformed
+ * header, or a payload over max_payload bytes, the payload is
+ * not read, so the connection is closed.
+ *
+ */
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <sstream>
+#include <algorithm>
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <deeplstm.h>
+#include <sampler.h>
+#include <containers/bpe.h>
+#include <timer.h>
+#include <utils.h>
+
+template <typename T>
+class Server {
+
+	public:
+	
+		/* net - single-step batch, B rows (see DeepLSTM::inference_mode) */
+		Server ( DeepLSTM<T> &_net, const BPE &_bpe ) : net ( _net ), bpe ( _bpe ), rows ( _net.B ), x ( _net.B, _net.M ) { }
+		
+		/* listens on path, serves until the process is stopped */
+		bool run ( const std::string &path ) {
+		
+			int fd = socket ( AF_UNIX, SOCK_STREAM, 0 );
+			
+			struct sockaddr_un address;
+			memset ( &address, 0, sizeof ( address ) );
+			address.sun_family = AF_UNIX;
+			strncpy ( address.sun_path, path.c_str(), sizeof ( address.sun_path ) - 1 );
+			
+			unlink ( path.c_str() );
+			
+			if ( fd < 0 || bind ( fd, ( struct sockaddr * ) &address, sizeof ( address ) ) != 0 || listen ( fd, 64 ) != 0 ) {
+			
+				std::cout << "socket error: (" << path << ")" << std::endl;
+				return false;
+				
+			}
+			
+			std::cout << "Serving on " << path << ", " << rows.size() << " streams" << std::endl;
+			
+			std::thread ( [this, fd] {
+			
+				while ( true ) {
+				
+					int connection = accept ( fd, NULL, NULL );
+					
+					if ( connection >= 0 ) std::thread ( &Server::serve, this, connection ).detach();
+					
+				}
+				
+			} ).detach();
+			
+			uptime.start();
+			schedule();
+			
+			return true;
+			
+		}
+		
+		/* largest text to score or prompt, in bytes */
+		static const size_t max_payload = ( size_t ) 16 << 20;
+		
+		// a longer header line closes the connection
+		static const size_t max_header = 4096;
+		
+	protected:
+	
+		typedef enum { SCORE, GENERATE, STATS } Kind;
+		
+		typedef struct {
+		
+			Kind kind;
+			
+			// text to score or the prompt
+			std::vector<size_t> tokens;
+			
+			size_t length;
+			Sampler sampler;
+			
+			std::promise<std::string> reply;
+			Timer timer;
+			
+		} Request;
+		
+		/* a stream in row b */
+		typedef struct {
+		
+			std::unique_ptr<Request> request;
+			
+			size_t position;
+			double bits;
+			std::vector<size_t> generated;
+			philox_key key;
+			
+		} Row;
+		
+		/* connection thread */
+		void serve ( int fd ) {
+		
+			std::string header;
+			
+			while ( read_line ( fd, header ) ) {
+			
+				std::unique_ptr<Request> request ( new Request() );
+				std::stringstream fields ( header );
+				std::string command, payload, error;
+				size_t bytes = 0;
+				
+				fields >> command;
+				
+				if ( command == "score" ) {
+				
+					request->kind = SCORE;
+					read_bytes ( fields, bytes );
+					
+				} else if ( command == "generate" ) {
+				
+					request->kind = GENERATE;
+					fields >> request->length >> request->sampler.temperature >> request->sampler.top_k >> request->sampler.top_p;
+					read_bytes ( fields, bytes );
+					
+				} else if ( command == "stats" ) request->kind = STATS;
+				
+				else error = "unknown command";
+				
+				if ( !fields ) error = "bad header";
+				
+				else if ( bytes > max_payload ) error = "payload over " + std::to_string ( max_payload ) + " bytes";
+				
+				// the payload length is unknown, the next header cannot be found
+				if ( error.length() > 0 ) {
+				
+					write_all ( fd, "error " + error + "\n" );
+					break;
+					
+				}
+				
+				payload.resize ( bytes );
+				
+				if ( bytes > 0 && !read_exact ( fd, &payload[0], bytes ) ) break;
+				
+				if ( request->kind != STATS ) request->tokens = tokenize ( payload );
+				
+				if ( error.empty() && request->kind == SCORE && request->tokens.size() < 2 ) error = "nothing to score";
+				
+				if ( error.empty() && request->kind == GENERATE && request->length == 0 ) error = "nothing to generate";
+				
+				if ( request->kind == GENERATE && request->tokens.empty() ) request->tokens.push_back ( ' ' );
+				
+				if ( error.length() > 0 ) {
+				
+					if ( !write_all ( fd, "error " + error + "\n" ) ) break;
+					
+					continue;
+					
+				}
+				
+				std::future<std::string> reply = request->reply.get_future();
+				request->timer.start();
+				
+				{
+					std::lock_guard<std::mutex> lock ( mtx );
+					queue.push_back ( std::move ( request ) );
+				}
+				
+				arrived.notify_one();
+				
+				if ( !write_all ( fd, reply.get() ) ) break;
+				
+			}
+			
+			close ( fd );
+			
+		}
+		
+		/* scheduler, one batched step per iteration */
+		void schedule() {
+		
+			while ( true ) {
+			
+				std::vector<size_t> joined;
+				
+				{
+					std::unique_lock<std::mutex> lock ( mtx );
+					
+					if ( active == 0 )
+						arrived.wait ( lock, [&] { return !queue.empty(); } );
+						
+					while ( !queue.empty() ) {
+					
+						size_t b = 0;
+						
+						while ( b < rows.size() && rows[b].request ) b++;
+						
+						if ( b == rows.size() && queue.front()->kind != STATS ) break;
+						
+						std::unique_ptr<Request> request = std::move ( queue.front() );
+						queue.pop_front();
+						
+						if ( request->kind == STATS ) {
+						
+							request->reply.set_value ( "ok " + stats() + "\n" );
+							continue;
+							
+						}
+						
+						rows[b].request = std::move ( request );
+						rows[b].position = 0;
+						rows[b].bits = 0;
+						rows[b].generated.clear();
+						rows[b].key = next_host_key();
+						
+						joined.push_back ( b );
+						active++;
+						
+					}
+					
+				}
+				
+				if ( active == 0 ) continue;
+				
+				if ( joined.size() > 0 ) net.reset_rows ( joined );
+				
+				step();
+				
+			}
+			
+		}
+		
+		void step() {
+		
+			x.setZero();
+			
+			for ( size_t b = 0; b < rows.size(); b++ ) {
+			
+				if ( !rows[b].request ) continue;
+				
+				set_row_one_hot ( x, b, input ( rows[b] ) );
+				
+				if ( rows[b].request->kind == SCORE ) net.set_target ( b, rows[b].request->tokens[rows[b].position + 1] );
+				
+			}
+			
+			net.forward ( false, x );
+			net.carryContext ( 1 );
+			
+			steps++;
+			filled += active;
+			
+			for ( size_t b = 0; b < rows.size(); b++ ) {
+			
+				Row &row = rows[b];
+				
+				if ( !row.request ) continue;
+				
+				Request &request = *row.request;
+				size_t i = row.position++;
+				bool finished = false;
+				
+				if ( request.kind == SCORE ) {
+				
+					row.bits += -log2 ( net.probability ( b, request.tokens[i + 1] ) );
+					finished = i + 2 == request.tokens.size();
+					
+				} else if ( i + 1 >= request.tokens.size() ) {
+				
+					// past the prompt
+					philox_out r = philox4x32 ( row.key, i );
+					
+					if ( net.classlayer )
+						row.generated.push_back ( net.classlayer->draw ( 1, b, philox_u01 ( r.x[0] ), philox_u01 ( r.x[1] ),
+												  request.sampler.temperature ) );
+					else
+						row.generated.push_back ( request.sampler.draw ( net.outputlayer->s[1]['p'], b, philox_u01 ( r.x[0] ) ) );
+						
+					finished = row.generated.size() >= request.length;
+					
+				}
+				
+				if ( finished ) finish ( row );
+				
+			}
+			
+		}
+		
+		/* token fed to a row at its position */
+		size_t input ( Row &row ) {
+		
+			std::vector<size_t> &tokens = row.request->tokens;
+			return row.position < tokens.size() ? tokens[row.position] : row.generated[row.position - tokens.size()];
+			
+		}
+		
+		void finish ( Row &row ) {
+		
+			Request &request = *row.request;
+			std::string reply;
+			
+			if ( request.kind == SCORE ) {
+			
+				// bytes after the first token
+				size_t bytes = bpe.decode ( request.tokens ).size() - bpe.decode ( std::vector<size_t> ( 1, request.tokens[0] ) ).size();
+				reply = "ok " + to_string_with_precision ( row.bits, 3 ) + " " + to_string_with_precision ( row.bits / std::max<size_t> ( 1,
+						bytes ), 4 ) + "\n";
+						
+			} else {
+			
+				std::string text = bpe.decode ( row.generated );
+				reply = "ok " + std::to_string ( text.size() ) + "\n" + text;
+				
+			}
+			
+			latencies.push_back ( request.timer.end() );
+			completed++;
+			
+			request.reply.set_value ( reply );
+			row.request.reset();
+			active--;
+			
+			if ( completed % 100 == 0 ) std::cout << stats() << std::endl;
+			
+		}
+		
+		/* over the last 10000 requests */
+		std::string stats() {
+		
+			if ( latencies.size() > 10000 ) latencies.erase ( latencies.begin(), latencies.end() - 10000 );
+			
+			std::vector<double> sorted ( latencies );
+			std::sort ( sorted.begin(), sorted.end() );
+			
+			auto percentile = [&] ( double q ) {
+			
+				return sorted.empty() ? 0.0 : 1000 * sorted[std::min ( sorted.size() - 1, ( size_t ) ( q * sorted.size() ) )];
+				
+			};
+			
+			double seconds = uptime.end();
+			
+			return "requests " + std::to_string ( completed ) +
+				   ", latency p50 " + to_string_with_precision ( percentile ( 0.50 ), 1 ) +
+				   " ms, p90 " + to_string_with_precision ( percentile ( 0.90 ), 1 ) +
+				   " ms, p99 " + to_string_with_precision ( percentile ( 0.99 ), 1 ) +
+				   " ms, " + to_string_with_precision ( completed / seconds, 1 ) + " requests/s, " +
+				   to_string_with_precision ( filled / seconds, 0 ) + " tokens/s, " +
+				   to_string_with_precision ( steps > 0 ? ( double ) filled / steps : 0.0, 1 ) + "/" + std::to_string ( rows.size() ) +
+				   " rows busy";
+				
+		}
+		
+		std::vector<size_t> tokenize ( const std::string &text ) {
+		
+			std::vector<size_t> tokens;
+			
+			if ( bpe.size() > 256 && text.size() > 0 ) {
+			
+				Corpus encoded = bpe.encode ( Corpus ( std::make_shared<Shards> ( std::vector<uint8_t> ( text.begin(), text.end() ) ) ) );
+				
+				for ( size_t i = 0; i < encoded.size(); i++ )
+					tokens.push_back ( encoded[i] );
+					
+			} else
+			
+				for ( char c : text )
+					tokens.push_back ( ( unsigned char ) c );
+					
+			return tokens;
+			
+		}
+		
+		static bool read_line ( int fd, std::string &line ) {
+		
+			line.clear();
+			char c;
+			
+			while ( read ( fd, &c, 1 ) == 1 ) {
+			
+				if ( c == '\n' ) return true;
+				
+				if ( line.size() == max_header ) return false;
+				
+				line += c;
+				
+			}
+			
+			return false;
+			
+		}
+		
+		/* a payload length, digits only (no sign), fields fails otherwise */
+		static void read_bytes ( std::stringstream &fields, size_t &bytes ) {
+		
+			std::string digits;
+			fields >> digits;
+			
+			// more than 19 digits may not fit in size_t, and is over max_payload anyway
+			if ( digits.empty() || digits.find_first_not_of ( "0123456789" ) != std::string::npos ) fields.setstate (
+					std::ios::failbit );
+			else bytes = digits.size() > 19 ? max_payload + 1 : std::stoull ( digits );
+			
+		}
+		
+		static bool read_exact ( int fd, char *data, size_t bytes ) {
+		
+			while ( bytes > 0 ) {
+			
+				ssize_t n = read ( fd, data, bytes );
+				
+				if ( n <= 0 ) return false;
+				
+				data += n;
+				bytes -= n;
+				
+			}
+			
+			return true;
+			
+		}
+		
+		static bool write_all ( int fd, const std::string &data ) {
+		
+			size_t done = 0;
+			
+			while ( done < data.size() ) {
+			
+				// a client that went away must not raise SIGPIPE in the server
+				ssize_t n = send ( fd, data.data() + done, data.size() - done, MSG_NOSIGNAL );
+				
+				if ( n <= 0 ) return false;
+				
+				done += n;
+				
+			}
+			
+			return true;
+			
+		}
+		
+		DeepLSTM<T> &net;
+		const BPE &bpe;
+		
+		std::vector<Row> rows;
+		size_t active = 0;
+		T x;
+		
+		std::deque<std::unique_ptr<Request>> queue;
+		std::mutex mtx;
+		std::condition_variable arrived;
+		
+		// statistics, scheduler thread only
+		std::vector<double> latencies;
+		size_t completed = 0, steps = 0;
+		
+		// row-steps of active streams, i.e. tokens
+		size_t filled = 0;
+		Timer uptime;
+		
+};
+
+#endif /* __SERVER_H__ */
@@ -0,0 +1,308 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Long-lived streams on one model
+ *
+ * A session is one stream: the carried state of every LSTM
+ * layer (h, c, DeepLSTM::state_size () values) and the number
+ * of tokens it has been fed. Any number of sessions share a
+ * single-step batch of B rows (DeepLSTM::inference_mode); a
+ * step takes up to B of them. A session stepped again stays in
+ * its row (its state never leaves the device), one that was
+ * not stepped is parked, i.e. only its carried rows are copied
+ * out (store_rows), and a parked one is loaded into a free row
+ * (load_rows). Nothing else of the net is copied.
+ *
+ * snapshot () / restore () turn a session into bytes and back:
+ * header, position, state (dtype, host byte order).
+ *
+ */
+
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <string.h>
+#include <stdint.h>
+
+#include <deeplstm.h>
+#include <sampler.h>
+
+#define SESSION_MAGIC 0x5353534cu
+#define SESSION_VERSION 1
+
+typedef struct {
+
+	uint32_t magic = SESSION_MAGIC;
+	uint32_t version = SESSION_VERSION;
+	uint32_t dtype_size = sizeof ( dtype );
+	uint32_t reserved = 0;
+	
+	uint64_t values = 0, position = 0;
+	
+} SessionHeader;
+
+typedef struct {
+
+	std::vector<dtype> state;
+	size_t position = 0;
+	
+	// row of the batch, -1 if parked (state holds the current values)
+	int row = -1;
+	
+} Session;
+
+template <typename T>
+class Sessions {
+
+	public:
+	
+		/* net - single-step batch, B rows */
+		Sessions ( DeepLSTM<T> &_net ) : net ( _net ), x ( _net.B, _net.M ), residents ( _net.B, 0 ) { }
+		
+		/* a new stream from the zero state, ids start at 1 */
+		size_t open() {
+		
+			Session &session = sessions[next_id];
+			session.state.assign ( net.state_size(), 0 );
+			
+			return next_id++;
+			
+		}
+		
+		void close ( size_t id ) {
+		
+			auto i = sessions.find ( id );
+			
+			if ( i == sessions.end() ) return;
+			
+			if ( i->second.row >= 0 ) residents[i->second.row] = 0;
+			
+			sessions.erase ( i );
+			
+		}
+		
+		bool exists ( size_t id ) const { return sessions.count ( id ) > 0; }
+		
+		size_t position ( size_t id ) const { return sessions.at ( id ).position; }
+		
+		/*
+			feeds tokens[k] to session ids[k] (at most B, distinct);
+			targets[k] - the token to evaluate with a class-factored
+			output, see probability ()
+		*/
+		bool step ( const std::vector<size_t> &ids, const std::vector<size_t> &tokens,
+					const std::vector<size_t> &targets = {} ) {
+					
+			// the rows of the net are the rows of the sessions, S = 2
+			if ( !net.in_inference_mode() || net.B != residents.size() ) {
+			
+				std::cout << "Sessions::step() : the net should be in inference mode with B = " << residents.size() << std::endl;
+				return false;
+				
+			}
+			
+			std::set<size_t> distinct ( ids.begin(), ids.end() );
+			
+			if ( ids.size() > net.B || distinct.size() != ids.size() || tokens.size() != ids.size() ||
+					( targets.size() > 0 && targets.size() != ids.size() ) ) {
+					
+				std::cout << "Sessions::step() : at most " << net.B << " distinct sessions, one token each" << std::endl;
+				return false;
+				
+			}
+			
+			for ( size_t k = 0; k < ids.size(); k++ ) {
+			
+				if ( !exists ( ids[k] ) || tokens[k] >= net.M ) {
+				
+					std::cout << "Sessions::step() : no session " << ids[k] << " or bad token " << tokens[k] << std::endl;
+					return false;
+					
+				}
+				
+			}
+			
+			std::vector<bool> stepping ( net.B, false );
+			
+			for ( size_t id : ids )
+				if ( sessions[id].row >= 0 ) stepping[sessions[id].row] = true;
+				
+			// the others would be advanced by an empty input
+			std::vector<size_t> rows;
+			
+			for ( size_t r = 0; r < net.B; r++ )
+				if ( residents[r] > 0 && !stepping[r] ) rows.push_back ( r );
+				
+			park ( rows );
+			
+			std::vector<size_t> loaded;
+			std::vector<const dtype *> in;
+			size_t r = 0;
+			
+			for ( size_t id : ids ) {
+			
+				Session &session = sessions[id];
+				
+				if ( session.row >= 0 ) continue;
+				
+				while ( residents[r] > 0 ) r++;
+				
+				session.row = r;
+				residents[r] = id;
+				loaded.push_back ( r );
+				in.push_back ( session.state.data() );
+				
+			}
+			
+			if ( loaded.size() > 0 ) net.load_rows ( loaded, in );
+			
+			loads += loaded.size();
+			
+			x.setZero();
+			
+			for ( size_t k = 0; k < ids.size(); k++ ) {
+			
+				Session &session = sessions[ids[k]];
+				
+				set_row_one_hot ( x, session.row, tokens[k] );
+				
+				if ( targets.size() > 0 ) net.set_target ( session.row, targets[k] );
+				
+				session.position++;
+				
+			}
+			
+			net.forward ( false, x );
+			net.carryContext ( 1 );
+			
+			return true;
+			
+		}
+		
+		/*
+			p ( token ) after the last step of id (class-factored output:
+			token = its target); false if id was not in that step, its
+			row may hold another session's output by now
+		*/
+		bool probability ( size_t id, size_t token, dtype &p ) {
+		
+			if ( !stepped ( id, "probability" ) ) return false;
+			
+			p = net.probability ( sessions[id].row, token );
+			return true;
+			
+		}
+		
+		/* next token after the last step of id, r uniform in ( 0, 1 ]; full softmax */
+		bool draw ( size_t id, Sampler &sampler, dtype r, size_t &token ) {
+		
+			if ( !stepped ( id, "draw" ) ) return false;
+			
+			token = sampler.draw ( net.outputlayer->s[1]['p'], sessions[id].row, r );
+			return true;
+			
+		}
+		
+		/* the session as bytes, it stays open */
+		std::vector<uint8_t> snapshot ( size_t id ) {
+		
+			Session &session = sessions.at ( id );
+			
+			if ( session.row >= 0 ) {
+			
+				std::vector<dtype *> out ( 1, session.state.data() );
+				net.store_rows ( std::vector<size_t> ( 1, session.row ), out, 0 );
+				
+			}
+			
+			SessionHeader header;
+			header.values = session.state.size();
+			header.position = session.position;
+			
+			std::vector<uint8_t> bytes ( sizeof ( header ) + session.state.size() * sizeof ( dtype ) );
+			memcpy ( &bytes[0], &header, sizeof ( header ) );
+			memcpy ( &bytes[sizeof ( header )], session.state.data(), session.state.size() * sizeof ( dtype ) );
+			
+			return bytes;
+			
+		}
+		
+		/* a new session from snapshot () bytes, 0 if they do not fit this net */
+		size_t restore ( const std::vector<uint8_t> &bytes ) {
+		
+			SessionHeader header, expected;
+			size_t values = net.state_size();
+			
+			if ( bytes.size() >= sizeof ( header ) ) memcpy ( &header, &bytes[0], sizeof ( header ) );
+			
+			if ( bytes.size() != sizeof ( header ) + values * sizeof ( dtype ) || header.magic != expected.magic ||
+					header.version != expected.version || header.dtype_size != expected.dtype_size || header.values != values ) {
+					
+				std::cout << "Sessions::restore() : not a session of this net" << std::endl;
+				return 0;
+				
+			}
+			
+			size_t id = open();
+			Session &session = sessions[id];
+			
+			session.position = header.position;
+			memcpy ( session.state.data(), &bytes[sizeof ( header )], values * sizeof ( dtype ) );
+			
+			return id;
+			
+		}
+		
+		// rows copied in / out so far
+		size_t loads = 0, stores = 0;
+		
+	protected:
+	
+		/* true if id is resident, i.e. it was in the last step (step () parks all others) */
+		bool stepped ( size_t id, const char *caller ) {
+		
+			if ( exists ( id ) && sessions[id].row >= 0 ) return true;
+			
+			std::cout << "Sessions::" << caller << "() : session " << id << " was not in the last step" << std::endl;
+			return false;
+			
+		}
+		
+		/* copy the state of rows out to their sessions */
+		void park ( const std::vector<size_t> &rows ) {
+		
+			if ( rows.empty() ) return;
+			
+			std::vector<dtype *> out;
+			
+			for ( size_t r : rows ) {
+			
+				Session &session = sessions[residents[r]];
+				
+				out.push_back ( session.state.data() );
+				session.row = -1;
+				residents[r] = 0;
+				
+			}
+			
+			net.store_rows ( rows, out, 0 );
+			stores += rows.size();
+			
+		}
+		
+		DeepLSTM<T> &net;
+		T x;
+		
+		std::unordered_map<size_t, Session> sessions;
+		size_t next_id = 1;
+		
+		// session in each row, 0 - free
+		std::vector<size_t> residents;
+		
+};
+
+#endif /* __SESSION_H__ */
@@ -0,0 +1,190 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Out-of-core storage for forward states
+ *
+ * Every step t = 1 .. S - 1 gets a page-aligned region of a
+ * memory-mapped scratch file (unlinked right after mapping,
+ * so it goes away with the process). During backward an I/O
+ * thread faults the regions back in reverse order, at most
+ * 'depth' steps ahead of BPTT, and consumed steps are dropped
+ * from memory again.
+ *
+ */
+
+#ifndef __SPILL_H__
+#define __SPILL_H__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <timer.h>
+
+class Spill {
+
+	public:
+	
+		Spill ( std::string dir, size_t _steps, size_t bytes_per_step, size_t _depth = 8 ) :
+			steps ( _steps ), depth ( _depth ) {
+			
+			page = sysconf ( _SC_PAGESIZE );
+			stride = ( ( bytes_per_step + page - 1 ) / page ) * page;
+			
+			std::string path = dir + "/spill.XXXXXX";
+			std::vector<char> name ( path.begin(), path.end() );
+			name.push_back ( '\0' );
+			
+			int fd = mkstemp ( &name[0] );
+			
+			if ( fd < 0 ) {
+			
+				std::cout << "Spill() : mkstemp error (" << path << ")" << std::endl;
+				return;
+				
+			}
+			
+			unlink ( &name[0] );
+			
+			if ( ftruncate ( fd, steps * stride ) == 0 ) {
+			
+				void *ptr = mmap ( NULL, steps * stride, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+				
+				if ( ptr != MAP_FAILED ) base = ( char * ) ptr;
+				
+			}
+			
+			close ( fd );
+			
+			if ( base == nullptr )
+				std::cout << "Spill() : could not map " << steps * stride / ( 1 << 20 ) << " MB in " << dir <<
+						  std::endl;
+						
+		}
+		
+		~Spill() {
+		
+			join();
+			
+			if ( base != nullptr ) munmap ( base, steps * stride );
+			
+		}
+		
+		bool ok() { return base != nullptr; }
+		
+		size_t size() { return steps * stride; }
+		
+		/* host storage of step t */
+		char *at ( size_t t ) { return base + ( t - 1 ) * stride; }
+		
+		/* step t is complete, t - 1 has been consumed by forward ( t ) */
+		void store ( size_t t ) {
+		
+			if ( t > 1 ) drop ( t - 1 );
+			
+		}
+		
+		/* start faulting in from, from - 1, ..., 1 */
+		void prefetch ( size_t from ) {
+		
+			join();
+			
+			loaded = from + 1;
+			consumed = from + 1;
+			
+			if ( from > 0 ) io = std::thread ( &Spill::reader, this, from );
+			
+		}
+		
+		/* blocks until step t is resident */
+		void wait ( size_t t ) {
+		
+			std::unique_lock<std::mutex> lock ( mtx );
+			
+			if ( loaded > t ) {
+			
+				Timer timer;
+				timer.start();
+				
+				ready.wait ( lock, [&] { return loaded <= t; } );
+				
+				io_wait += timer.end();
+				
+			}
+			
+		}
+		
+		/* backward is done with step t */
+		void release ( size_t t ) {
+		
+			drop ( t );
+			
+			std::lock_guard<std::mutex> lock ( mtx );
+			consumed = t;
+			space.notify_one();
+			
+		}
+		
+		void join() {
+		
+			if ( io.joinable() ) io.join();
+			
+		}
+		
+		/* seconds backward spent waiting on the reader */
+		double io_wait = 0.0;
+		
+	protected:
+	
+		void reader ( size_t from ) {
+		
+			for ( size_t t = from; t > 0; t-- ) {
+			
+				{
+					std::unique_lock<std::mutex> lock ( mtx );
+					space.wait ( lock, [&] { return consumed <= t + depth; } );
+				}
+				
+				madvise ( at ( t ), stride, MADV_WILLNEED );
+				
+				// WILLNEED is only a hint, touch every page
+				volatile char sink = 0;
+				
+				for ( size_t i = 0; i < stride; i += page )
+					sink += at ( t ) [i];
+					
+				std::lock_guard<std::mutex> lock ( mtx );
+				loaded = t;
+				ready.notify_one();
+				
+			}
+			
+		}
+		
+		/* dirty pages stay in the page cache until written back */
+		void drop ( size_t t ) {
+		
+			madvise ( at ( t ), stride, MADV_DONTNEED );
+			
+		}
+		
+		char *base = nullptr;
+		size_t steps, stride, depth, page;
+		
+		std::thread io;
+		std::mutex mtx;
+		std::condition_variable ready, space;
+		
+		size_t loaded = 0, consumed = 0;
+		
+};
+
+#endif /* __SPILL_H__ */
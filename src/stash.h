@@ -0,0 +1,115 @@
+/*
+ *
+ * Author: Kamil Rocki
+ *
+ * Fixed-point stash of bounded forward states (device)
+ *
+ * Sigmoid and tanh outputs are in [0, 1] and [-1, 1], so they
+ * can be kept for backward as 8 or 16-bit fixed point instead
+ * of dtype: x -> round ( ( x - lo ) / ( hi - lo ) * ( 2^bits -
+ * 1 ) ), an error of at most ( hi - lo ) / 2^( bits + 1 ). Every
+ * step t = 1 .. steps gets a region of one device allocation,
+ * store ( t ) encodes the tensors of a State into it and load
+ * ( t ) decodes them back in place.
+ *
+ */
+
+#ifndef __STASH_H__
+#define __STASH_H__
+
+#include <iostream>
+#include <vector>
+
+#include <state.h>
+
+class Stash {
+
+	public:
+	
+		Stash ( size_t _steps, int _bits ) : steps ( _steps ), bits ( _bits ) { }
+		
+		~Stash() {
+		
+			if ( base != nullptr ) cudaFree ( base );
+			
+		}
+		
+		/* tensor i of the State, elements values; the first unit of them in [0, 1], the rest in [-1, 1] */
+		void add ( size_t i, size_t elements, size_t unit ) {
+		
+			tensors.push_back ( { i, elements, unit, stride } );
+			
+			// 256B aligned
+			stride += ( ( elements * bits / 8 + 255 ) / 256 ) * 256;
+			
+		}
+		
+		bool allocate() {
+		
+			if ( cudaMalloc ( ( void ** ) &base, steps * stride ) != cudaSuccess ) {
+			
+				std::cout << "Stash() : could not allocate " << size() / ( 1 << 20 ) << " MB" << std::endl;
+				base = nullptr;
+				
+			}
+			
+			return base != nullptr;
+			
+		}
+		
+		size_t size() { return steps * stride; }
+		
+		/* device storage of step t */
+		char *at ( size_t t ) { return base + ( t - 1 ) * stride; }
+		
+		/* the stashed tensors of s (on the device) -> step t */
+		template <typename T>
+		void store ( size_t t, State<T> &s ) {
+		
+			for ( auto &i : tensors ) {
+			
+				dtype *x = s.matrices[i.matrix].cu_data;
+				char *q = at ( t ) + i.offset;
+				
+				if ( i.unit > 0 ) cu_stash_encode ( q, x, i.unit, 0, 1, bits );
+				
+				if ( i.elements > i.unit ) cu_stash_encode ( q + i.unit * bits / 8, x + i.unit, i.elements - i.unit, -1, 1, bits );
+				
+			}
+			
+		}
+		
+		/* step t -> the stashed tensors of s */
+		template <typename T>
+		void load ( size_t t, State<T> &s ) {
+		
+			for ( auto &i : tensors ) {
+			
+				dtype *x = s.matrices[i.matrix].cu_data;
+				char *q = at ( t ) + i.offset;
+				
+				if ( i.unit > 0 ) cu_stash_decode ( x, q, i.unit, 0, 1, bits );
+				
+				if ( i.elements > i.unit ) cu_stash_decode ( x + i.unit, q + i.unit * bits / 8, i.elements - i.unit, -1, 1, bits );
+				
+			}
+			
+		}
+		
+		typedef struct {
+		
+			size_t matrix, elements, unit, offset;
+			
+		} Tensor;
+		
+		std::vector<Tensor> tensors;
+		
+	protected:
+	
+		char *base = nullptr;
+		size_t steps, stride = 0;
+		int bits;
+		
+};
+
+#endif /* __STASH_H__ */
@@ -8,6 +8,10 @@
 
 #include <state.h>
 #include <parameters.h>
+#include <spill.h>
+#include <stash.h>
+
+#include <memory>
 
 template <typename T>
 class Timelayer {
@@ -32,15 +36,43 @@ class Timelayer {
 			: M ( _M ), N ( _N ), S ( _S ), B ( _B ) {
 			
 			s.resize ( _S );
-			g.resize ( _S );
+			g.resize ( 2 );
+			
+			if ( spill_directory.length() > 0 && S > 2 ) {
+			
+				State<T> full ( M, N, B, name, state_definition, "s" );
+				spill_to_file ( full, name );
+				
+			} else if ( bptt_memory_budget > 0 ) {
+			
+				State<T> full ( M, N, B, name, state_definition, "s" );
+				k = checkpoint_interval ( full, name );
+				
+				ring.resize ( k );
+				
+				for ( size_t i = 0; i < k; i++ )
+					ring[i] = full;
+					
+			} else if ( stash_bits > 0 && S > 3 ) {
+			
+				State<T> full ( M, N, B, name, state_definition, "s" );
+				stash_activations ( full, name );
+				
+			}
 			
 			for ( size_t t = 0; t < S; t++ ) {
 			
 				s[t] = State<T> ( M, N, B, name, state_definition, "s" );
-				g[t] = State<T> ( M, N, B, name, state_definition, "g" );
+				
+				if ( k > 0 ) release ( t );
+				else if ( spill ) map_spill ( t );
+				else if ( stash ) map_stash ( t );
 				
 			}
 			
+			for ( size_t i = 0; i < g.size(); i++ )
+				g[i] = State<T> ( M, N, B, name, state_definition, "g" );
+				
 			p  = Parameters<T> ( name, param_definition, "parameters" );
 			d  = Parameters<T> ( name, param_definition, "gradients" );
 			m  = Parameters<T> ( name, param_definition, "memory" );
@@ -51,10 +83,269 @@ class Timelayer {
 			
 		};
 		
+		/*
+			checkpointed BPTT
+			
+			if bptt_memory_budget (bytes per layer) is set and all S states
+			do not fit, only x and y are kept for every t; the carried
+			tensors (h, c) are kept every k steps and everything else
+			lives in a ring of k States which is refilled segment by
+			segment during backward; k is the largest interval that fits
+		*/
+		
+		static size_t bptt_memory_budget;
+		
+		size_t k = 0;
+		std::vector<State<T>> ring;
+		
+		bool is_checkpoint ( size_t t ) {
+		
+			return t == 0 || t % k == 0 || t == S - 1;
+			
+		}
+		
+		size_t checkpoints ( size_t _k ) {
+		
+			return 1 + ( S - 1 ) / _k + ( ( ( S - 1 ) % _k ) != 0 );
+			
+		}
+		
+		size_t checkpoint_interval ( State<T> &full, std::string name ) {
+		
+			size_t F = 0, C = 0, K = 0;
+			
+			for ( auto &i : full.namemap ) {
+			
+				size_t bytes = full.matrices[i.second].size() * sizeof ( dtype );
+				
+				F += bytes;
+				
+				if ( i.first == "x" || i.first == "y" ) K += bytes;
+				else if ( is_carried ( i.first ) ) C += bytes;
+				
+			}
+			
+			// nothing to recompute from (e.g. softmax), or everything fits
+			if ( C == 0 || S < 3 || S * F <= bptt_memory_budget ) return 0;
+			
+			auto memory = [&] ( size_t _k ) { return S * K + checkpoints ( _k ) * C + _k * F; };
+			
+			size_t best = 1;
+			
+			for ( size_t _k = S - 2; _k > 0; _k-- ) {
+			
+				if ( memory ( _k ) <= bptt_memory_budget ) { best = _k; break; }
+				
+				if ( memory ( _k ) < memory ( best ) ) best = _k;
+				
+			}
+			
+			// the last segment is still resident after forward
+			size_t last = ( S - 1 ) % best == 0 ? best : ( S - 1 ) % best;
+			size_t recomputed = S - 1 - last;
+			
+			std::cout << "Timelayer() : " << name << " checkpointing every " << best << " steps, " <<
+					  memory ( best ) / ( 1 << 20 ) << " MB instead of " << S * F / ( 1 << 20 ) << " MB (budget " <<
+					  bptt_memory_budget / ( 1 << 20 ) << " MB), recomputing " << recomputed << "/" << S - 1 <<
+					  " forward steps" << std::endl;
+					
+			if ( memory ( best ) > bptt_memory_budget )
+				std::cout << "Timelayer() : " << name << " budget too small, using smallest footprint" << std::endl;
+				
+			return best;
+			
+		}
+		
+		bool is_carried ( const std::string &name ) {
+		
+			return name == "h" || name == "c";
+			
+		}
+		
+		/* point the tensors which are not stored at t into the ring */
+		void release ( size_t t ) {
+		
+			if ( t == 0 ) return;
+			
+			State<T> &slot = ring[ ( t - 1 ) % k];
+			
+			for ( auto &i : s[t].namemap ) {
+			
+				if ( i.first == "x" || i.first == "y" ) continue;
+				
+				if ( is_carried ( i.first ) && is_checkpoint ( t ) ) continue;
+				
+				s[t].matrices[i.second].alias ( slot.matrices[i.second] );
+				
+			}
+			
+		}
+		
+		/* rebuild the states of ( t0, t1 ] from the checkpoint at t0 */
+		void recompute ( size_t t0, size_t t1 ) {
+		
+			uint32_t step = rng_step;
+			
+			for ( size_t t = t0 + 1; t <= t1; t++ ) {
+			
+				// same random numbers as in the original pass
+				rng_step = rng_base + t - 1;
+				forward ( last_dropout, t );
+				
+			}
+			
+			rng_step = step;
+			
+		}
+		
+		/*
+			out-of-core BPTT
+			
+			if spill_directory is set, the host copy of every s[t]
+			(t > 0) lives in a memory-mapped scratch file and the device
+			copy in a ring of 2 States (forward ( t ) and backward ( t )
+			only touch t and t - 1); completed states are written out by
+			step() and read back in reverse order by an I/O thread during
+			backward, nothing is recomputed; takes precedence over
+			checkpointing
+		*/
+		
+		static std::string spill_directory;
+		
+		std::unique_ptr<Spill> spill;
+		std::vector<size_t> spill_offsets;
+		
+		void spill_to_file ( State<T> &full, std::string name ) {
+		
+			size_t bytes = 0;
+			
+			// 64B aligned tensors, in the order of full.matrices
+			for ( size_t i = 0; i < full.matrices.size(); i++ ) {
+			
+				spill_offsets.push_back ( bytes );
+				bytes += ( ( full.matrices[i].size() * sizeof ( dtype ) + 63 ) / 64 ) * 64;
+				
+			}
+			
+			spill.reset ( new Spill ( spill_directory, S - 1, bytes ) );
+			
+			if ( !spill->ok() ) {
+			
+				spill.reset();
+				return;
+				
+			}
+			
+			ring.resize ( 2 );
+			
+			for ( size_t i = 0; i < ring.size(); i++ )
+				ring[i] = full;
+				
+			std::cout << "Timelayer() : " << name << " spilling " << spill->size() / ( 1 << 20 ) << " MB of states to " <<
+					  spill_directory << std::endl;
+					
+		}
+		
+		void map_spill ( size_t t ) {
+		
+			if ( t == 0 ) return;
+			
+			char *region = spill->at ( t );
+			
+			for ( size_t i = 0; i < s[t].matrices.size(); i++ ) {
+			
+				s[t].matrices[i].alias ( ( dtype * ) ( region + spill_offsets[i] ) );
+				s[t].matrices[i].alias_device ( ring[t % 2].matrices[i] );
+				
+			}
+			
+		}
+		
+		/*
+			compressed activation stash
+			
+			if stash_bits is 8 or 16, the bounded tensors of s[1] ..
+			s[S - 3] (see unit_interval) live in a ring of 2 States, as
+			when spilling; once forward ( t ) is done they are encoded
+			into a per-step device stash in fixed point, and decoded back
+			into the ring just before backward ( t + 1 ) needs them; the
+			last two steps are still exact when backward starts and keep
+			their own storage (carry); c, x, the weights and the
+			gradients stay dtype; spilling and checkpointing take
+			precedence
+		*/
+		
+		static int stash_bits;
+		
+		std::unique_ptr<Stash> stash;
+		
+		/*
+			bounded tensors (sigmoid / tanh outputs of LSTM layers):
+			how many of their elements are in [0, 1], the rest are in
+			[-1, 1]; -1 - not bounded
+		*/
+		long unit_interval ( const std::string &name, size_t elements ) {
+		
+			// i, o, f, u
+			if ( name == "g" ) return 3 * elements / 4;
+			
+			if ( name == "h" || name == "ct" ) return 0;
+			
+			return -1;
+			
+		}
+		
+		void stash_activations ( State<T> &full, std::string name ) {
+		
+			stash.reset ( new Stash ( S - 3, stash_bits ) );
+			
+			size_t bytes = 0;
+			
+			for ( auto &i : full.namemap ) {
+			
+				size_t elements = full.matrices[i.second].size();
+				long unit = unit_interval ( i.first, elements );
+				
+				if ( unit < 0 ) continue;
+				
+				stash->add ( i.second, elements, unit );
+				bytes += elements * sizeof ( dtype );
+				
+			}
+			
+			// nothing bounded (e.g. softmax)
+			if ( stash->tensors.empty() || !stash->allocate() ) {
+			
+				stash.reset();
+				return;
+				
+			}
+			
+			ring.resize ( 2 );
+			
+			for ( size_t i = 0; i < ring.size(); i++ )
+				ring[i] = full;
+				
+			std::cout << "Timelayer() : " << name << " stashing activations in " << stash_bits << " bits, " <<
+					  ( stash->size() + 4 * bytes ) / ( 1 << 20 ) << " MB instead of " << ( S - 1 ) * bytes / ( 1 << 20 ) << " MB" <<
+					  std::endl;
+					
+		}
+		
+		void map_stash ( size_t t ) {
+		
+			if ( t == 0 || t + 2 >= S ) return;
+			
+			for ( auto &i : stash->tensors )
+				s[t].matrices[i.matrix].alias ( ring[t % 2].matrices[i.matrix] );
+				
+		}
+		
 		/* copy constr */
 		Timelayer ( const Timelayer &t ) :
 			p ( t.p ), d ( t.d ), m ( t.m ), n ( t.n ), u ( t.u ),
-			S ( t.S ), N ( t.N ), M ( t.M ), B ( t.B ) {
+			S ( t.S ), N ( t.N ), M ( t.M ), B ( t.B ),
+			rng_layer ( t.rng_layer ), rng_step ( t.rng_step ) {
 			s = t.s;
 			g = t.g;
 		}
@@ -65,6 +356,7 @@ class Timelayer {
 			/* just go over all members */
 			p = t.p; d = t.d; m = t.m; n = t.n; u = t.u;
 			S = t.S; B = t.B; M = t.M, N = t.N;
+			rng_layer = t.rng_layer; rng_step = t.rng_step;
 			s = t.s; g = t.g;
 			return *this;
 			
@@ -72,27 +364,258 @@ class Timelayer {
 		
 		/* TODO: move constr */
 		
+		/*
+			change B and S in place, e.g. for evaluation; states beyond S
+			are kept for later, storage only grows; the gradient slots and
+			B-sized parameters (B_ones) are not touched, so this is for
+			forward only; false (nothing changed) if not reshapable ()
+		*/
+		virtual bool reshape ( size_t _B, size_t _S ) {
+		
+			if ( !reshapable ( _S ) ) return false;
+			
+			for ( size_t t = s.size(); t < _S; t++ )
+				s.push_back ( s[0] );
+				
+			for ( size_t t = 0; t < _S; t++ )
+				s[t].resize_rows ( _B );
+				
+			B = _B;
+			S = _S;
+			
+			return true;
+			
+		}
+		
+		/* all states resident in dtype, S = 2 in inference mode */
+		bool reshapable ( size_t _S ) {
+		
+			if ( k > 0 || spill || stash || ( inference && _S != 2 ) ) {
+			
+				std::cout << "reshape() : not supported with checkpointing, spilling, stashing or S != 2 in inference mode" <<
+						  std::endl;
+				return false;
+				
+			}
+			
+			return true;
+			
+		}
+		
+		/*
+			read-only view of the parameters of src (host and device),
+			e.g. for an evaluation context; own parameters, gradients
+			and optimizer memory are released
+		*/
+		void share_parameters ( Timelayer &src ) {
+		
+			for ( size_t i = 0; i < p.matrices.size(); i++ )
+				p.matrices[i].alias ( src.p.matrices[i] );
+				
+			release_gradients();
+			
+		}
+		
+		/* device copy of the parameters of src, host copies are not synced */
+		void copy_parameters ( Timelayer &src ) {
+		
+			for ( size_t i = 0; i < p.matrices.size(); i++ )
+				cu_copy ( p.matrices[i], src.p.matrices[i] );
+				
+		}
+		
+		/* forward only from now on */
+		void release_gradients() {
+		
+			d = Parameters<T>();
+			m = Parameters<T>();
+			u = Parameters<T>();
+			n = Parameters<T>();
+			
+		}
+		
+		/* gradients and m only (dynamic.h) */
+		void release_updates() {
+		
+			u = Parameters<T>();
+			n = Parameters<T>();
+			
+		}
+		
+		/*
+			inference mode, one step at a time (S = 2): no gradient
+			states, gradients or optimizer memory, and carry ( 1 )
+			swaps the two slots instead of copying, so the carried
+			state stays where forward ( 1 ) left it (also on the
+			device)
+		*/
+		bool inference = false;
+		
+		/* false (nothing changed) if not inference_ready () */
+		bool inference_mode() {
+		
+			if ( !inference_ready() ) return false;
+			
+			g.clear();
+			release_gradients();
+			inference = true;
+			
+			return true;
+			
+		}
+		
+		bool inference_ready() {
+		
+			if ( S != 2 || k > 0 || spill || stash ) {
+			
+				std::cout << "inference_mode() : needs S = 2, no checkpointing, spilling or stashing" << std::endl;
+				return false;
+				
+			}
+			
+			return true;
+			
+		}
+		
+		/* zero the carried state of some rows, e.g. a stream joining a batch */
+		void reset_rows ( const std::vector<size_t> &rows ) {
+		
+			for ( auto &i : s[0].namemap ) {
+			
+				if ( !is_carried ( i.first ) ) continue;
+				
+				T &m = s[0].matrices[i.second];
+				m.sync_host();
+				
+				for ( size_t r : rows )
+					for ( size_t j = 0; j < m.cols(); j++ )
+						m ( r, j ) = 0;
+						
+				m.sync_device();
+				
+			}
+			
+		}
+		
+		/* carried values per row */
+		size_t carried_size() {
+		
+			size_t size = 0;
+			
+			for ( auto &i : s[0].namemap )
+				if ( is_carried ( i.first ) ) size += s[0].matrices[i.second].cols();
+				
+			return size;
+			
+		}
+		
+		/* carried state of some rows at t into host buffers of carried_size () values */
+		void store_rows ( size_t t, const std::vector<size_t> &rows, const std::vector<dtype *> &out ) {
+		
+			size_t offset = 0;
+			
+			for ( auto &i : s[t].namemap ) {
+			
+				if ( !is_carried ( i.first ) ) continue;
+				
+				T &m = s[t].matrices[i.second];
+				m.sync_host();
+				
+				for ( size_t k = 0; k < rows.size(); k++ )
+					for ( size_t j = 0; j < m.cols(); j++ )
+						out[k][offset + j] = m ( rows[k], j );
+						
+				offset += m.cols();
+				
+			}
+			
+		}
+		
+		/* the reverse, into state ( 0 ); nullptr - zero state */
+		void load_rows ( const std::vector<size_t> &rows, const std::vector<const dtype *> &in ) {
+		
+			size_t offset = 0;
+			
+			for ( auto &i : s[0].namemap ) {
+			
+				if ( !is_carried ( i.first ) ) continue;
+				
+				T &m = s[0].matrices[i.second];
+				m.sync_host();
+				
+				for ( size_t k = 0; k < rows.size(); k++ )
+					for ( size_t j = 0; j < m.cols(); j++ )
+						m ( rows[k], j ) = in[k] ? in[k][offset + j] : 0;
+						
+				m.sync_device();
+				offset += m.cols();
+				
+			}
+			
+		}
+		
+		/* state ( 0 ) = state ( t ) */
+		void carry ( size_t t ) {
+		
+			if ( inference ) s[0].matrices.swap ( s[t].matrices );
+			else s[0] = s[t];
+			
+		}
+		
+		/* forward ( t ) and write out the completed state */
+		void step ( bool apply_dropout, size_t t ) {
+		
+			forward ( apply_dropout, t );
+			
+			if ( spill ) {
+			
+				s[t].sync_host();
+				spill->store ( t );
+				
+			}
+			
+			// forward ( t + 2 ) reuses the slot of t
+			if ( stash && t + 2 < S ) stash->store ( t, s[t] );
+			
+		}
+		
+		/* call before step ( t ) for t = 1 .. S - 1 */
+		void start_sequence ( bool apply_dropout ) {
+		
+			rng_base = rng_step;
+			last_dropout = apply_dropout;
+			
+		}
+		
 		void forward ( bool apply_dropout, std::vector <State<T>> &input, char id ) {
 		
+			start_sequence ( apply_dropout );
+			
 			for ( size_t t = 1; t < S; t++ )
 				s[t]['x'] = input[t][id];
 				
 			for ( size_t t = 1; t < S; t++ )
-				forward ( apply_dropout, t );
+				step ( apply_dropout, t );
 				
 		}
 		
 		void forward ( bool apply_dropout, std::vector<T> &x ) {
 		
+			start_sequence ( apply_dropout );
+			
 			// sequence -> -> ->
 			for ( size_t t = 1; t < S; t++ )
 				s[t]['x'] =  x[t];
 				
 			for ( size_t t = 1; t < S; t++ )
-				forward ( apply_dropout, t );
+				step ( apply_dropout, t );
 				
 		}
 		
+		/*
+			dy[t] - error coming from above, on return dy[t] holds
+			the error wrt inputs of this layer (for the layer below)
+		*/
 		void backward ( bool apply_dropout, std::vector<T> &dy ) {
 		
 			//d.zero();
@@ -102,27 +625,57 @@ class Timelayer {
 			// for ( size_t w = 0; w < d.matrices.size(); w++ )
 			// 	d.matrices[w].sync_device();
 			
+			prepare_grad ( S - 1, dy );
 			
-			for ( size_t t = 0; t < S; t++ ) {
-			
-				/* CPU */
-				/* 			g[t].zero();
-							g[t]['y'] = dy[t]; */
-				g[t].cu_zero();
-				g[t]['y'] = dy[t];
-				g[t]['y'].sync_device();
-				
-			}
+			// S - 1 and S - 2 are still on the device
+			if ( spill ) spill->prefetch ( S - 3 );
 			
 			// sequence <- <- <-
-			for ( size_t t = S - 1; t > 0; t-- )
+			for ( size_t t = S - 1; t > 0; t-- ) {
+			
+				// t - 1 receives the carried error (y, c, ...) from t
+				prepare_grad ( t - 1, dy );
+				
+				// entering a new segment, the last one is still resident
+				if ( k > 0 && is_checkpoint ( t ) && t != S - 1 )
+					recompute ( t - k, t );
+					
+				if ( spill && t > 1 && t < S - 1 ) {
+				
+					spill->wait ( t - 1 );
+					s[t - 1].sync_device();
+					
+				}
+				
+				if ( stash && t > 1 && t < S - 1 ) stash->load ( t - 1, s[t - 1] );
+				
 				backward ( apply_dropout, t );
 				
-			for ( size_t t = 0; t < S; t++ )
-			
-				g[t]['x'].sync_host();
+				if ( spill ) spill->release ( t );
 				
 				
+				// dy[t] has already been consumed
+				grad ( t ) ['x'].sync_host();
+				dy[t] = grad ( t ) ['x'];
+				
+			}
+			
+			dy[0] = grad ( 0 ) ['x'];
+			
+			if ( spill ) spill->join();
+			
+		}
+		
+		/* recycle the slot of t + 2 for t */
+		void prepare_grad ( size_t t, std::vector<T> &dy ) {
+		
+			/* CPU */
+			/* 			grad ( t ).zero();
+						grad ( t ) ['y'] = dy[t]; */
+			grad ( t ).cu_zero();
+			grad ( t ) ['y'] = dy[t];
+			grad ( t ) ['y'].sync_device();
+			
 		}
 		
 		// void sync_state(size_t t) {
@@ -146,12 +699,18 @@ class Timelayer {
 		
 			s is used during inference (actual states)
 			g is used during learning (gradient states)
-		
+			
+			BPTT only carries the error from t to t - 1, so g holds
+			two slots, grad ( t ) = g[t % 2]; weight gradients are
+			accumulated in d
+			
 		*/
 		
 		/* change to State* and Parameter* */
 		std::vector<State<T>> s, g;
 		
+		State<T> &grad ( size_t t ) { return g[t % g.size()]; }
+		
 		/* weights */
 		Parameters<T> p, d, m, n, u;
 		
@@ -165,11 +724,28 @@ class Timelayer {
 		
 			M and N are properties of the parameters
 			S and B are needed for learning, can be changed for given M and N
+			(see reshape)
 		
 		*/
 		
 		size_t S, B, M, N;
 		
+		/*
+			random numbers of stochastic layers are keyed by
+			(seed, rng_layer, rng_step, element), see philox.h
+		*/
+		
+		uint32_t rng_layer = 0;
+		uint32_t rng_step = 0;
+		uint32_t rng_base = 0;
+		bool last_dropout = false;
+		
+		philox_key next_rng_key() {
+		
+			return make_philox_key ( philox_seed, rng_layer, rng_step++ );
+			
+		}
+		
 		void sync_all_host() {
 		
 			// for ( size_t t = 0; t < S; t++ ) {
@@ -196,9 +772,53 @@ class Timelayer {
 		/* FLOPS */
 };
 
+template <typename T>
+size_t Timelayer<T>::bptt_memory_budget = 0;
+
+template <typename T>
+std::string Timelayer<T>::spill_directory = "";
+
+template <typename T>
+int Timelayer<T>::stash_bits = 0;
+
+/*
+	layers built while it exists keep all states resident in
+	dtype (no spilling, checkpointing or stashing); the settings
+	come back when it goes out of scope
+*/
+template <typename T>
+class ResidentStates {
+
+	public:
+	
+		ResidentStates() : spill_directory ( Timelayer<T>::spill_directory ),
+			bptt_memory_budget ( Timelayer<T>::bptt_memory_budget ), stash_bits ( Timelayer<T>::stash_bits ) {
+			
+			Timelayer<T>::spill_directory = "";
+			Timelayer<T>::bptt_memory_budget = 0;
+			Timelayer<T>::stash_bits = 0;
+			
+		}
+		
+		~ResidentStates() {
+		
+			Timelayer<T>::spill_directory = spill_directory;
+			Timelayer<T>::bptt_memory_budget = bptt_memory_budget;
+			Timelayer<T>::stash_bits = stash_bits;
+			
+		}
+		
+	protected:
+	
+		std::string spill_directory;
+		size_t bptt_memory_budget;
+		int stash_bits;
+		
+};
+
 #define p(x) this->p[#x]
 #define d(x) this->d[#x]
 #define s(t, x) this->s[t][#x]
-#define g(t, x) this->g[t][#x]
+#define g(t, x) this->grad(t)[#x]
 
 #endif /* __TIMELAYER_H__ */
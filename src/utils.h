@@ -67,6 +67,6 @@ std::string to_string_with_precision ( const T a_value, const int n = 6 ) {
 								  std::setw(2) << eta.tm_sec << " s, " << test_eta << " s)" << std::setfill(' ') << \
 								  std::setw(8) << std::setprecision(6) << "ce = " << smooth_loss << \
 								  std::setw(7) << std::setprecision(1) << gflops_per_sec << \
-								  " GFlOP/s    " << "\r" << std::flush;
+								  " GFlOP/s, batch wait " << std::setprecision(2) << batch_wait << " s" << input_info << "    " << "\r" << std::flush;
 
 #endif